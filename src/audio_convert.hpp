@@ -0,0 +1,267 @@
+#ifndef AUDIO_CONVERT_HPP
+#define AUDIO_CONVERT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define AUDIO_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+// Conversions between the router's interleaved int32 audio and the sample
+// formats and layouts other systems want
+// Every kernel gives bit-identical results to the scalar loop next to it
+namespace audio {
+
+// Full scale for int32, a power of two so scaling is exact
+inline constexpr auto int32_full_scale = 2147483648.0f;
+// The largest float below full scale, 1.0 and above clip to this
+inline constexpr auto int32_max_float = 2147483520.0f;
+
+inline auto int32_to_float(int32_t sample) -> float {
+  return static_cast<float>(sample) * (1.0f / int32_full_scale);
+}
+
+// NaN goes to the int32 minimum, as the AVX2 kernel's max_ps gives it
+inline auto float_to_int32(float sample) -> int32_t {
+  if (sample != sample) {
+    return std::numeric_limits<int32_t>::min();
+  }
+  return static_cast<int32_t>(std::clamp(sample * int32_full_scale,
+                                         -int32_full_scale, int32_max_float));
+}
+
+inline auto int16_to_int32(int16_t sample) -> int32_t {
+  return static_cast<int32_t>(static_cast<uint32_t>(sample) << 16);
+}
+
+inline auto int32_to_int16(int32_t sample) -> int16_t {
+  return static_cast<int16_t>(sample >> 16);
+}
+
+#if defined(AUDIO_CONVERT_X86)
+
+[[gnu::target("avx2")]] inline void
+int32_to_float_avx2(float *dst, int32_t const *src, std::size_t count) {
+  auto const scale = _mm256_set1_ps(1.0f / int32_full_scale);
+  auto i = std::size_t{0};
+  for (; i + 8 <= count; i += 8) {
+    auto const s =
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), scale));
+  }
+  for (; i < count; i += 1) {
+    dst[i] = int32_to_float(src[i]);
+  }
+}
+
+[[gnu::target("avx2")]] inline auto float_to_int32_avx2(__m256 sample)
+    -> __m256i {
+  auto const scaled = _mm256_mul_ps(sample, _mm256_set1_ps(int32_full_scale));
+  return _mm256_cvttps_epi32(
+      _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(-int32_full_scale)),
+                    _mm256_set1_ps(int32_max_float)));
+}
+
+[[gnu::target("avx2")]] inline void
+float_to_int32_avx2(int32_t *dst, float const *src, std::size_t count) {
+  auto i = std::size_t{0};
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        float_to_int32_avx2(_mm256_loadu_ps(src + i)));
+  }
+  for (; i < count; i += 1) {
+    dst[i] = float_to_int32(src[i]);
+  }
+}
+
+[[gnu::target("avx2")]] inline void
+int16_to_int32_avx2(int32_t *dst, int16_t const *src, std::size_t count) {
+  auto i = std::size_t{0};
+  for (; i + 8 <= count; i += 8) {
+    auto const s = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_slli_epi32(s, 16));
+  }
+  for (; i < count; i += 1) {
+    dst[i] = int16_to_int32(src[i]);
+  }
+}
+
+[[gnu::target("avx2")]] inline void
+int32_to_int16_avx2(int16_t *dst, int32_t const *src, std::size_t count) {
+  auto i = std::size_t{0};
+  for (; i + 16 <= count; i += 16) {
+    auto const a = _mm256_srai_epi32(
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i)), 16);
+    auto const b = _mm256_srai_epi32(
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i + 8)),
+        16);
+    // packs works within 128 bit lanes, so put the quarters back in order
+    auto const packed =
+        _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0b11011000);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+  }
+  for (; i < count; i += 1) {
+    dst[i] = int32_to_int16(src[i]);
+  }
+}
+
+// Stereo is by far the most common, so it gets its own shuffles
+[[gnu::target("avx2")]] inline void
+stereo_to_float_planar_avx2(float *left, float *right, int32_t const *src,
+                            std::size_t samples) {
+  auto const scale = _mm256_set1_ps(1.0f / int32_full_scale);
+  auto i = std::size_t{0};
+  for (; i + 8 <= samples; i += 8) {
+    auto const a = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(src + 2 * i))),
+        scale);
+    auto const b = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(src + 2 * i + 8))),
+        scale);
+    // Shuffles stay within 128 bit lanes, leaving 0 1 4 5 2 3 6 7
+    auto const l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    auto const r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm256_storeu_ps(left + i,
+                     _mm256_castpd_ps(_mm256_permute4x64_pd(
+                         _mm256_castps_pd(l), 0b11011000)));
+    _mm256_storeu_ps(right + i,
+                     _mm256_castpd_ps(_mm256_permute4x64_pd(
+                         _mm256_castps_pd(r), 0b11011000)));
+  }
+  for (; i < samples; i += 1) {
+    left[i] = int32_to_float(src[2 * i]);
+    right[i] = int32_to_float(src[2 * i + 1]);
+  }
+}
+
+[[gnu::target("avx2")]] inline void
+float_planar_to_stereo_avx2(int32_t *dst, float const *left,
+                            float const *right, std::size_t samples) {
+  auto i = std::size_t{0};
+  for (; i + 8 <= samples; i += 8) {
+    auto const l = float_to_int32_avx2(_mm256_loadu_ps(left + i));
+    auto const r = float_to_int32_avx2(_mm256_loadu_ps(right + i));
+    // Unpacks stay within 128 bit lanes, so swap the middle quarters after
+    auto const lo = _mm256_unpacklo_epi32(l, r);
+    auto const hi = _mm256_unpackhi_epi32(l, r);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * i),
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * i + 8),
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  for (; i < samples; i += 1) {
+    dst[2 * i] = float_to_int32(left[i]);
+    dst[2 * i + 1] = float_to_int32(right[i]);
+  }
+}
+
+#endif // AUDIO_CONVERT_X86
+
+// Checked once, without AVX2 the plain loops are left to the compiler
+inline auto use_avx2() -> bool {
+#if defined(AUDIO_CONVERT_X86)
+  static auto const supported = __builtin_cpu_supports("avx2") != 0;
+  return supported;
+#else
+  return false;
+#endif
+}
+
+inline void convert(std::span<int32_t const> src, std::span<float> dst) {
+  auto const count = std::min(src.size(), dst.size());
+#if defined(AUDIO_CONVERT_X86)
+  if (use_avx2()) {
+    return int32_to_float_avx2(dst.data(), src.data(), count);
+  }
+#endif
+  for (std::size_t i = 0; i < count; i += 1) {
+    dst[i] = int32_to_float(src[i]);
+  }
+}
+
+inline void convert(std::span<float const> src, std::span<int32_t> dst) {
+  auto const count = std::min(src.size(), dst.size());
+#if defined(AUDIO_CONVERT_X86)
+  if (use_avx2()) {
+    return float_to_int32_avx2(dst.data(), src.data(), count);
+  }
+#endif
+  for (std::size_t i = 0; i < count; i += 1) {
+    dst[i] = float_to_int32(src[i]);
+  }
+}
+
+inline void convert(std::span<int16_t const> src, std::span<int32_t> dst) {
+  auto const count = std::min(src.size(), dst.size());
+#if defined(AUDIO_CONVERT_X86)
+  if (use_avx2()) {
+    return int16_to_int32_avx2(dst.data(), src.data(), count);
+  }
+#endif
+  for (std::size_t i = 0; i < count; i += 1) {
+    dst[i] = int16_to_int32(src[i]);
+  }
+}
+
+inline void convert(std::span<int32_t const> src, std::span<int16_t> dst) {
+  auto const count = std::min(src.size(), dst.size());
+#if defined(AUDIO_CONVERT_X86)
+  if (use_avx2()) {
+    return int32_to_int16_avx2(dst.data(), src.data(), count);
+  }
+#endif
+  for (std::size_t i = 0; i < count; i += 1) {
+    dst[i] = int32_to_int16(src[i]);
+  }
+}
+
+// Interleaved int32 to one float plane per channel, each plane starting
+// stride samples after the last
+inline void deinterleave(std::span<int32_t const> src, std::size_t channels,
+                         float *dst, std::size_t stride) {
+  auto const samples = src.size() / channels;
+#if defined(AUDIO_CONVERT_X86)
+  if (channels == 2 && use_avx2()) {
+    return stereo_to_float_planar_avx2(dst, dst + stride, src.data(),
+                                       samples);
+  }
+#endif
+  for (std::size_t channel = 0; channel < channels; channel += 1) {
+    auto *plane = dst + channel * stride;
+    for (std::size_t sample = 0; sample < samples; sample += 1) {
+      plane[sample] = int32_to_float(src[sample * channels + channel]);
+    }
+  }
+}
+
+// The reverse of deinterleave
+inline void interleave(float const *src, std::size_t stride,
+                       std::size_t channels, std::span<int32_t> dst) {
+  auto const samples = dst.size() / channels;
+#if defined(AUDIO_CONVERT_X86)
+  if (channels == 2 && use_avx2()) {
+    return float_planar_to_stereo_avx2(dst.data(), src, src + stride,
+                                       samples);
+  }
+#endif
+  for (std::size_t channel = 0; channel < channels; channel += 1) {
+    auto const *plane = src + channel * stride;
+    for (std::size_t sample = 0; sample < samples; sample += 1) {
+      dst[sample * channels + channel] = float_to_int32(plane[sample]);
+    }
+  }
+}
+
+} // namespace audio
+
+#endif // AUDIO_CONVERT_HPP
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "../compositor.hpp"
+
+// Throughput of each alpha_over kernel the CPU supports, in GB/s of dst, and
+// of compositing a whole output band by band against layer by layer
+// Build with CMAKE_BUILD_TYPE=Release, the numbers mean nothing unoptimised
+
+namespace {
+
+using namespace std::chrono_literals;
+
+auto random_frame(std::size_t size) -> std::vector<uint8_t> {
+  auto rng = std::mt19937{1};
+  auto dist = std::uniform_int_distribution<int>{0, 255};
+  auto bytes = std::vector<uint8_t>(size);
+  for (auto &byte : bytes) {
+    byte = static_cast<uint8_t>(dist(rng));
+  }
+  return bytes;
+}
+
+// Repeats f until at least half a second has passed, returns GB/s given
+// that each call processes bytes
+auto measure(std::size_t bytes, auto &&f) -> double {
+  f(); // Warm up, page in and pick the kernel
+  auto calls = std::size_t{0};
+  auto const start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::duration{};
+  do {
+    f();
+    calls += 1;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < 500ms);
+  return static_cast<double>(bytes * calls) /
+         std::chrono::duration<double>(elapsed).count() / 1e9;
+}
+
+} // namespace
+
+auto main() -> int {
+  // One line stays in L1, so is bound by the kernel, a whole frame is bound
+  // by memory
+  auto const line = std::size_t{1920 * 4};
+  auto const frame = line * 1080;
+
+  auto const src = random_frame(frame);
+  auto dst = random_frame(frame);
+
+  std::printf("%-10s %14s %14s\n", "alpha_over", "line GB/s", "1080p GB/s");
+  for (auto isa_ : {compositor::isa::scalar, compositor::isa::sse2,
+                    compositor::isa::avx2, compositor::isa::avx512}) {
+    if (!compositor::supported(isa_)) {
+      std::printf("%-10s %14s %14s\n", compositor::isa_name(isa_), "-", "-");
+      continue;
+    }
+    auto const kernel = compositor::alpha_over_kernel(isa_);
+    auto const in_cache = measure(
+        line, [&] { kernel(dst.data(), src.data(), line); });
+    auto const in_memory = measure(
+        frame, [&] { kernel(dst.data(), src.data(), frame); });
+    std::printf("%-10s %14.2f %14.2f\n", compositor::isa_name(isa_), in_cache,
+                in_memory);
+  }
+
+  // Every tile mixed, the worst case, so no tile can be skipped or copied
+  auto const format = compositor::raster{1920, 1080, line};
+  auto const map = [&] {
+    auto map = compositor::alpha_map{format};
+    map.classify(src.data(), format);
+    return map;
+  }();
+  auto out = std::vector<uint8_t>(frame);
+
+  std::printf("\n%-10s %14s %14s\n", "layers", "layered ms", "banded ms");
+  for (auto count : {std::size_t{2}, std::size_t{4}, std::size_t{8}}) {
+    auto const frames = std::vector<std::vector<uint8_t>>(count, src);
+    auto layers = std::vector<compositor::layer>{};
+    for (auto const &layer_frame : frames) {
+      layers.emplace_back(layer_frame.data(), map);
+    }
+
+    // As before composite, copy the bottom layer and then blend each layer
+    // over the whole band in turn
+    auto const layered = measure(frame, [&] {
+      for (std::size_t row = 0; row < map.rows(); row += 1) {
+        compositor::copy(out.data(), frames[0].data(), map, format, row);
+        for (std::size_t i = 1; i < count; i += 1) {
+          compositor::alpha_over(out.data(), frames[i].data(), map, format,
+                                 row);
+        }
+      }
+    });
+    auto const banded = measure(frame, [&] {
+      for (std::size_t row = 0; row < map.rows(); row += 1) {
+        compositor::composite(out.data(), std::span{layers}, format, row);
+      }
+    });
+    std::printf("%-10zu %14.2f %14.2f\n", count,
+                static_cast<double>(frame) / layered / 1e6,
+                static_cast<double>(frame) / banded / 1e6);
+  }
+}
@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../ipc_shared_object.hpp"
+#include "../triple_buffer.hpp"
+
+// CPU used by output processes waiting for the router's frames
+// Writes a frame to each of N segments at the frame rate, like the router, and
+// reports the CPU time and context switches of the process reading each one,
+// either blocking in wait_for_novel or, with --spin, busy polling
+// Usage: wakeup_bench [outputs] [seconds] [--spin]
+
+namespace {
+
+using namespace std::chrono_literals;
+
+[[noreturn]] void read_frames(char const *name, bool spin) {
+  auto segment = ipc_unmanaged_object<triple_buffer>{name};
+  while (true) {
+    if (spin) {
+      while (!segment->novel_to_read()) {
+      }
+    } else if (!segment->wait_for_novel(1s)) {
+      break;
+    }
+    // The last frame starts with a zero, telling the reader to stop
+    if (segment->about_to_read() && segment->read().video_frame()[0] == 0) {
+      break;
+    }
+  }
+  std::exit(0);
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  auto const outputs = argc > 1 ? std::atoi(argv[1]) : 4;
+  auto const seconds = argc > 2 ? std::atoi(argv[2]) : 5;
+  auto const spin = argc > 3 && argv[3] == std::string_view{"--spin"};
+
+  auto format = media_format{};
+  auto segments =
+      std::vector<std::unique_ptr<ipc_managed_object<triple_buffer>>>{};
+  auto readers = std::vector<pid_t>{};
+  for (auto i = 0; i < outputs; i += 1) {
+    segments.push_back(
+        std::make_unique<ipc_managed_object<triple_buffer>>(format));
+    auto const pid = fork();
+    if (pid == 0) {
+      read_frames(segments.back()->name().c_str(), spin);
+    }
+    readers.push_back(pid);
+  }
+
+  auto const period = format.frame_duration();
+  auto next = std::chrono::steady_clock::now();
+  auto const end = next + std::chrono::seconds{seconds};
+  while (next < end) {
+    next += period;
+    std::this_thread::sleep_until(next);
+    for (auto &segment : segments) {
+      (*segment)->write().video_frame()[0] = 1;
+      (*segment)->done_writing();
+    }
+  }
+  for (auto &segment : segments) {
+    (*segment)->write().video_frame()[0] = 0;
+    (*segment)->done_writing();
+  }
+
+  std::printf("%d outputs %s for %ds at %u/%u fps\n", outputs,
+              spin ? "spinning" : "waiting", seconds, format.frame_rate_num,
+              format.frame_rate_den);
+  std::printf("%-8s %10s %10s %12s %12s\n", "output", "cpu %", "cpu ms",
+              "voluntary", "involuntary");
+  for (std::size_t i = 0; i < readers.size(); i += 1) {
+    auto status = 0;
+    auto usage = rusage{};
+    wait4(readers[i], &status, 0, &usage);
+    auto const cpu_ms =
+        static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+            1e3 +
+        static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+            1e3;
+    std::printf("%-8zu %10.2f %10.1f %12ld %12ld\n", i,
+                cpu_ms / 10 / seconds, cpu_ms, usage.ru_nvcsw, usage.ru_nivcsw);
+  }
+}
@@ -0,0 +1,476 @@
+#ifndef BROADCAST_BUFFER_HPP
+#define BROADCAST_BUFFER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include <boost/interprocess/sync/interprocess_condition_any.hpp>
+
+#include "pipeline_stats.hpp"
+#include "triple_buffer.hpp"
+
+#if defined(__linux__)
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
+
+// Like triple_buffer, but for one writer and any number of readers up to the
+// segment's capacity, each with its own cursor, so a source can feed the
+// router's tick and its previews, or a recorder, at once
+// Every reader picks up the newest frame written, and holds it in its slot
+// until its next about_to_read, there are enough slots that the writer always
+// finds one nobody holds, so it never waits for a slow reader
+class broadcast_buffer {
+public:
+  using buffer = triple_buffer::buffer;
+
+  static constexpr auto max_readers = std::size_t{8};
+
+private:
+  // Bumped whenever the layout of the segment changes
+  static constexpr auto layout_version = uint32_t{2};
+
+  // Slot in the low bits and sequence number above
+  static constexpr auto slot_bits = 8;
+  static constexpr auto slot_mask = (uint64_t{1} << slot_bits) - 1;
+  static_assert(max_readers + 3 <= slot_mask,
+                "Slot doesn't fit in the shared word");
+
+  static constexpr auto no_slot = ~uint32_t{0};
+
+  // A reader not heard from for this long is taken to have died, and its
+  // cursor is handed to the next reader to attach once none are free
+  static constexpr auto stale_reader = std::chrono::seconds{2};
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "The shared words must be address free");
+
+  struct cursor {
+    // The reader's generation above and the slot it holds below
+    // The generation is zero while the cursor is free and bumped on every
+    // attach, and the word only ever changes by compare and swap against
+    // it, so a reader that was given up on can't touch what its successor
+    // inherited
+    alignas(64) std::atomic<uint64_t> state;
+    // Steady clock nanoseconds of the last about_to_read
+    std::atomic<uint64_t> last_seen;
+  };
+
+  static constexpr auto pack(uint32_t generation, uint32_t slot) -> uint64_t {
+    return uint64_t{generation} << 32 | slot;
+  }
+  static constexpr auto generation_of(uint64_t state) -> uint32_t {
+    return static_cast<uint32_t>(state >> 32);
+  }
+  static constexpr auto slot_of(uint64_t state) -> uint32_t {
+    return static_cast<uint32_t>(state);
+  }
+
+  uint32_t _layout_version = layout_version;
+  media_format _format;
+  // Readers the segment has room for
+  uint32_t _readers;
+
+  ipc::interprocess_condition_any sync;
+
+  // The newest frame written, stored only by the writer
+  alignas(64) std::atomic<uint64_t> latest;
+  // The low bits of latest's sequence, for readers to sleep on
+  std::atomic<uint32_t> published;
+  std::atomic<uint32_t> waiters;
+
+  // Readers holding each slot
+  alignas(64) std::array<std::atomic<uint32_t>, max_readers + 3> refs;
+
+  // Only touched by the writer
+  alignas(64) uint32_t write_index;
+  uint64_t write_sequence;
+
+  std::array<cursor, max_readers> cursors;
+
+  pipeline_stats _stats;
+
+  // One per reader, the newest frame, the one being written, and one more as
+  // a reader taken over part way through about_to_read may still hold a
+  // reference for a moment
+  auto slots() const -> std::size_t { return std::size_t{_readers} + 3; }
+
+  static constexpr auto header_size() -> std::size_t {
+    return (sizeof(broadcast_buffer) + 63) / 64 * 64;
+  }
+
+  auto buffer_at(std::size_t i) -> buffer * {
+    return reinterpret_cast<buffer *>(reinterpret_cast<std::byte *>(this) +
+                                      header_size() +
+                                      i * buffer::required_size(_format));
+  }
+  auto buffer_at(std::size_t i) const -> buffer const * {
+    return const_cast<broadcast_buffer *>(this)->buffer_at(i);
+  }
+
+  // Moves the cursor's reference from the slot it holds to the newest frame,
+  // letting go first so no reader holds more than one slot
+  // Returns that frame's sequence, or nothing if the cursor was taken over
+  // meanwhile, in which case whatever it held is the new owner's
+  auto take_newest(cursor &cursor_, uint32_t generation, uint32_t &held)
+      -> std::optional<uint64_t> {
+    auto expected = pack(generation, held);
+    auto const previous = std::exchange(held, no_slot);
+    if (!cursor_.state.compare_exchange_strong(
+            expected, pack(generation, no_slot), std::memory_order_acq_rel)) {
+      return std::nullopt;
+    }
+    if (previous != no_slot) {
+      refs[previous].fetch_sub(1, std::memory_order_release);
+    }
+
+    auto current = latest.load(std::memory_order_seq_cst);
+    while (true) {
+      auto const slot = static_cast<uint32_t>(current & slot_mask);
+      refs[slot].fetch_add(1, std::memory_order_seq_cst);
+      // The writer only reuses a slot that isn't the newest, so once it is
+      // held while still the newest it is safe until released
+      auto const again = latest.load(std::memory_order_seq_cst);
+      if (again == current) {
+        break;
+      }
+      refs[slot].fetch_sub(1, std::memory_order_release);
+      current = again;
+    }
+
+    auto const slot = static_cast<uint32_t>(current & slot_mask);
+    expected = pack(generation, no_slot);
+    if (!cursor_.state.compare_exchange_strong(expected, pack(generation, slot),
+                                               std::memory_order_acq_rel)) {
+      refs[slot].fetch_sub(1, std::memory_order_release);
+      return std::nullopt;
+    }
+    held = slot;
+    return current >> slot_bits;
+  }
+
+public:
+  // The segment must be at least required_size(format, readers) bytes
+  broadcast_buffer(media_format const &format = {},
+                   std::size_t readers = max_readers)
+      : _format{format}, _readers{static_cast<uint32_t>(readers)} {
+    if (readers == 0 || readers > max_readers) {
+      std::cerr << "A broadcast_buffer has room for 1 to " << max_readers
+                << " readers, not " << readers << '\n';
+      std::terminate();
+    }
+    for (std::size_t i = 0; i < slots(); i += 1) {
+      ::new (buffer_at(i)) buffer{_format};
+    }
+    for (auto &ref : refs) {
+      ref = 0;
+    }
+    for (auto &cursor_ : cursors) {
+      cursor_.state = pack(0, no_slot);
+      cursor_.last_seen = 0;
+    }
+    // Readers start out on a cleared frame, the same as a triple_buffer
+    latest = 0;
+    published = 0;
+    waiters = 0;
+    write_index = 1;
+    write_sequence = 0;
+    write()._writes.store(1, std::memory_order_relaxed);
+  }
+
+  broadcast_buffer(broadcast_buffer const &) = delete;
+
+  static auto required_size(media_format const &format = {},
+                            std::size_t readers = max_readers)
+      -> std::size_t {
+    return header_size() + (readers + 3) * buffer::required_size(format);
+  }
+
+  // Checked by processes attaching to a segment created by the router
+  auto compatible(std::size_t segment_size) const -> bool {
+    return _layout_version == layout_version && _format.supported() &&
+           _readers != 0 && _readers <= max_readers &&
+           segment_size >= required_size(_format, _readers);
+  }
+
+  auto format() const -> media_format const & { return _format; }
+
+  auto stats() -> pipeline_stats & { return _stats; }
+  auto stats() const -> pipeline_stats const & { return _stats; }
+
+  // Readers can come and go, a slow one only ever misses frames
+  // One that goes quiet for too long may lose its cursor to a new reader,
+  // after which its about_to_read returns false and it must attach again
+  class reader {
+  private:
+    broadcast_buffer *segment;
+    std::size_t index;
+    uint32_t generation;
+    // Only one reader of a segment should count its reads in its stats
+    bool records_stats;
+
+    // Of the frame read, both only touched by this reader
+    uint64_t sequence;
+    uint32_t held;
+
+    auto own() const -> cursor & { return segment->cursors[index]; }
+
+  public:
+    reader(broadcast_buffer &segment, std::size_t index, uint32_t generation,
+           bool records_stats, uint64_t sequence, uint32_t held)
+        : segment{&segment}, index{index}, generation{generation},
+          records_stats{records_stats}, sequence{sequence}, held{held} {}
+
+    reader(reader const &) = delete;
+    reader(reader &&other) noexcept
+        : segment{std::exchange(other.segment, nullptr)}, index{other.index},
+          generation{other.generation}, records_stats{other.records_stats},
+          sequence{other.sequence}, held{other.held} {}
+
+    auto operator=(reader &&other) noexcept -> reader & {
+      std::swap(segment, other.segment);
+      std::swap(index, other.index);
+      std::swap(generation, other.generation);
+      std::swap(records_stats, other.records_stats);
+      std::swap(sequence, other.sequence);
+      std::swap(held, other.held);
+      return *this;
+    }
+
+    ~reader() {
+      if (segment == nullptr) {
+        return;
+      }
+      auto expected = pack(generation, held);
+      if (own().state.compare_exchange_strong(expected, pack(0, no_slot),
+                                              std::memory_order_acq_rel) &&
+          held != no_slot) {
+        segment->refs[held].fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    // False once the cursor was given to another reader
+    auto attached() const -> bool {
+      return generation_of(own().state.load(std::memory_order_acquire)) ==
+             generation;
+    }
+
+    auto novel_to_read() const -> bool {
+      return segment->latest.load(std::memory_order_relaxed) >> slot_bits !=
+             sequence;
+    }
+
+    // Keeps the cursor for a reader that goes a while between reads, a reader
+    // is only seen while it reads or calls this
+    void keep_alive() {
+      if (attached()) {
+        own().last_seen.store(pipeline_stats::now(),
+                              std::memory_order_relaxed);
+      }
+    }
+
+    // Returns whether read() now refers to a newly written frame
+    auto about_to_read() -> bool {
+      keep_alive();
+      if (!novel_to_read() || !attached()) {
+        if (records_stats) {
+          segment->_stats.record_repeated();
+        }
+        return false;
+      }
+
+      auto const newest = segment->take_newest(own(), generation, held);
+      if (!newest) {
+        return false;
+      }
+      if (records_stats) {
+        segment->_stats.record_read(
+            static_cast<uint32_t>(*newest - sequence - 1));
+      }
+      sequence = *newest;
+      return true;
+    }
+
+    // Blocks until there is a new frame or the timeout passes, returns
+    // whether there is a new frame
+    auto wait_for_novel(std::chrono::nanoseconds timeout) -> bool {
+      auto const deadline = std::chrono::steady_clock::now() + timeout;
+      while (true) {
+        auto const current =
+            segment->published.load(std::memory_order_seq_cst);
+        if (novel_to_read()) {
+          return true;
+        }
+        auto const remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::nanoseconds::zero()) {
+          return false;
+        }
+#if defined(__linux__)
+        auto const ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(remaining)
+                .count();
+        auto const timeout_ =
+            timespec{static_cast<time_t>(ns / 1'000'000'000),
+                     static_cast<long>(ns % 1'000'000'000)};
+        segment->waiters.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&segment->published),
+                FUTEX_WAIT, current, &timeout_, nullptr, 0);
+        segment->waiters.fetch_sub(1, std::memory_order_relaxed);
+#else
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+            remaining, std::chrono::milliseconds{1}));
+#endif
+      }
+    }
+
+    // The frame held since attach or the last about_to_read, which stays put
+    // until the next one
+    // A reader whose cursor was taken over holds nothing and mustn't read
+    auto read() const -> buffer const & {
+      if (held == no_slot) {
+        std::cerr << "Read from a broadcast_buffer reader that holds no "
+                     "frame, its cursor was taken over\n";
+        std::terminate();
+      }
+      return *segment->buffer_at(held);
+    }
+  };
+
+  // Takes a free cursor, or failing that one whose reader has gone quiet,
+  // nothing if every cursor is in use
+  // The reader starts out holding the newest frame, which is still novel to
+  // it once anything was written, so its first about_to_read picks it up
+  auto attach(bool records_stats = false) -> std::optional<reader> {
+    auto const now = pipeline_stats::now();
+    for (auto const reclaim : {false, true}) {
+      for (std::size_t i = 0; i < _readers; i += 1) {
+        auto &cursor_ = cursors[i];
+        auto state = cursor_.state.load(std::memory_order_acquire);
+        auto const generation = generation_of(state);
+        auto const quiet = std::chrono::nanoseconds{static_cast<int64_t>(
+            now - cursor_.last_seen.load(std::memory_order_relaxed))};
+        if (generation != 0 && (!reclaim || quiet < stale_reader)) {
+          continue;
+        }
+        auto const next = generation + 1 == 0 ? 1 : generation + 1;
+        // Whatever slot the cursor holds is the new reader's to let go of
+        if (!cursor_.state.compare_exchange_strong(
+                state, pack(next, slot_of(state)),
+                std::memory_order_acq_rel)) {
+          continue;
+        }
+        cursor_.last_seen.store(now, std::memory_order_relaxed);
+
+        auto held = slot_of(state);
+        auto const newest = take_newest(cursor_, next, held);
+        if (!newest) {
+          continue;
+        }
+        return std::optional<reader>{std::in_place,
+                                     *this,
+                                     i,
+                                     next,
+                                     records_stats,
+                                     *newest == 0 ? 0 : *newest - 1,
+                                     held};
+      }
+    }
+    return std::nullopt;
+  }
+
+  // A frame of this segment as found by a reader of another segment that
+  // was passed a reference to it, with the slot's write count at the time
+  struct borrowed {
+    buffer const *frame;
+    uint32_t writes;
+  };
+
+  // The frame with that sequence if it is still in a slot and not being
+  // written over, found without holding anything, as for triple_buffer
+  // Copy the frame out and then check it is still intact before using it
+  auto borrow(uint64_t sequence) const -> std::optional<borrowed> {
+    for (std::size_t i = 0; i < slots(); i += 1) {
+      auto const *frame = buffer_at(i);
+      auto const writes = frame->_writes.load(std::memory_order_acquire);
+      if (writes % 2 == 0 && frame->sequence() == sequence) {
+        return borrowed{frame, writes};
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Whether the writer left a borrowed frame alone until now
+  auto intact(borrowed const &borrowed_) const -> bool {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return borrowed_.frame->_writes.load(std::memory_order_relaxed) ==
+           borrowed_.writes;
+  }
+
+  // Nobody else reads the slot until done_writing
+  auto write() -> buffer & { return *buffer_at(write_index); }
+
+  void done_writing() {
+    _stats.record_write();
+    write_sequence += 1;
+    write().stamp(write_sequence);
+    write()._writes.fetch_add(1, std::memory_order_release);
+
+    latest.store(write_index | write_sequence << slot_bits,
+                 std::memory_order_seq_cst);
+    published.store(static_cast<uint32_t>(write_sequence),
+                    std::memory_order_seq_cst);
+#if defined(__linux__)
+    if (waiters.load(std::memory_order_seq_cst) != 0) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&published), FUTEX_WAKE,
+              INT32_MAX, nullptr, nullptr, 0);
+    }
+#endif
+
+    // Each reader holds at most one slot and the newest is never taken, so
+    // one of the others is always free, the spare covers a reader that lost
+    // its cursor still letting go
+    auto const newest = write_index;
+    for (std::size_t i = 1; i < slots(); i += 1) {
+      auto const candidate = static_cast<uint32_t>((newest + i) % slots());
+      if (refs[candidate].load(std::memory_order_seq_cst) == 0) {
+        write_index = candidate;
+        // Marked as being written before any of it is, for borrowers
+        write()._writes.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write().reset_header();
+        return;
+      }
+    }
+    std::cerr << "Every broadcast_buffer slot is held by a reader\n";
+    std::terminate();
+  }
+
+  void trigger_sync() { sync.notify_all(); }
+
+  void wait_for_sync() {
+    struct dummy_lock {
+      bool locked = true;
+      void lock() { locked = true; }
+      void unlock() { locked = false; }
+      operator bool() const { return locked; }
+    };
+    auto lock = dummy_lock{};
+    sync.wait(lock);
+  }
+};
+
+#endif // BROADCAST_BUFFER_HPP
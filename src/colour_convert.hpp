@@ -0,0 +1,166 @@
+#ifndef COLOUR_CONVERT_HPP
+#define COLOUR_CONVERT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define COLOUR_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+// BGRA to 4:2:2 YCbCr, BT.709 limited range, for outputs that encode UYVY
+// much more cheaply than BGRA
+// Frames stay premultiplied, the alpha goes to a separate plane for UYVA
+namespace colour {
+
+// Q15, each row of chroma sums to zero so grey has no chroma
+inline constexpr auto y_r = 5983;
+inline constexpr auto y_g = 20127;
+inline constexpr auto y_b = 2032;
+inline constexpr auto cb_r = -3298;
+inline constexpr auto cb_g = -11094;
+inline constexpr auto cb_b = 14392;
+inline constexpr auto cr_r = 14392;
+inline constexpr auto cr_g = -13072;
+inline constexpr auto cr_b = -1320;
+
+// Offsets with rounding, chroma is from the sum of two pixels so has one
+// more bit
+inline constexpr auto y_offset = (16 << 15) + (1 << 14);
+inline constexpr auto c_offset = (128 << 16) + (1 << 15);
+
+// Every kernel gives bit-identical results to this one
+// width must be even, alpha may be null
+inline void bgra_to_uyvy_scalar(uint8_t *uyvy, uint8_t *alpha,
+                                uint8_t const *bgra, std::size_t width) {
+  for (std::size_t x = 0; x < width; x += 2) {
+    auto const *p = bgra + x * 4;
+    auto const b0 = int32_t{p[0]}, g0 = int32_t{p[1]}, r0 = int32_t{p[2]};
+    auto const b1 = int32_t{p[4]}, g1 = int32_t{p[5]}, r1 = int32_t{p[6]};
+    auto const luma = [](int32_t b, int32_t g, int32_t r) {
+      return static_cast<uint8_t>(
+          std::clamp((y_b * b + y_g * g + y_r * r + y_offset) >> 15, 0, 255));
+    };
+    auto const b = b0 + b1, g = g0 + g1, r = r0 + r1;
+    auto *out = uyvy + x * 2;
+    out[0] = static_cast<uint8_t>(
+        std::clamp((cb_b * b + cb_g * g + cb_r * r + c_offset) >> 16, 0, 255));
+    out[1] = luma(b0, g0, r0);
+    out[2] = static_cast<uint8_t>(
+        std::clamp((cr_b * b + cr_g * g + cr_r * r + c_offset) >> 16, 0, 255));
+    out[3] = luma(b1, g1, r1);
+    if (alpha != nullptr) {
+      alpha[x] = p[3];
+      alpha[x + 1] = p[7];
+    }
+  }
+}
+
+#if defined(COLOUR_CONVERT_X86)
+
+// Eight pixels with each channel gathered into one qword, blue green red alpha
+[[gnu::target("avx2")]] inline auto load_channels_avx2(uint8_t const *bgra)
+    -> __m256i {
+  // Each channel of four pixels into one dword per 128 bit lane
+  auto const gather = _mm256_setr_epi8(
+      0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, //
+      0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  auto const by_channel = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  return _mm256_permutevar8x32_epi32(
+      _mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<__m256i const *>(bgra)), gather),
+      by_channel);
+}
+
+// Luma of four pixels per lane from interleaved blue green and red zero pairs
+[[gnu::target("avx2")]] inline auto luma_avx2(__m256i bg, __m256i r0)
+    -> __m256i {
+  auto const weighted = _mm256_add_epi32(
+      _mm256_madd_epi16(bg, _mm256_set1_epi32((y_g << 16) | (y_b & 0xffff))),
+      _mm256_madd_epi16(r0, _mm256_set1_epi32(y_r & 0xffff)));
+  return _mm256_srai_epi32(
+      _mm256_add_epi32(weighted, _mm256_set1_epi32(y_offset)), 15);
+}
+
+// Chroma from sums of pairs of pixels, clamped like the scalar kernel
+[[gnu::target("avx2")]] inline auto chroma_avx2(__m256i b, __m256i g,
+                                                __m256i r, int32_t kb,
+                                                int32_t kg, int32_t kr)
+    -> __m256i {
+  auto const weighted = _mm256_add_epi32(
+      _mm256_add_epi32(_mm256_mullo_epi32(b, _mm256_set1_epi32(kb)),
+                       _mm256_mullo_epi32(g, _mm256_set1_epi32(kg))),
+      _mm256_mullo_epi32(r, _mm256_set1_epi32(kr)));
+  auto const c = _mm256_srai_epi32(
+      _mm256_add_epi32(weighted, _mm256_set1_epi32(c_offset)), 16);
+  return _mm256_min_epi32(_mm256_max_epi32(c, _mm256_setzero_si256()),
+                          _mm256_set1_epi32(255));
+}
+
+// 16 pixels at a time, split into 16 bit planes so luma is a madd per pair of
+// channels and the chroma sums of neighbouring pixels are another
+[[gnu::target("avx2")]] inline void bgra_to_uyvy_avx2(uint8_t *uyvy,
+                                                      uint8_t *alpha,
+                                                      uint8_t const *bgra,
+                                                      std::size_t width) {
+  auto const zero = _mm256_setzero_si256();
+  auto const ones = _mm256_set1_epi16(1);
+
+  auto x = std::size_t{0};
+  for (; x + 16 <= width; x += 16) {
+    auto const p = load_channels_avx2(bgra + x * 4);
+    auto const q = load_channels_avx2(bgra + x * 4 + 32);
+    // Low lane blue then red, high lane green then alpha, 16 pixels each
+    auto const br = _mm256_unpacklo_epi64(p, q);
+    auto const ga = _mm256_unpackhi_epi64(p, q);
+
+    auto const b = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(br));
+    auto const r = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(br, 1));
+    auto const g = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(ga));
+
+    if (alpha != nullptr) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(alpha + x),
+                       _mm256_extracti128_si256(ga, 1));
+    }
+
+    // Unpacking then packing within lanes leaves the pixels in order
+    auto const luma = _mm256_packs_epi32(
+        luma_avx2(_mm256_unpacklo_epi16(b, g), _mm256_unpacklo_epi16(r, zero)),
+        luma_avx2(_mm256_unpackhi_epi16(b, g), _mm256_unpackhi_epi16(r, zero)));
+
+    // Pairs 0 to 3 in the low lane and 4 to 7 in the high, matching luma
+    auto const sb = _mm256_madd_epi16(b, ones);
+    auto const sg = _mm256_madd_epi16(g, ones);
+    auto const sr = _mm256_madd_epi16(r, ones);
+    auto const cb = chroma_avx2(sb, sg, sr, cb_b, cb_g, cb_r);
+    auto const cr = chroma_avx2(sb, sg, sr, cr_b, cr_g, cr_r);
+    auto const cbcr = _mm256_or_si256(cb, _mm256_slli_epi32(cr, 16));
+
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(uyvy + x * 2),
+        _mm256_packus_epi16(_mm256_unpacklo_epi16(cbcr, luma),
+                            _mm256_unpackhi_epi16(cbcr, luma)));
+  }
+  bgra_to_uyvy_scalar(uyvy + x * 2, alpha == nullptr ? nullptr : alpha + x,
+                      bgra + x * 4, width - x);
+}
+
+#endif // COLOUR_CONVERT_X86
+
+inline void bgra_to_uyvy(uint8_t *uyvy, uint8_t *alpha, uint8_t const *bgra,
+                         std::size_t width) {
+#if defined(COLOUR_CONVERT_X86)
+  static auto const avx2 = __builtin_cpu_supports("avx2") != 0;
+  if (avx2) {
+    return bgra_to_uyvy_avx2(uyvy, alpha, bgra, width);
+  }
+#endif
+  bgra_to_uyvy_scalar(uyvy, alpha, bgra, width);
+}
+
+} // namespace colour
+
+#endif // COLOUR_CONVERT_HPP
@@ -1,7 +1,8 @@
 
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
-#include "triple_buffer.hpp"
+#include "trace.hpp"
 
 #include <charconv>
 #include <chrono>
@@ -89,7 +90,7 @@ public:
 };
 
 int main(int, char **) {
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto colour = "#abcdef"s;
 
@@ -105,14 +106,13 @@ int main(int, char **) {
     auto b = parse_channel(colour.substr(5, 2));
 
     if (output_buffer) {
-      auto &buffer = (*output_buffer)->write();
-      for (std::size_t i = 0; i < triple_buffer::size; i += 4) {
-        buffer.video_frame[i + 0] = b;
-        buffer.video_frame[i + 1] = g;
-        buffer.video_frame[i + 2] = r;
-        buffer.video_frame[i + 3] = 255;
-      }
+      auto span = trace::span{"produce"};
+      // The router fills from the colour alone, no need to write 8MB of it
+      auto &written = (*output_buffer)->write();
+      written.set_solid(uint32_t{b} | uint32_t{g} << 8 | uint32_t{r} << 16 |
+                        uint32_t{255} << 24);
       (*output_buffer)->done_writing();
+      span.set_frame(written.sequence(), written.source_time());
     }
   };
 
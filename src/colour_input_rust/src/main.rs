@@ -1,7 +1,7 @@
 use dioxus::prelude::*;
 use futures::stream::StreamExt;
 use ipc_shared_object::IpcUnmanagedObject;
-use triple_buffer::TripleBuffer;
+use triple_buffer::BroadcastBuffer;
 
 enum GuiToRendererMsg {
     SetColour(String),
@@ -143,9 +143,9 @@ async fn renderer(
         }
     });
 
-    let mut cpp_output_buffer: IpcUnmanagedObject<triple_buffer::CppTripleBuffer> =
+    let mut cpp_output_buffer: IpcUnmanagedObject<triple_buffer::CppBroadcastBuffer> =
         IpcUnmanagedObject::new(name);
-    let mut output_buffer = TripleBuffer::new(cpp_output_buffer.get_mut());
+    let mut output_buffer = BroadcastBuffer::new(cpp_output_buffer.get_mut());
 
     let mut write_frame = |colour: &str| {
         let parse_channel = |s: &str| u8::from_str_radix(s, 16);
@@ -154,13 +154,10 @@ async fn renderer(
         let Ok(g) = parse_channel(&colour[3..5]) else {return;};
         let Ok(b) = parse_channel(&colour[5..7]) else {return;};
 
-        let buffer = output_buffer.write();
-        for i in (0..triple_buffer::SIZE).step_by(4) {
-            buffer.video_frame[i + 0] = b;
-            buffer.video_frame[i + 1] = g;
-            buffer.video_frame[i + 2] = r;
-            buffer.video_frame[i + 3] = 255;
-        }
+        // The router fills from the colour alone, no need to write the pixels
+        output_buffer
+            .write()
+            .set_solid(u32::from_le_bytes([b, g, r, 255]));
         output_buffer.done_writing();
     };
 
@@ -0,0 +1,532 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define COMPOSITOR_X86
+#include <immintrin.h>
+#endif
+
+namespace compositor {
+
+// Premultiplied BGRA over: dst = src + dst * (256 - src.alpha) / 256
+// Div by 256 is much cheaper, so factor ranges from 1 to 256
+// mult by 1 div by 256 will be 0
+// Every kernel below must give bit-identical results to this one
+inline void alpha_over_scalar(uint8_t *dst, uint8_t const *src,
+                              std::size_t size) {
+  for (std::size_t i = 0; i < size; i += 4) {
+    auto factor = 256 - src[i + 3];
+    for (std::size_t j = i; j < i + 4; j += 1) {
+      dst[j] = static_cast<uint8_t>(src[j] + (dst[j] * factor) / 256);
+    }
+  }
+}
+
+#if defined(COMPOSITOR_X86)
+
+// dst * factor fits in 16 bits (255 * 256), so the blend is done with 16 bit
+// lanes and the final add wraps exactly like the scalar uint8_t cast
+
+[[gnu::target("sse2")]] inline auto blend_sse2(__m128i dst, __m128i src)
+    -> __m128i {
+  auto const zero = _mm_setzero_si128();
+  auto const full = _mm_set1_epi16(256);
+
+  auto const dst_lo = _mm_unpacklo_epi8(dst, zero);
+  auto const dst_hi = _mm_unpackhi_epi8(dst, zero);
+  auto const src_lo = _mm_unpacklo_epi8(src, zero);
+  auto const src_hi = _mm_unpackhi_epi8(src, zero);
+
+  auto const factor_lo = _mm_sub_epi16(
+      full, _mm_shufflehi_epi16(
+                _mm_shufflelo_epi16(src_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+  auto const factor_hi = _mm_sub_epi16(
+      full, _mm_shufflehi_epi16(
+                _mm_shufflelo_epi16(src_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+
+  auto const scaled_lo = _mm_srli_epi16(_mm_mullo_epi16(dst_lo, factor_lo), 8);
+  auto const scaled_hi = _mm_srli_epi16(_mm_mullo_epi16(dst_hi, factor_hi), 8);
+
+  return _mm_add_epi8(src, _mm_packus_epi16(scaled_lo, scaled_hi));
+}
+
+[[gnu::target("sse2")]] inline void
+alpha_over_sse2(uint8_t *dst, uint8_t const *src, std::size_t size) {
+  auto i = std::size_t{0};
+  for (; i + 16 <= size; i += 16) {
+    auto const d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(dst + i));
+    auto const s = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), blend_sse2(d, s));
+  }
+  alpha_over_scalar(dst + i, src + i, size - i);
+}
+
+[[gnu::target("avx2")]] inline auto blend_avx2(__m256i dst, __m256i src)
+    -> __m256i {
+  auto const zero = _mm256_setzero_si256();
+  auto const full = _mm256_set1_epi16(256);
+
+  auto const dst_lo = _mm256_unpacklo_epi8(dst, zero);
+  auto const dst_hi = _mm256_unpackhi_epi8(dst, zero);
+  auto const src_lo = _mm256_unpacklo_epi8(src, zero);
+  auto const src_hi = _mm256_unpackhi_epi8(src, zero);
+
+  auto const factor_lo = _mm256_sub_epi16(
+      full, _mm256_shufflehi_epi16(
+                _mm256_shufflelo_epi16(src_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+  auto const factor_hi = _mm256_sub_epi16(
+      full, _mm256_shufflehi_epi16(
+                _mm256_shufflelo_epi16(src_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+
+  auto const scaled_lo =
+      _mm256_srli_epi16(_mm256_mullo_epi16(dst_lo, factor_lo), 8);
+  auto const scaled_hi =
+      _mm256_srli_epi16(_mm256_mullo_epi16(dst_hi, factor_hi), 8);
+
+  // unpack and pack both work within 128 bit lanes, so the order is preserved
+  return _mm256_add_epi8(src, _mm256_packus_epi16(scaled_lo, scaled_hi));
+}
+
+[[gnu::target("avx2")]] inline void
+alpha_over_avx2(uint8_t *dst, uint8_t const *src, std::size_t size) {
+  auto i = std::size_t{0};
+  for (; i + 32 <= size; i += 32) {
+    auto const d =
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(dst + i));
+    auto const s =
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        blend_avx2(d, s));
+  }
+  alpha_over_scalar(dst + i, src + i, size - i);
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline auto blend_avx512(__m512i dst,
+                                                             __m512i src)
+    -> __m512i {
+  auto const zero = _mm512_setzero_si512();
+  auto const full = _mm512_set1_epi16(256);
+
+  auto const dst_lo = _mm512_unpacklo_epi8(dst, zero);
+  auto const dst_hi = _mm512_unpackhi_epi8(dst, zero);
+  auto const src_lo = _mm512_unpacklo_epi8(src, zero);
+  auto const src_hi = _mm512_unpackhi_epi8(src, zero);
+
+  auto const factor_lo = _mm512_sub_epi16(
+      full, _mm512_shufflehi_epi16(
+                _mm512_shufflelo_epi16(src_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+  auto const factor_hi = _mm512_sub_epi16(
+      full, _mm512_shufflehi_epi16(
+                _mm512_shufflelo_epi16(src_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+                _MM_SHUFFLE(3, 3, 3, 3)));
+
+  auto const scaled_lo =
+      _mm512_srli_epi16(_mm512_mullo_epi16(dst_lo, factor_lo), 8);
+  auto const scaled_hi =
+      _mm512_srli_epi16(_mm512_mullo_epi16(dst_hi, factor_hi), 8);
+
+  return _mm512_add_epi8(src, _mm512_packus_epi16(scaled_lo, scaled_hi));
+}
+
+[[gnu::target("avx512f,avx512bw")]] inline void
+alpha_over_avx512(uint8_t *dst, uint8_t const *src, std::size_t size) {
+  auto i = std::size_t{0};
+  for (; i + 64 <= size; i += 64) {
+    auto const d = _mm512_loadu_si512(dst + i);
+    auto const s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, blend_avx512(d, s));
+  }
+  alpha_over_scalar(dst + i, src + i, size - i);
+}
+
+// Non-temporal stores for a finished line, which nothing in this process
+// reads again, so it goes to memory without evicting the layers from cache
+// The caller must stream_fence before another thread may read the line
+[[gnu::target("sse2")]] inline void stream_sse2(uint8_t *dst,
+                                               uint8_t const *src,
+                                               std::size_t size) {
+  auto i = std::size_t{0};
+  // Frames in segments are cache line aligned, so this is only for odd
+  // callers
+  for (; i < size && reinterpret_cast<uintptr_t>(dst + i) % 16 != 0; i += 1) {
+    dst[i] = src[i];
+  }
+  for (; i + 16 <= size; i += 16) {
+    _mm_stream_si128(
+        reinterpret_cast<__m128i *>(dst + i),
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i)));
+  }
+  std::memcpy(dst + i, src + i, size - i);
+}
+
+#endif // COMPOSITOR_X86
+
+enum class isa { scalar, sse2, avx2, avx512 };
+
+inline auto isa_name(isa isa_) -> char const * {
+  switch (isa_) {
+  case isa::scalar:
+    return "scalar";
+  case isa::sse2:
+    return "SSE2";
+  case isa::avx2:
+    return "AVX2";
+  case isa::avx512:
+    return "AVX-512";
+  }
+  return "unknown";
+}
+
+inline auto supported(isa isa_) -> bool {
+  switch (isa_) {
+  case isa::scalar:
+    return true;
+#if defined(COMPOSITOR_X86)
+  case isa::sse2:
+    return __builtin_cpu_supports("sse2");
+  case isa::avx2:
+    return __builtin_cpu_supports("avx2");
+  case isa::avx512:
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+#endif
+  default:
+    return false;
+  }
+}
+
+inline auto best_isa() -> isa {
+  for (auto isa_ : {isa::avx512, isa::avx2, isa::sse2}) {
+    if (supported(isa_)) {
+      return isa_;
+    }
+  }
+  return isa::scalar;
+}
+
+using alpha_over_kernel_t = void (*)(uint8_t *, uint8_t const *, std::size_t);
+
+inline auto alpha_over_kernel(isa isa_) -> alpha_over_kernel_t {
+  switch (isa_) {
+#if defined(COMPOSITOR_X86)
+  case isa::sse2:
+    return alpha_over_sse2;
+  case isa::avx2:
+    return alpha_over_avx2;
+  case isa::avx512:
+    return alpha_over_avx512;
+#endif
+  default:
+    return alpha_over_scalar;
+  }
+}
+
+// Picked once on first use from what the CPU supports
+inline void alpha_over(uint8_t *dst, uint8_t const *src, std::size_t size) {
+  static auto const kernel = alpha_over_kernel(best_isa());
+  kernel(dst, src, size);
+}
+
+inline void stream(uint8_t *dst, uint8_t const *src, std::size_t size) {
+#if defined(COMPOSITOR_X86)
+  static auto const sse2 = supported(isa::sse2);
+  if (sse2) {
+    stream_sse2(dst, src, size);
+    return;
+  }
+#endif
+  std::memcpy(dst, src, size);
+}
+
+// Orders the streamed stores before any that follow
+inline void stream_fence() {
+#if defined(COMPOSITOR_X86)
+  _mm_sfence();
+#endif
+}
+
+struct raster {
+  std::size_t width;
+  std::size_t height;
+  std::size_t pitch;
+};
+
+static constexpr auto tile_size = std::size_t{64};
+
+enum class tile_alpha : uint8_t { transparent, opaque, mixed };
+
+// Per tile summary of a frame, so that compositing can skip tiles that are
+// entirely zero and copy tiles that are entirely opaque
+class alpha_map {
+private:
+  std::size_t _columns;
+  std::size_t _rows;
+  std::vector<tile_alpha> tiles;
+
+  static auto classify_tile(uint8_t const *frame, raster const &format,
+                            std::size_t x0, std::size_t y0) -> tile_alpha {
+    auto const x1 = std::min(x0 + tile_size, format.width);
+    auto const y1 = std::min(y0 + tile_size, format.height);
+
+    auto all_bits = uint32_t{0};
+    auto common_bits = ~uint32_t{0};
+    for (auto y = y0; y < y1; y += 1) {
+      auto const *row = frame + y * format.pitch;
+      for (auto x = x0; x < x1; x += 1) {
+        uint32_t pixel;
+        std::memcpy(&pixel, row + x * 4, sizeof(pixel));
+        all_bits |= pixel;
+        common_bits &= pixel;
+      }
+      if (all_bits != 0 && (common_bits & 0xff000000) != 0xff000000) {
+        return tile_alpha::mixed;
+      }
+    }
+
+    if (all_bits == 0) {
+      return tile_alpha::transparent;
+    } else if ((common_bits & 0xff000000) == 0xff000000) {
+      return tile_alpha::opaque;
+    } else {
+      return tile_alpha::mixed;
+    }
+  }
+
+public:
+  // Until the first classify every tile is mixed, which is always correct
+  alpha_map(raster const &format)
+      : _columns{(format.width + tile_size - 1) / tile_size},
+        _rows{(format.height + tile_size - 1) / tile_size},
+        tiles(_columns * _rows, tile_alpha::mixed) {}
+
+  auto columns() const { return _columns; }
+  auto rows() const { return _rows; }
+
+  auto operator()(std::size_t column, std::size_t row) const -> tile_alpha {
+    return tiles[row * _columns + column];
+  }
+
+  void classify(uint8_t const *frame, raster const &format, std::size_t row) {
+    for (std::size_t column = 0; column < _columns; column += 1) {
+      tiles[row * _columns + column] =
+          classify_tile(frame, format, column * tile_size, row * tile_size);
+    }
+  }
+
+  void classify(uint8_t const *frame, raster const &format) {
+    for (std::size_t row = 0; row < _rows; row += 1) {
+      classify(frame, format, row);
+    }
+  }
+};
+
+// Transparent tiles are all zero so leave dst as is, opaque tiles have a
+// factor of 1 so come out as src, only mixed tiles need blending
+inline void alpha_over(uint8_t *dst, uint8_t const *src, alpha_map const &map,
+                       raster const &format, std::size_t row) {
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (std::size_t column = 0; column < map.columns(); column += 1) {
+    auto const tile = map(column, row);
+    if (tile == tile_alpha::transparent) {
+      continue;
+    }
+
+    auto const offset = column * tile_size * 4;
+    auto const bytes =
+        (std::min((column + 1) * tile_size, format.width) - column * tile_size) *
+        4;
+    for (auto y = y0; y < y1; y += 1) {
+      auto const line = y * format.pitch + offset;
+      if (tile == tile_alpha::opaque) {
+        std::memcpy(dst + line, src + line, bytes);
+      } else {
+        alpha_over(dst + line, src + line, bytes);
+      }
+    }
+  }
+}
+
+inline void alpha_over(uint8_t *dst, uint8_t const *src, alpha_map const &map,
+                       raster const &format) {
+  for (std::size_t row = 0; row < map.rows(); row += 1) {
+    alpha_over(dst, src, map, format, row);
+  }
+}
+
+// Same result as clearing dst and then alpha_over, but without the extra pass
+inline void copy(uint8_t *dst, uint8_t const *src, alpha_map const &map,
+                 raster const &format, std::size_t row) {
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (std::size_t column = 0; column < map.columns(); column += 1) {
+    auto const offset = column * tile_size * 4;
+    auto const bytes =
+        (std::min((column + 1) * tile_size, format.width) - column * tile_size) *
+        4;
+    for (auto y = y0; y < y1; y += 1) {
+      auto const line = y * format.pitch + offset;
+      if (map(column, row) == tile_alpha::transparent) {
+        std::memset(dst + line, 0, bytes);
+      } else {
+        std::memcpy(dst + line, src + line, bytes);
+      }
+    }
+  }
+}
+
+// Zero the lines of dst covered by one row of tiles
+inline void clear(uint8_t *dst, raster const &format, std::size_t row) {
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (auto y = y0; y < y1; y += 1) {
+    std::memset(dst + y * format.pitch, 0, format.width * 4);
+  }
+}
+
+// A frame that is one premultiplied BGRA colour all over, kept as a single
+// line of that colour
+// Compositing reads the line for every line of dst, so it stays in L1 rather
+// than streaming a whole frame of the same pixel through the cache
+class solid {
+private:
+  std::vector<uint8_t> _line;
+  tile_alpha _alpha;
+
+public:
+  solid(uint32_t pixel, raster const &format)
+      : _line(format.width * 4),
+        _alpha{pixel == 0                       ? tile_alpha::transparent
+               : (pixel >> 24) == 0xff ? tile_alpha::opaque
+                                       : tile_alpha::mixed} {
+    for (std::size_t x = 0; x < _line.size(); x += 4) {
+      std::memcpy(_line.data() + x, &pixel, sizeof(pixel));
+    }
+  }
+
+  auto line() const -> uint8_t const * { return _line.data(); }
+  auto alpha() const -> tile_alpha { return _alpha; }
+};
+
+inline void alpha_over(uint8_t *dst, solid const &src, raster const &format,
+                       std::size_t row) {
+  if (src.alpha() == tile_alpha::transparent) {
+    return;
+  }
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (auto y = y0; y < y1; y += 1) {
+    if (src.alpha() == tile_alpha::opaque) {
+      std::memcpy(dst + y * format.pitch, src.line(), format.width * 4);
+    } else {
+      alpha_over(dst + y * format.pitch, src.line(), format.width * 4);
+    }
+  }
+}
+
+// Over zeros a solid comes out as itself
+inline void copy(uint8_t *dst, solid const &src, raster const &format,
+                 std::size_t row) {
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (auto y = y0; y < y1; y += 1) {
+    std::memcpy(dst + y * format.pitch, src.line(), format.width * 4);
+  }
+}
+
+// One layer of a composite, either a frame with its alpha map or a solid
+class layer {
+private:
+  uint8_t const *frame = nullptr;
+  alpha_map const *map = nullptr;
+  solid const *_solid = nullptr;
+
+public:
+  layer(uint8_t const *frame, alpha_map const &map)
+      : frame{frame}, map{&map} {}
+  layer(solid const &solid_) : _solid{&solid_} {}
+
+  auto tile(std::size_t column, std::size_t row) const -> tile_alpha {
+    return _solid != nullptr ? _solid->alpha() : (*map)(column, row);
+  }
+
+  auto line(raster const &format, std::size_t y) const -> uint8_t const * {
+    return _solid != nullptr ? _solid->line() : frame + y * format.pitch;
+  }
+};
+
+// Every layer into one row of tiles of dst at once, bottom layer first, with
+// the same result as copying the bottom layer and then alpha_over the rest
+// Each line is built up from every layer in a scratch line that stays in L1
+// and then streamed to dst, so dst is written to memory once however many
+// layers there are, rather than read and written again for each layer
+inline void composite(uint8_t *dst, std::span<layer const> layers,
+                      raster const &format, std::size_t row) {
+  auto const columns = (format.width + tile_size - 1) / tile_size;
+  thread_local auto scratch = std::vector<uint8_t>{};
+  thread_local auto first = std::vector<std::size_t>{};
+  scratch.resize(format.width * 4);
+  first.resize(columns);
+
+  // Layers under the top opaque one in a tile can't show through it
+  for (std::size_t column = 0; column < columns; column += 1) {
+    first[column] = 0;
+    for (auto i = layers.size(); i > 0; i -= 1) {
+      if (layers[i - 1].tile(column, row) == tile_alpha::opaque) {
+        first[column] = i - 1;
+        break;
+      }
+    }
+  }
+
+  auto const y0 = row * tile_size;
+  auto const y1 = std::min(y0 + tile_size, format.height);
+  for (auto y = y0; y < y1; y += 1) {
+    for (std::size_t column = 0; column < columns; column += 1) {
+      auto const offset = column * tile_size * 4;
+      auto const bytes = (std::min((column + 1) * tile_size, format.width) -
+                          column * tile_size) *
+                         4;
+      auto *const out = scratch.data() + offset;
+
+      // Blending onto zeros is just a copy, as is any opaque tile
+      auto blank = true;
+      for (auto i = first[column]; i < layers.size(); i += 1) {
+        auto const tile = layers[i].tile(column, row);
+        if (tile == tile_alpha::transparent) {
+          continue;
+        }
+        auto const *src = layers[i].line(format, y) + offset;
+        if (blank || tile == tile_alpha::opaque) {
+          std::memcpy(out, src, bytes);
+        } else {
+          alpha_over(out, src, bytes);
+        }
+        blank = false;
+      }
+      if (blank) {
+        std::memset(out, 0, bytes);
+      }
+    }
+    stream(dst + y * format.pitch, scratch.data(), format.width * 4);
+  }
+  stream_fence();
+}
+
+} // namespace compositor
+
+#endif // COMPOSITOR_HPP
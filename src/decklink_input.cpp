@@ -25,8 +25,10 @@
 #include <DeckLinkAPI_i.h>
 #endif
 
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
 
 using fmt::operator""_a;
@@ -106,10 +108,12 @@ template <typename T> auto find_if(auto &&it, auto const &f) {
 
 class output_frame : public IDeckLinkVideoFrame {
 private:
+  media_format const &format;
   triple_buffer::buffer &buffer;
 
 public:
-  output_frame(triple_buffer::buffer &buffer) : buffer{buffer} {}
+  output_frame(media_format const &format, triple_buffer::buffer &buffer)
+      : format{format}, buffer{buffer} {}
 
   auto QueryInterface(REFIID id, void **outputInterface) -> HRESULT override {
     *outputInterface = nullptr;
@@ -119,13 +123,13 @@ public:
   auto AddRef() -> ULONG override { return 0; }
   auto Release() -> ULONG override { return 0; }
 
-  auto GetWidth() -> long override { return triple_buffer::width; }
-  auto GetHeight() -> long override { return triple_buffer::height; }
-  auto GetRowBytes() -> long override { return triple_buffer::pitch; }
+  auto GetWidth() -> long override { return format.width; }
+  auto GetHeight() -> long override { return format.height; }
+  auto GetRowBytes() -> long override { return format.pitch; }
   auto GetPixelFormat() -> BMDPixelFormat override { return bmdFormat8BitBGRA; }
   auto GetFlags() -> BMDFrameFlags override { return bmdFrameFlagDefault; }
   auto GetBytes(void **_buffer) -> HRESULT override {
-    *_buffer = buffer.video_frame;
+    *_buffer = buffer.video_frame().data();
     return S_OK;
   }
   auto GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode)
@@ -142,11 +146,13 @@ public:
 
 class Callback : public IDeckLinkInputCallback {
 private:
-  std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer;
+  std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer;
   IDeckLinkVideoConversion &decklink_convertor;
 
 public:
-  Callback(std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer,
+  BMDDisplayMode display_mode = bmdModeHD1080p25;
+
+  Callback(std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer,
            IDeckLinkVideoConversion &decklink_convertor)
       : output_buffer{output_buffer}, decklink_convertor{decklink_convertor} {}
 
@@ -155,9 +161,16 @@ private:
                               IDeckLinkAudioInputPacket *audioPacket)
       -> HRESULT override {
     if (output_buffer) {
-      auto output_frame_ = output_frame{(*output_buffer)->write()};
-      decklink_convertor.ConvertFrame(videoFrame, &output_frame_);
+      auto span = trace::span{"produce"};
+      auto &written = (*output_buffer)->write();
+      written.set_source_time(pipeline_stats::now());
+      auto output_frame_ = output_frame{(*output_buffer)->format(), written};
+      {
+        auto const timer = (*output_buffer)->stats().convert.time();
+        decklink_convertor.ConvertFrame(videoFrame, &output_frame_);
+      }
       (*output_buffer)->done_writing();
+      span.set_frame(written.sequence(), written.source_time());
     }
     return S_OK;
   }
@@ -167,7 +180,7 @@ private:
                           IDeckLinkDisplayMode *newDisplayMode,
                           BMDDetectedVideoInputFormatFlags detectedSignalFlags)
       -> HRESULT override {
-    if (newDisplayMode->GetDisplayMode() != bmdModeHD1080p25) {
+    if (newDisplayMode->GetDisplayMode() != display_mode) {
       std::cerr << "Invalid mode\n";
       std::terminate();
     }
@@ -181,19 +194,54 @@ private:
   auto Release() -> ULONG override { return 0; }
 };
 
+// The progressive display mode matching the format the router runs at
+auto find_display_mode(IDeckLinkInput &decklink_input,
+                       media_format const &format) -> BMDDisplayMode {
+  auto display_mode_iterator = decklink_ptr<IDeckLinkDisplayModeIterator>{};
+  if (decklink_input.GetDisplayModeIterator(out_ptr(display_mode_iterator)) !=
+      S_OK) {
+    std::cerr << "Could not get a display mode iterator\n";
+    std::terminate();
+  }
+
+  auto mode = find_if<IDeckLinkDisplayMode>(
+      display_mode_iterator,
+      [&](decklink_ptr<IDeckLinkDisplayMode> const &mode) {
+        BMDTimeValue frame_duration;
+        BMDTimeScale time_scale;
+        mode->GetFrameRate(&frame_duration, &time_scale);
+        return mode->GetWidth() == static_cast<long>(format.width) &&
+               mode->GetHeight() == static_cast<long>(format.height) &&
+               mode->GetFieldDominance() == bmdProgressiveFrame &&
+               time_scale * format.frame_rate_den ==
+                   frame_duration * format.frame_rate_num;
+      });
+  if (!mode) {
+    std::cerr << fmt::format("No display mode for {}x{} at {}/{} fps\n",
+                             format.width, format.height,
+                             format.frame_rate_num, format.frame_rate_den);
+    std::terminate();
+  }
+  return mode->GetDisplayMode();
+}
+
 class active_decklink {
 private:
   decklink_ptr<IDeckLinkInput> decklink_input;
 
 public:
-  active_decklink(IDeckLink &decklink, Callback &callback) {
+  active_decklink(IDeckLink &decklink, Callback &callback,
+                  media_format const &format) {
     if (decklink.QueryInterface(IID_IDeckLinkInput, out_ptr(decklink_input)) !=
         S_OK) {
       std::cerr << "Could not get a DeckLink input\n";
       std::terminate();
     }
 
-    if (decklink_input->EnableVideoInput(bmdModeHD1080p25, bmdFormat8BitYUV,
+    callback.display_mode = find_display_mode(*decklink_input, format);
+
+    if (decklink_input->EnableVideoInput(callback.display_mode,
+                                         bmdFormat8BitYUV,
                                          bmdVideoInputEnableFormatDetection) !=
         S_OK) {
       std::cerr << "Could not enable video input\n";
@@ -390,13 +438,15 @@ int main(int argc, char **argv) {
   auto decklink_index = std::optional<std::size_t>{};
   auto decklink = std::optional<active_decklink>{};
 
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto callback = Callback{output_buffer, *decklink_convertor};
 
   auto reload_decklink = [&] {
     if (decklink_index) {
-      decklink.emplace(*decklinks[*decklink_index], callback);
+      decklink.emplace(*decklinks[*decklink_index], callback,
+                       output_buffer ? (*output_buffer)->format()
+                                     : media_format{});
     } else {
       decklink = std::nullopt;
     }
@@ -416,6 +466,7 @@ int main(int argc, char **argv) {
         auto name = std::string{static_cast<char const *>(buffer.data().data()),
                                 buffer.data().size()};
         output_buffer.emplace(name.c_str());
+        reload_decklink();
       });
   auto router_websocket = server_.connect_to_websocket(
       router_websocket_delegate_, "127.0.0.1", 8080,
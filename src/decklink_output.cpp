@@ -1,12 +1,16 @@
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <range/v3/view/iota.hpp>
+#include <range/v3/view/transform.hpp>
 #include <range/v3/view/zip_with.hpp>
 
 #include <fmt/format.h>
@@ -25,8 +29,11 @@
 #include <DeckLinkAPI_i.h>
 #endif
 
+#include "decklink_playback.hpp"
 #include "ipc_shared_object.hpp"
+#include "passthrough.hpp"
 #include "server/server.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
 
 using fmt::operator""_a;
@@ -35,20 +42,6 @@ using namespace std::literals;
 
 using ztd::out_ptr::out_ptr;
 
-struct DeckLinkRelease {
-  void operator()(IUnknown *p) {
-    if (p != nullptr) {
-      p->Release();
-    }
-  }
-};
-
-template <typename T> using decklink_ptr = std::unique_ptr<T, DeckLinkRelease>;
-
-template <typename T> auto make_decklink_ptr(T *p) {
-  return decklink_ptr<T>{p};
-}
-
 struct DLString {
 #if defined(__linux__)
   char const *data;
@@ -107,13 +100,47 @@ template <typename T> auto find_if(auto &&it, auto const &f) {
   return decklink_ptr<T>{};
 }
 
+// The progressive display mode matching the format the router runs at
+auto find_display_mode(IDeckLinkOutput &decklink_output,
+                       media_format const &format) -> BMDDisplayMode {
+  auto display_mode_iterator = decklink_ptr<IDeckLinkDisplayModeIterator>{};
+  if (decklink_output.GetDisplayModeIterator(
+          out_ptr(display_mode_iterator)) != S_OK) {
+    std::cerr << "Could not get a display mode iterator\n";
+    std::terminate();
+  }
+
+  auto mode = find_if<IDeckLinkDisplayMode>(
+      display_mode_iterator,
+      [&](decklink_ptr<IDeckLinkDisplayMode> const &mode) {
+        BMDTimeValue frame_duration;
+        BMDTimeScale time_scale;
+        mode->GetFrameRate(&frame_duration, &time_scale);
+        return mode->GetWidth() == static_cast<long>(format.width) &&
+               mode->GetHeight() == static_cast<long>(format.height) &&
+               mode->GetFieldDominance() == bmdProgressiveFrame &&
+               time_scale * format.frame_rate_den ==
+                   frame_duration * format.frame_rate_num;
+      });
+  if (!mode) {
+    std::cerr << fmt::format("No display mode for {}x{} at {}/{} fps\n",
+                             format.width, format.height,
+                             format.frame_rate_num, format.frame_rate_den);
+    std::terminate();
+  }
+  return mode->GetDisplayMode();
+}
+
 class active_decklink {
 private:
   decklink_ptr<IDeckLinkOutput> decklink_output;
   decklink_ptr<IDeckLinkKeyer> decklink_keyer;
 
+  std::optional<decklink_playout> playout;
+
 public:
-  active_decklink(IDeckLink &decklink, bool external_keyer) {
+  active_decklink(IDeckLink &decklink, bool external_keyer,
+                  std::size_t preroll, media_format const &format) {
     if (decklink.QueryInterface(IID_IDeckLinkOutput,
                                 out_ptr(decklink_output)) != S_OK) {
       std::cerr << "Could not get a DeckLink output\n";
@@ -126,20 +153,25 @@ public:
       std::terminate();
     }
 
-    if (decklink_output->EnableVideoOutput(bmdModeHD1080p25,
-                                           bmdVideoOutputFlagDefault) != S_OK) {
+    if (decklink_output->EnableVideoOutput(
+            find_display_mode(*decklink_output, format),
+            bmdVideoOutputFlagDefault) != S_OK) {
       std::cerr << "Could not enable video output\n";
       std::terminate();
     }
 
-    if (decklink_output->EnableAudioOutput(
+    if (format.sample_rate != 48'000 ||
+        decklink_output->EnableAudioOutput(
             bmdAudioSampleRate48kHz, bmdAudioSampleType32bitInteger,
-            triple_buffer::num_channels,
-            bmdAudioOutputStreamContinuous) != S_OK) {
+            format.num_channels,
+            preroll == 0 ? bmdAudioOutputStreamContinuous
+                         : bmdAudioOutputStreamTimestamped) != S_OK) {
       std::cerr << "Could not enable audio output\n";
       std::terminate();
     }
 
+    playout.emplace(*decklink_output, format, preroll);
+
     if (decklink_keyer->Enable(external_keyer) != S_OK ||
         decklink_keyer->SetLevel(255) != S_OK) {
       std::cerr << "Could not enable keyer\n";
@@ -149,37 +181,14 @@ public:
 
   ~active_decklink() {
     decklink_keyer->Disable();
+    if (playout->scheduling()) {
+      decklink_output->StopScheduledPlayback(0, nullptr, 0);
+    }
     decklink_output->DisableAudioOutput();
     decklink_output->DisableVideoOutput();
   }
 
-  void display_frame(triple_buffer::buffer const &buffer) {
-    auto frame = decklink_ptr<IDeckLinkMutableVideoFrame>{};
-    if (decklink_output->CreateVideoFrame(
-            triple_buffer::width, triple_buffer::height, triple_buffer::pitch,
-            bmdFormat8BitBGRA, bmdFrameFlagDefault, out_ptr(frame)) != S_OK) {
-      std::cerr << "Could not create frame\n";
-      std::terminate();
-    }
-
-    void *data;
-    if (frame->GetBytes(&data) != S_OK) {
-      std::cerr << "Can't get frame data\n";
-      std::terminate();
-    }
-
-    auto typed_buffer = static_cast<uint8_t *>(data);
-    std::copy(std::begin(buffer.video_frame), std::end(buffer.video_frame),
-              typed_buffer);
-
-    decklink_output->DisplayVideoFrameSync(frame.get());
-
-    uint32_t audio_samples_written;
-    decklink_output->WriteAudioSamplesSync(
-        const_cast<void *>(reinterpret_cast<void const *>(buffer.audio_frame)),
-        triple_buffer::audio_samples_per_frame_per_channel,
-        &audio_samples_written);
-  }
+  void display_frame(playout_source &source) { playout->display(source); }
 };
 
 struct decklink_option {
@@ -215,6 +224,42 @@ template <> struct fmt::formatter<decklink_option> {
   }
 };
 
+// Frames queued ahead of the card, none means each is displayed as it arrives
+constexpr auto preroll_depths = std::array<std::size_t, 5>{0, 2, 3, 4, 6};
+
+struct preroll_option {
+  bool selected;
+  std::size_t depth;
+
+  static constexpr auto make(std::size_t selected_depth) {
+    return [selected_depth](std::size_t depth) {
+      return preroll_option{selected_depth == depth, depth};
+    };
+  }
+};
+
+template <> struct fmt::formatter<preroll_option> {
+  constexpr auto parse(format_parse_context &ctx) -> decltype(ctx.begin()) {
+    if (ctx.begin() != ctx.end() && *ctx.begin() != '}')
+      throw format_error("invalid format");
+    return ctx.begin();
+  }
+
+  auto format(preroll_option const &preroll, auto &ctx) const
+      -> decltype(ctx.out()) {
+    if (preroll.depth == 0) {
+      return fmt::format_to(
+          ctx.out(), R"html(<option value="0" {selected}>Immediate</option>)html",
+          "selected"_a = preroll.selected ? "selected"sv : ""sv);
+    }
+    return fmt::format_to(
+        ctx.out(),
+        R"html(<option value="{depth}" {selected}>Scheduled, {depth} frames</option>)html",
+        "depth"_a = preroll.depth,
+        "selected"_a = preroll.selected ? "selected"sv : ""sv);
+  }
+};
+
 template <typename ReloadDecklink> class http_delegate {
 public:
   using body_type = beast::http::string_body;
@@ -224,6 +269,7 @@ private:
   std::vector<decklink_ptr<IDeckLink>> &decklinks;
   std::optional<std::size_t> &decklink_index;
   bool &external_keyer;
+  std::size_t &preroll;
 
   ReloadDecklink reload_decklink;
 
@@ -233,10 +279,11 @@ public:
   http_delegate(std::string_view name,
                 std::vector<decklink_ptr<IDeckLink>> &decklinks,
                 std::optional<std::size_t> &decklink_index,
-                bool &external_keyer, ReloadDecklink reload_decklink)
+                bool &external_keyer, std::size_t &preroll,
+                ReloadDecklink reload_decklink)
       : name{name}, decklinks{decklinks}, decklink_index{decklink_index},
-        external_keyer{external_keyer}, reload_decklink{
-                                            std::move(reload_decklink)} {}
+        external_keyer{external_keyer}, preroll{preroll},
+        reload_decklink{std::move(reload_decklink)} {}
 
   template <typename Body, typename Allocator>
   void handle_request(
@@ -261,6 +308,11 @@ public:
       <option value="internal" {internal_selected}>Internal</option>
       <option value="external" {external_selected}>External</option>
     </select>
+    <br/>
+    Playback
+    <select onchange="fetch('/preroll', {{method: 'POST', body: event.target.value}})">
+      {prerolls}
+    </select>
     <script>
       let ws;
       
@@ -290,7 +342,11 @@ public:
                                       ranges::views::iota(0ul), decklinks),
               ""),
           "internal_selected"_a = external_keyer ? ""sv : "selected"sv,
-          "external_selected"_a = external_keyer ? "selected"sv : ""sv);
+          "external_selected"_a = external_keyer ? "selected"sv : ""sv,
+          "prerolls"_a = fmt::join(
+              preroll_depths |
+                  ranges::views::transform(preroll_option::make(preroll)),
+              ""));
       auto mime_type = "text/html"sv;
 
       return http::string_response(req, std::move(body), mime_type, send);
@@ -311,6 +367,15 @@ public:
       reload_decklink();
       reload_clients();
       return send(http::empty_response(req));
+    } else if (req.target() == "/preroll" &&
+               req.method() == beast::http::verb::post) {
+      auto depth = std::stoul(req.body());
+      preroll = std::ranges::find(preroll_depths, depth) != preroll_depths.end()
+                    ? depth
+                    : 0;
+      reload_decklink();
+      reload_clients();
+      return send(http::empty_response(req));
     } else {
       return send(http::not_found(req));
     }
@@ -354,11 +419,18 @@ int main(int argc, char **argv) {
 
   auto decklink_index = std::optional<std::size_t>{};
   auto external_keyer = false;
+  auto preroll = std::size_t{0};
+
+  // Both changed from the server's threads while frames are displayed
+  auto mutex = std::mutex{};
   auto decklink = std::optional<active_decklink>{};
+  auto source = std::shared_ptr<playout_source>{};
 
   auto reload_decklink = [&] {
+    auto lock = std::scoped_lock{mutex};
     if (decklink_index) {
-      decklink.emplace(*decklinks[*decklink_index], external_keyer);
+      decklink.emplace(*decklinks[*decklink_index], external_keyer, preroll,
+                       source ? (*source)->format() : media_format{});
     } else {
       decklink = std::nullopt;
     }
@@ -412,11 +484,10 @@ int main(int argc, char **argv) {
   }();
   */
 
-  auto input_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
-
   auto http_delegate_ =
       std::make_shared<http_delegate<decltype(reload_decklink)>>(
-          name, decklinks, decklink_index, external_keyer, reload_decklink);
+          name, decklinks, decklink_index, external_keyer, preroll,
+          reload_decklink);
   auto websocket_delegate_ = std::make_shared<websocket::tracking_delegate>();
   auto server_ = server{http_delegate_, websocket_delegate_, "0.0.0.0", 0, 4};
 
@@ -427,26 +498,63 @@ int main(int argc, char **argv) {
       [&](std::any &, beast::flat_buffer &buffer) {
         auto name = std::string{static_cast<char const *>(buffer.data().data()),
                                 buffer.data().size()};
-        input_buffer.emplace(name.c_str());
+        auto segment =
+            std::make_shared<ipc_unmanaged_object<triple_buffer>>(name.c_str());
+        // The input frame is copied here rather than in the router, taking
+        // the copy off the router's tick
+        (*segment)->accept_passthrough();
+        {
+          auto lock = std::scoped_lock{mutex};
+          source = std::make_shared<playout_source>(
+              std::shared_ptr<triple_buffer>{segment, segment->data()});
+        }
+        reload_decklink();
       });
+  // The card plays frames straight out of the segment, holding their slots
+  // until it has finished with them
   auto router_websocket = server_.connect_to_websocket(
       router_websocket_delegate_, "127.0.0.1", 8080,
-      fmt::format("/output_{port}", "port"_a = server_.port()));
+      fmt::format("/output_{port}?hold={held_slots}", "port"_a = server_.port(),
+                  "held_slots"_a =
+                      decklink_playout::held_slots(preroll_depths.back())));
 
-  while (true) {
-    if (input_buffer) {
-      while (!(*input_buffer)->novel_to_read()) {
-      }
+  auto passthrough = passthrough_reader{};
 
-      (*input_buffer)->about_to_read();
+  while (true) {
+    auto const source_ = [&] {
+      auto lock = std::scoped_lock{mutex};
+      return source;
+    }();
+    if (!source_) {
+      std::this_thread::sleep_for(10ms);
+      continue;
+    }
+    // Once every held slot is with the card, woken as it hands one back
+    if (!(*source_)->wait_for_novel(100ms) || !source_->wait_for_slot(100ms) ||
+        !(*source_)->about_to_read()) {
+      continue;
+    }
 
-      if (decklink) {
-        decklink->display_frame((*input_buffer)->read());
+    auto lock = std::scoped_lock{mutex};
+    if (decklink) {
+      auto &buffer = (*source_)->read();
+      auto &stats = (*source_)->stats();
+      auto span = trace::span{"display"};
+      span.set_frame(buffer.sequence(), buffer.source_time());
+      // Into the read slot, which is ours, so the card never holds anything
+      // of the input's
+      if (buffer.passthrough()) {
+        auto const video = passthrough.acquire(buffer);
+        if (video) {
+          auto const timer = stats.copy.time();
+          std::ranges::copy(*video, buffer.video_frame().begin());
+        }
+        if (!passthrough.release() || !video) {
+          stats.record_repeated();
+          continue;
+        }
       }
-
-      (*input_buffer)->wait_for_sync();
-    } else {
-      std::atomic_thread_fence(std::memory_order_seq_cst);
+      decklink->display_frame(*source_);
     }
   }
 }
@@ -0,0 +1,390 @@
+#ifndef DECKLINK_PLAYBACK_HPP
+#define DECKLINK_PLAYBACK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if defined(WIN32)
+#include <DeckLinkAPI_i.h>
+#else
+#include <DeckLinkAPI.h>
+#endif
+
+#include "triple_buffer.hpp"
+
+struct DeckLinkRelease {
+  void operator()(IUnknown *p) {
+    if (p != nullptr) {
+      p->Release();
+    }
+  }
+};
+
+template <typename T> using decklink_ptr = std::unique_ptr<T, DeckLinkRelease>;
+
+template <typename T> auto make_decklink_ptr(T *p) {
+  return decklink_ptr<T>{p};
+}
+
+class held_frame;
+
+// Every frame the card can have of an output's segment, one for each slot made
+// up front so playing a frame never allocates
+// Counted by the playout_source and each frame the card still has, so one
+// handed back after the router reconnected or the card was changed still has
+// its slot to go back to
+class held_frames {
+private:
+  std::shared_ptr<triple_buffer> segment;
+  std::vector<std::unique_ptr<held_frame>> frames;
+  std::atomic<std::size_t> references = 1;
+
+  std::mutex mutex;
+  std::condition_variable released;
+
+  friend class held_frame;
+  friend class playout_source;
+
+  explicit held_frames(std::shared_ptr<triple_buffer> segment);
+
+  void add_ref() { references.fetch_add(1, std::memory_order_relaxed); }
+  // The last reference frees the frames and lets go of the segment
+  void release_ref();
+
+  // From whichever thread the card is done with the frame on
+  void release(std::size_t slot) {
+    segment->release(slot);
+    { auto lock = std::scoped_lock{mutex}; }
+    released.notify_all();
+  }
+};
+
+// The output's segment, made with held slots so the card can read frames
+// straight out of it after the reader has moved on
+class playout_source {
+private:
+  held_frames *pool;
+
+public:
+  explicit playout_source(std::shared_ptr<triple_buffer> segment)
+      : pool{new held_frames{std::move(segment)}} {}
+
+  playout_source(playout_source const &) = delete;
+
+  ~playout_source() { pool->release_ref(); }
+
+  auto operator->() -> triple_buffer * { return pool->segment.get(); }
+  auto operator*() -> triple_buffer & { return *pool->segment; }
+
+  // The frame for the read slot, which is held until the card is done with it
+  auto hold() -> decklink_ptr<held_frame>;
+
+  // Blocks until about_to_read has a slot to read into or the timeout passes,
+  // woken by the card handing one back
+  auto wait_for_slot(std::chrono::nanoseconds timeout) -> bool {
+    auto lock = std::unique_lock{pool->mutex};
+    return pool->released.wait_for(
+        lock, timeout, [&] { return pool->segment->slot_free_to_read(); });
+  }
+};
+
+// Points the card straight at a held slot instead of copying it into a frame
+// of its own
+// The slot goes back once the card says it has finished with the frame, or
+// failing that when the last reference is released, and the frame is used
+// again whenever its slot is held again, even if the card still has it
+class held_frame : public IDeckLinkVideoFrame {
+private:
+  held_frames &pool;
+  std::size_t slot;
+  media_format format;
+  std::span<uint8_t const> video;
+  // Two for each reference and one while the slot is held, together so the
+  // last reference can give the slot back before it can be held again
+  std::atomic<uint32_t> state = 0;
+
+public:
+  held_frame(held_frames &pool, std::size_t slot)
+      : pool{pool}, slot{slot}, format{pool.segment->format()},
+        video{pool.segment->held(slot).video_frame()} {}
+
+  held_frame(held_frame const &) = delete;
+
+  auto buffer() const -> triple_buffer::buffer const & {
+    return pool.segment->held(slot);
+  }
+
+  // Once its slot has been held, taking one reference
+  void hold() {
+    if (state.fetch_add(3, std::memory_order_acq_rel) == 0) {
+      pool.add_ref();
+    }
+  }
+
+  // Lets the slot go back to the writer, only the first call after each hold
+  // counts
+  void give_back() {
+    if ((state.fetch_and(~uint32_t{1}, std::memory_order_acq_rel) & 1) != 0) {
+      pool.release(slot);
+    }
+  }
+
+  auto QueryInterface([[maybe_unused]] REFIID id, void **outputInterface)
+      -> HRESULT override {
+    *outputInterface = nullptr;
+    return E_NOINTERFACE;
+  }
+
+  auto AddRef() -> ULONG override { return (state.fetch_add(2) + 2) >> 1; }
+  auto Release() -> ULONG override {
+    auto before = state.load();
+    auto after = uint32_t{};
+    do {
+      after = before == 3 ? 0 : before - 2;
+    } while (!state.compare_exchange_weak(before, after));
+    if (before == 3) {
+      pool.release(slot);
+    }
+    if (after == 0) {
+      // Possibly the pool's last reference, taking this frame with it
+      pool.release_ref();
+    }
+    return after >> 1;
+  }
+
+  auto GetWidth() -> long override { return format.width; }
+  auto GetHeight() -> long override { return format.height; }
+  auto GetRowBytes() -> long override { return format.pitch; }
+  auto GetPixelFormat() -> BMDPixelFormat override { return bmdFormat8BitBGRA; }
+  auto GetFlags() -> BMDFrameFlags override { return bmdFrameFlagDefault; }
+  auto GetBytes(void **_buffer) -> HRESULT override {
+    *_buffer = const_cast<uint8_t *>(video.data());
+    return S_OK;
+  }
+  auto GetTimecode([[maybe_unused]] BMDTimecodeFormat format,
+                   IDeckLinkTimecode **timecode) -> HRESULT override {
+    *timecode = nullptr;
+    return S_FALSE;
+  }
+  auto GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)
+      -> HRESULT override {
+    *ancillary = nullptr;
+    return S_FALSE;
+  }
+};
+
+inline held_frames::held_frames(std::shared_ptr<triple_buffer> segment_)
+    : segment{std::move(segment_)} {
+  frames.reserve(segment->slots());
+  for (std::size_t slot = 0; slot < segment->slots(); slot += 1) {
+    frames.push_back(std::make_unique<held_frame>(*this, slot));
+  }
+}
+
+inline void held_frames::release_ref() {
+  if (references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+inline auto playout_source::hold() -> decklink_ptr<held_frame> {
+  auto &frame = *pool->frames[pool->segment->hold()];
+  frame.hold();
+  return decklink_ptr<held_frame>{&frame};
+}
+
+// Queues frames ahead of the card rather than handing each over as it
+// arrives, so a late router tick eats into the preroll instead of going to air
+// as a repeated frame
+// Every frame queued is a held_frame, its slot goes back as it completes
+class scheduled_playback : public IDeckLinkVideoOutputCallback {
+private:
+  IDeckLinkOutput &decklink_output;
+  media_format format;
+  std::size_t preroll;
+
+  // In frames since playback started
+  BMDTimeValue next_frame = 0;
+  bool started = false;
+
+  std::atomic<std::size_t> completed = 0;
+  std::atomic<std::size_t> late = 0;
+  std::atomic<std::size_t> dropped = 0;
+  std::atomic<std::size_t> flushed = 0;
+  // Router frames the card wouldn't queue
+  std::atomic<std::size_t> skipped = 0;
+
+  auto ScheduledFrameCompleted(IDeckLinkVideoFrame *completedFrame,
+                               BMDOutputFrameCompletionResult result)
+      -> HRESULT override {
+    switch (result) {
+    case bmdOutputFrameDisplayedLate:
+      late += 1;
+      break;
+    case bmdOutputFrameDropped:
+      dropped += 1;
+      break;
+    case bmdOutputFrameFlushed:
+      flushed += 1;
+      break;
+    default:
+      break;
+    }
+    static_cast<held_frame *>(completedFrame)->give_back();
+
+    if ((completed += 1) % 250 == 0) {
+      std::cerr << fmt::format("Scheduled playback: {} late, {} dropped, {} "
+                               "flushed, {} skipped of {} frames\n",
+                               late.load(), dropped.load(), flushed.load(),
+                               skipped.load(), completed.load());
+    }
+    return S_OK;
+  }
+
+  auto ScheduledPlaybackHasStopped() -> HRESULT override { return S_OK; }
+
+  auto QueryInterface([[maybe_unused]] REFIID iid, LPVOID *ppv)
+      -> HRESULT override {
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+  auto AddRef() -> ULONG override { return 0; }
+  auto Release() -> ULONG override { return 0; }
+
+public:
+  // Audio output must be enabled as timestamped before this is made
+  scheduled_playback(IDeckLinkOutput &decklink_output,
+                     media_format const &format, std::size_t preroll)
+      : decklink_output{decklink_output}, format{format}, preroll{preroll} {
+    if (decklink_output.SetScheduledFrameCompletionCallback(this) != S_OK) {
+      std::cerr << "Could not set completion callback\n";
+      std::terminate();
+    }
+
+    if (decklink_output.BeginAudioPreroll() != S_OK) {
+      std::cerr << "Could not begin audio preroll\n";
+      std::terminate();
+    }
+  }
+
+  scheduled_playback(scheduled_playback const &) = delete;
+
+  struct completion_counts {
+    std::size_t completed;
+    std::size_t late;
+    std::size_t dropped;
+    std::size_t flushed;
+    std::size_t skipped;
+  };
+  auto counts() const -> completion_counts {
+    return {completed.load(), late.load(), dropped.load(), flushed.load(),
+            skipped.load()};
+  }
+
+  // Playback must be stopped and the queue flushed before this goes
+  ~scheduled_playback() {
+    decklink_output.SetScheduledFrameCompletionCallback(nullptr);
+  }
+
+  void schedule(held_frame &frame) {
+    auto const frame_duration = BMDTimeValue{format.frame_rate_den};
+    auto const time_scale = BMDTimeScale{format.frame_rate_num};
+
+    if (started) {
+      // If the queue ran dry start again a full preroll ahead of the card
+      BMDTimeValue stream_time;
+      double playback_speed;
+      if (decklink_output.GetScheduledStreamTime(time_scale, &stream_time,
+                                                 &playback_speed) == S_OK &&
+          next_frame * frame_duration <= stream_time) {
+        next_frame = stream_time / frame_duration +
+                     static_cast<BMDTimeValue>(preroll);
+      }
+    }
+
+    if (decklink_output.ScheduleVideoFrame(&frame, next_frame * frame_duration,
+                                           frame_duration,
+                                           time_scale) != S_OK) {
+      skipped += 1;
+      return;
+    }
+
+    auto const samples_per_frame = format.audio_samples_per_frame_per_channel();
+    uint32_t audio_samples_written;
+    decklink_output.ScheduleAudioSamples(
+        const_cast<int32_t *>(frame.buffer().audio_frame().data()),
+        static_cast<uint32_t>(samples_per_frame),
+        next_frame * static_cast<BMDTimeValue>(samples_per_frame),
+        BMDTimeScale{format.sample_rate}, &audio_samples_written);
+
+    next_frame += 1;
+
+    if (!started && next_frame >= static_cast<BMDTimeValue>(preroll)) {
+      if (decklink_output.EndAudioPreroll() != S_OK ||
+          decklink_output.StartScheduledPlayback(0, time_scale, 1.0) != S_OK) {
+        std::cerr << "Could not start scheduled playback\n";
+        std::terminate();
+      }
+      started = true;
+    }
+  }
+};
+
+// Hands the read frame of an output's segment to the card without copying it
+// Frames are displayed as they arrive unless there is a preroll
+class decklink_playout {
+private:
+  IDeckLinkOutput &decklink_output;
+  media_format format;
+  std::optional<scheduled_playback> scheduled;
+
+public:
+  // Enough held slots for the longest preroll, the frame on air and one on
+  // its way back
+  static constexpr auto held_slots(std::size_t max_preroll) -> std::size_t {
+    return max_preroll + 2;
+  }
+
+  // Video and audio output must be enabled, audio as timestamped if there is
+  // a preroll
+  decklink_playout(IDeckLinkOutput &decklink_output,
+                   media_format const &format, std::size_t preroll)
+      : decklink_output{decklink_output}, format{format} {
+    if (preroll != 0) {
+      scheduled.emplace(decklink_output, format, preroll);
+    }
+  }
+
+  auto scheduling() const -> bool { return scheduled.has_value(); }
+
+  void display(playout_source &source) {
+    auto frame = source.hold();
+    if (scheduled) {
+      scheduled->schedule(*frame);
+      return;
+    }
+
+    decklink_output.DisplayVideoFrameSync(frame.get());
+
+    uint32_t audio_samples_written;
+    decklink_output.WriteAudioSamplesSync(
+        const_cast<int32_t *>(frame->buffer().audio_frame().data()),
+        static_cast<uint32_t>(format.audio_samples_per_frame_per_channel()),
+        &audio_samples_written);
+  }
+};
+
+#endif // DECKLINK_PLAYBACK_HPP
@@ -641,14 +641,20 @@ pub struct Encoder {
 }
 
 impl Encoder {
-    pub fn new(codec: &Codec, pix_fmt: ffmpeg_c::AVPixelFormat) -> Result<Encoder, Error> {
+    pub fn new(
+        codec: &Codec,
+        pix_fmt: ffmpeg_c::AVPixelFormat,
+        width: core::ffi::c_int,
+        height: core::ffi::c_int,
+        time_base: AVRational,
+    ) -> Result<Encoder, Error> {
         unsafe {
             let context = ffmpeg_c::avcodec_alloc_context3(codec.raw);
 
             (*context).bit_rate = 1000000;
-            (*context).width = 1920;
-            (*context).height = 1080;
-            (*context).time_base = ffmpeg_c::AVRational { num: 1, den: 25 };
+            (*context).width = width;
+            (*context).height = height;
+            (*context).time_base = time_base;
             (*context).gop_size = 10;
             (*context).max_b_frames = 0;
             (*context).pix_fmt = pix_fmt;
@@ -0,0 +1,252 @@
+#ifndef FRAME_CLOCK_HPP
+#define FRAME_CLOCK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <fmt/format.h>
+
+#if defined(__linux__)
+#include <cerrno>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+// What to do when ticks were missed, either run once and carry on from the
+// next tick, or run each missed tick back to back
+enum class late_policy { skip, catch_up };
+
+// How late each tick woke up, and how often whole ticks were missed
+class clock_stats {
+private:
+  static constexpr auto report_every = 250;
+
+  std::chrono::nanoseconds total{};
+  std::chrono::nanoseconds longest{};
+  std::size_t late_ticks = 0;
+  std::size_t missed_ticks = 0;
+  int ticks = 0;
+
+public:
+  void record(std::chrono::nanoseconds lateness, std::size_t due) {
+    total += lateness;
+    longest = std::max(longest, lateness);
+    if (due > 1) {
+      late_ticks += 1;
+      missed_ticks += due - 1;
+    }
+    ticks += 1;
+
+    if (ticks == report_every) {
+      using ms = std::chrono::duration<double, std::milli>;
+      std::cerr << fmt::format(
+          "Clock over {} ticks: jitter mean {:.3f}ms, max {:.3f}ms, {} late "
+          "ticks missing {} frames\n",
+          ticks, std::chrono::duration_cast<ms>(total).count() / ticks,
+          std::chrono::duration_cast<ms>(longest).count(), late_ticks,
+          missed_ticks);
+      total = {};
+      longest = {};
+      late_ticks = 0;
+      missed_ticks = 0;
+      ticks = 0;
+    }
+  }
+};
+
+class frame_clock {
+private:
+  late_policy policy;
+  clock_stats stats;
+  std::chrono::system_clock::time_point _started;
+
+protected:
+  struct tick {
+    // Ticks that fell due since the last, more than one when running late
+    std::size_t due;
+    // How long after the tick was due it woke up
+    std::chrono::nanoseconds lateness;
+  };
+
+  virtual auto wait() -> tick = 0;
+
+public:
+  explicit frame_clock(late_policy policy,
+                       std::chrono::system_clock::time_point started =
+                           std::chrono::system_clock::now())
+      : policy{policy}, _started{started} {}
+  virtual ~frame_clock() = default;
+
+  // When the tick last returned by next was due, on the clock's own timeline
+  // from when it was made, which only a real clock keeps to real time
+  virtual auto now() const -> std::chrono::nanoseconds = 0;
+  // The time of day the clock's timeline starts at
+  auto started() const -> std::chrono::system_clock::time_point {
+    return _started;
+  }
+
+  // Blocks until the next tick, returns how many ticks to run
+  auto next() -> std::size_t {
+    auto const tick_ = wait();
+    stats.record(tick_.lateness, tick_.due);
+    return policy == late_policy::catch_up ? tick_.due : 1;
+  }
+};
+
+// Ticks at a fixed period from the monotonic clock, a late tick never moves
+// the ticks after it
+// On Linux this is a timerfd, which counts the expirations it has missed, and
+// can run the waiting thread as SCHED_FIFO
+class timer_clock : public frame_clock {
+private:
+  std::chrono::nanoseconds period;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point next_tick;
+#if defined(__linux__)
+  int fd;
+#endif
+
+protected:
+  auto wait() -> tick override {
+#if defined(__linux__)
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) < 0) {
+      if (errno != EINTR) {
+        std::cerr << "Could not read frame timer\n";
+        std::terminate();
+      }
+    }
+    auto const due = static_cast<std::size_t>(expirations);
+#else
+    std::this_thread::sleep_until(next_tick);
+    auto const due =
+        static_cast<std::size_t>(
+            (std::chrono::steady_clock::now() - next_tick) / period) +
+        1;
+#endif
+    auto const lateness = std::chrono::steady_clock::now() - next_tick;
+    next_tick += period * static_cast<int64_t>(due);
+    return {due, lateness};
+  }
+
+public:
+  timer_clock(std::chrono::nanoseconds period, late_policy policy,
+              bool realtime)
+      : frame_clock{policy}, period{period},
+        start{std::chrono::steady_clock::now()}, next_tick{start + period} {
+#if defined(__linux__)
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    auto const spec = timespec{
+        static_cast<time_t>(period.count() / 1'000'000'000),
+        static_cast<long>(period.count() % 1'000'000'000)};
+    auto const timer = itimerspec{spec, spec};
+    if (fd < 0 || timerfd_settime(fd, 0, &timer, nullptr) != 0) {
+      std::cerr << "Could not create frame timer\n";
+      std::terminate();
+    }
+
+    if (realtime) {
+      auto const param = sched_param{sched_get_priority_min(SCHED_FIFO) + 10};
+      if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        std::cerr << "Could not switch the tick thread to SCHED_FIFO, running "
+                     "at normal priority\n";
+      }
+    }
+#else
+    if (realtime) {
+      std::cerr << "Realtime scheduling is only supported on Linux\n";
+    }
+#endif
+  }
+
+  timer_clock(timer_clock const &) = delete;
+
+  auto now() const -> std::chrono::nanoseconds override {
+    return next_tick - period - start;
+  }
+
+#if defined(__linux__)
+  ~timer_clock() override { close(fd); }
+#endif
+};
+
+// Ticks when a frame arrives from an input so the outputs follow its clock
+// rather than drifting against it
+// If no frame comes within half a period of when one was due it ticks anyway,
+// and keeps ticking at the nominal period until frames return
+class input_clock : public frame_clock {
+public:
+  // Blocks for up to the timeout, returns whether a frame arrived
+  using wait_for_frame_t = std::function<bool(std::chrono::nanoseconds)>;
+
+private:
+  std::chrono::nanoseconds period;
+  wait_for_frame_t wait_for_frame;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point last_tick;
+
+protected:
+  auto wait() -> tick override {
+    auto const due = last_tick + period;
+    auto const timeout = due + period / 2 - std::chrono::steady_clock::now();
+    if (wait_for_frame(std::max(timeout, std::chrono::nanoseconds::zero()))) {
+      auto const now = std::chrono::steady_clock::now();
+      auto const lateness = std::max(now - due, std::chrono::nanoseconds::zero());
+      last_tick = now;
+      return {1, lateness};
+    }
+    last_tick = due;
+    return {1, period / 2};
+  }
+
+public:
+  input_clock(std::chrono::nanoseconds period, late_policy policy,
+              wait_for_frame_t wait_for_frame)
+      : frame_clock{policy}, period{period},
+        wait_for_frame{std::move(wait_for_frame)},
+        start{std::chrono::steady_clock::now()}, last_tick{start} {}
+
+  auto now() const -> std::chrono::nanoseconds override {
+    return last_tick - start;
+  }
+};
+
+// Never sleeps, each tick is a period after the last on its own timeline
+// Runs the matrix faster than real time, for tests and soak testing, and miss
+// makes the next tick late for testing the late policies
+class simulated_clock : public frame_clock {
+private:
+  std::chrono::nanoseconds period;
+  std::chrono::nanoseconds _now{};
+  std::size_t missed = 0;
+
+protected:
+  auto wait() -> tick override {
+    auto const due = missed + 1;
+    missed = 0;
+    _now += period * static_cast<int64_t>(due);
+    return {due, period * static_cast<int64_t>(due - 1)};
+  }
+
+public:
+  simulated_clock(std::chrono::nanoseconds period, late_policy policy,
+                  std::chrono::system_clock::time_point started =
+                      std::chrono::system_clock::now())
+      : frame_clock{policy, started}, period{period} {}
+
+  auto now() const -> std::chrono::nanoseconds override { return _now; }
+
+  // The next tick comes this many periods late
+  void miss(std::size_t ticks) { missed += ticks; }
+};
+
+#endif // FRAME_CLOCK_HPP
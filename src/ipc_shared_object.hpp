@@ -1,5 +1,10 @@
+#ifndef IPC_SHARED_OBJECT_HPP
+#define IPC_SHARED_OBJECT_HPP
+
+#include <exception>
 #include <iostream>
 #include <random>
+#include <string>
 #include <utility>
 
 #include <boost/interprocess/mapped_region.hpp>
@@ -37,18 +42,28 @@ private:
     }
   } remover;
 
+  // Types with a variable sized tail report how big the segment must be
+  static auto required_size(auto const &...args) -> std::size_t {
+    if constexpr (requires { T::required_size(args...); }) {
+      return T::required_size(args...);
+    } else {
+      return sizeof(T);
+    }
+  }
+
+  std::size_t size;
   ipc::shared_memory_object object;
   ipc::mapped_region region;
 
 public:
   ipc_managed_object(auto &&...args)
-      : remover{_name.c_str()}, object{[&] {
+      : remover{_name.c_str()}, size{required_size(args...)}, object{[&] {
           auto object = ipc::shared_memory_object{
               ipc::create_only, _name.c_str(), ipc::read_write};
-          object.truncate(sizeof(T));
+          object.truncate(static_cast<ipc::offset_t>(size));
           return object;
         }()},
-        region{object, ipc::read_write, 0, sizeof(T)} {
+        region{object, ipc::read_write, 0, size} {
     std::construct_at<T>(data(), std::forward<decltype(args)>(args)...);
   }
 
@@ -71,10 +86,18 @@ private:
   ipc::mapped_region region;
 
 public:
+  // Maps the whole segment, so types with a variable sized tail can check it
+  // was created with a layout they understand
   ipc_unmanaged_object(char const *name)
       : object{ipc::open_only, name, ipc::read_write}, region{object,
-                                                              ipc::read_write,
-                                                              0, sizeof(T)} {}
+                                                              ipc::read_write} {
+    if constexpr (requires(T const &t) { t.compatible(region.get_size()); }) {
+      if (!data()->compatible(region.get_size())) {
+        std::cerr << "Incompatible shared memory object: " << name << '\n';
+        std::terminate();
+      }
+    }
+  }
 
   auto data() -> T * { return reinterpret_cast<T *>(region.get_address()); }
   auto data() const -> T const * { return reinterpret_cast<T const *>(region.get_address()); }
@@ -84,3 +107,5 @@ public:
   auto operator->() -> T * { return data(); }
   auto operator->() const -> T const * { return data(); }
 };
+
+#endif // IPC_SHARED_OBJECT_HPP
@@ -14,13 +14,21 @@ cpp::cpp! {{
     namespace ipc = boost::interprocess;
 }}
 
+// A type at the start of a segment, which may be followed by a tail sized at
+// runtime, that can tell whether the segment was created with a layout it
+// understands
+pub trait Segment {
+    fn compatible(&self, segment_size: usize) -> bool;
+}
+
 pub struct IpcUnmanagedObject<T> {
     phantom_data: core::marker::PhantomData<T>,
     _object: ffi::boost::interprocess::shared_memory_object,
     region: ffi::boost::interprocess::mapped_region,
 }
 
-impl<T> IpcUnmanagedObject<T> {
+impl<T: Segment> IpcUnmanagedObject<T> {
+    // Maps the whole segment, not just the size of T, so the tail is there too
     pub fn new(name: &str) -> IpcUnmanagedObject<T> {
         unsafe {
             let cname_storage = std::ffi::CString::new(name).unwrap();
@@ -32,21 +40,29 @@ impl<T> IpcUnmanagedObject<T> {
                 return ipc::shared_memory_object{ipc::open_only, cname, ipc::read_write};
             });
 
-            let size = core::mem::size_of::<T>();
-
-            let region = cpp::cpp!([object as "ipc::shared_memory_object", size as "std::size_t"]
+            let region = cpp::cpp!([object as "ipc::shared_memory_object"]
                                    -> ffi::boost::interprocess::mapped_region
                                    as "ipc::mapped_region" {
-                return ipc::mapped_region{object, ipc::read_write, 0, size};
+                return ipc::mapped_region{object, ipc::read_write};
             });
 
-            IpcUnmanagedObject {
+            let mapped = IpcUnmanagedObject {
                 phantom_data: core::marker::PhantomData,
                 _object: object,
                 region: region,
+            };
+            if !mapped.get_ref().compatible(mapped.size()) {
+                panic!("Incompatible shared memory object: {name}");
             }
+            mapped
         }
     }
+}
+
+impl<T> IpcUnmanagedObject<T> {
+    pub fn size(&self) -> usize {
+        self.region.get_size()
+    }
 
     pub fn get_ref<'a>(&'a self) -> &'a T {
         unsafe { core::mem::transmute::<*const autocxx::c_void, &'a T>(self.region.get_address()) }
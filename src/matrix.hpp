@@ -0,0 +1,1335 @@
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <regex>
+#include <span>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "broadcast_buffer.hpp"
+#include "compositor.hpp"
+#include "frame_clock.hpp"
+#include "ipc_shared_object.hpp"
+#include "multiview.hpp"
+#include "preview.hpp"
+#include "server/synchronised.hpp"
+#include "trace.hpp"
+#include "triple_buffer.hpp"
+#include "worker_pool.hpp"
+
+
+inline auto raster_of(media_format const &format) -> compositor::raster {
+  return {format.width, format.height, format.pitch};
+}
+
+inline void mix_audio(triple_buffer::buffer &dst,
+                      triple_buffer::buffer const &src) {
+  //  std::ranges::transform(src.audio_frame(), dst.audio_frame(),
+  //                         dst.audio_frame().begin(), std::plus{});
+  std::ranges::copy(src.audio_frame(), dst.audio_frame().begin());
+}
+
+// Reports how long the work in each tick takes, to size the worker pool
+class tick_timing {
+private:
+  static constexpr auto report_every = 250;
+
+  std::chrono::steady_clock::duration total{};
+  std::chrono::steady_clock::duration longest{};
+  int ticks = 0;
+
+public:
+  void record(std::chrono::steady_clock::duration duration) {
+    total += duration;
+    longest = std::max(longest, duration);
+    ticks += 1;
+
+    if (ticks == report_every) {
+      using ms = std::chrono::duration<double, std::milli>;
+      std::cerr << fmt::format(
+          "Tick time over {} ticks: mean {:.2f}ms, max {:.2f}ms\n", ticks,
+          std::chrono::duration_cast<ms>(total).count() / ticks,
+          std::chrono::duration_cast<ms>(longest).count());
+      total = {};
+      longest = {};
+      ticks = 0;
+    }
+  }
+};
+
+// Outputs are a triple_buffer for their one reader, inputs a broadcast_buffer
+// for the router and whatever else reads them
+template <typename Segment> class io_device {
+private:
+  unsigned short _port;
+  // Of the device's page on that port
+  std::string _page;
+
+  ipc_managed_object<Segment> buffer;
+
+public:
+  io_device(io_device const &) = delete;
+  io_device(io_device &&) = delete;
+
+  // The rest of the arguments are the segment's, after its format
+  io_device(unsigned short port, media_format const &format,
+            std::string page = "/", auto... args)
+      : _port{port}, _page{std::move(page)}, buffer{format, args...} {}
+
+  auto name() const -> std::string const & { return buffer.name(); }
+  auto port() const -> unsigned short { return _port; }
+  auto page() const -> std::string const & { return _page; }
+
+  auto operator->() const -> Segment const * { return buffer.data(); }
+  auto operator->() -> Segment * { return buffer.data(); }
+};
+
+class output_device {
+private:
+  io_device<triple_buffer> device;
+
+public:
+  // Held slots are for outputs that keep frames after reading past them
+  output_device(unsigned short port, media_format const &format,
+                std::size_t held_slots = 0)
+      : device{port, format, "/", held_slots} {}
+
+  auto name() const -> std::string const & { return device.name(); }
+  auto port() const -> unsigned short { return device.port(); }
+  auto page() const -> std::string const & { return device.page(); }
+
+  void done_writing() { device->done_writing(); }
+  auto write() -> triple_buffer::buffer & { return device->write(); }
+  auto published() const -> triple_buffer::buffer const & {
+    return device->published();
+  }
+  auto stats() const -> pipeline_stats const & { return device->stats(); }
+
+  auto accepts_passthrough() const -> bool {
+    return device->accepts_passthrough();
+  }
+
+  // Ids of the inputs last composited into this output, bottom first, unset
+  // until the first composite
+  std::optional<std::vector<uint64_t>> composited_from;
+  // Sequence of the frame the preview was last drawn from
+  std::optional<uint64_t> previewed;
+
+  void trigger_sync() { device->trigger_sync(); }
+  void wait_for_sync() { device->wait_for_sync(); }
+};
+
+class input_device {
+private:
+  static inline auto next_id = std::atomic<uint64_t>{0};
+
+  // Cursors for the tick, the previews and one reader outside the router, a
+  // recorder or the like
+  static constexpr auto readers = std::size_t{3};
+
+  io_device<broadcast_buffer> device;
+  // The tick's, the one that records the input's stats
+  std::optional<broadcast_buffer::reader> reader;
+  std::optional<broadcast_buffer::reader> preview_reader;
+  // Unlike an address, never reused by a later input
+  uint64_t _id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+  compositor::raster raster;
+  compositor::alpha_map _alpha;
+  // Set while the frame read is a solid colour
+  std::optional<compositor::solid> _solid;
+  // Whether _alpha is for the frame read
+  bool classified = false;
+
+public:
+  input_device(unsigned short port, media_format const &format,
+               std::string page = "/")
+      : device{port, format, std::move(page), readers},
+        reader{device->attach(true)}, preview_reader{device->attach()},
+        raster{raster_of(device->format())}, _alpha{raster} {}
+
+  auto name() const -> std::string const & { return device.name(); }
+  auto port() const -> unsigned short { return device.port(); }
+  auto page() const -> std::string const & { return device.page(); }
+  auto id() const -> uint64_t { return _id; }
+
+  void about_to_read() {
+    // Only lost if the router stalled long enough to look like a dead reader,
+    // in which case a detached reader is kept rather than none
+    if (!reader->attached()) {
+      if (auto attached = device->attach(true)) {
+        reader = std::move(attached);
+      }
+    }
+    novel = reader->about_to_read();
+    if (novel) {
+      classified = false;
+      if (auto const pixel = reader->read().solid()) {
+        _solid.emplace(*pixel, raster);
+      } else {
+        _solid.reset();
+      }
+    }
+  }
+  // For the ticks it isn't read on
+  void keep_alive() { reader->keep_alive(); }
+  auto wait_for_novel(std::chrono::nanoseconds timeout) -> bool {
+    return reader->wait_for_novel(timeout);
+  }
+  auto read() const -> broadcast_buffer::buffer const & {
+    return reader->read();
+  }
+  auto stats() const -> pipeline_stats const & { return device->stats(); }
+
+  // For the inputs the router draws itself
+  auto write() -> broadcast_buffer::buffer & { return device->write(); }
+  void done_writing() { device->done_writing(); }
+
+  // Whether the last about_to_read picked up a new frame
+  bool novel = false;
+
+  // The newest frame for the preview, read apart from the tick's so a preview
+  // never needs the tick to read an input nothing is routed from
+  // Null if there is nothing new since the last one
+  auto about_to_preview() -> broadcast_buffer::buffer const * {
+    if (!preview_reader || !preview_reader->attached()) {
+      preview_reader = device->attach();
+    }
+    if (!preview_reader || !preview_reader->about_to_read()) {
+      return nullptr;
+    }
+    return &preview_reader->read();
+  }
+
+  auto solid() const -> bool { return _solid.has_value(); }
+
+  // Classify once per new frame, shared by every output this input feeds
+  // A solid frame has no pixels to classify, and one only passed through is
+  // left until an output composites it
+  auto needs_classifying() const -> bool { return !classified && !_solid; }
+  void classify(std::size_t row) {
+    _alpha.classify(read().video_frame().data(), raster, row);
+  }
+  void done_classifying() { classified = true; }
+  auto alpha() const -> compositor::alpha_map const & { return _alpha; }
+
+  // The frame read, as a layer of an output
+  auto layer() const -> compositor::layer {
+    if (_solid) {
+      return {*_solid};
+    }
+    return {read().video_frame().data(), _alpha};
+  }
+
+  // Refers dst to the frame read instead of copying it
+  void pass_through(triple_buffer::buffer &dst) const {
+    dst.set_passthrough(name(), read().sequence());
+  }
+
+  void trigger_sync() { device->trigger_sync(); }
+  void wait_for_sync() { device->wait_for_sync(); }
+};
+
+// Routing as of one moment, never changed once published, so the tick thread
+// reads it without locks while control threads build the next one
+// Holding the devices keeps them alive until no snapshot refers to them
+class routing {
+public:
+  // Bottom layer first
+  std::vector<std::shared_ptr<input_device>> inputs;
+  std::vector<std::shared_ptr<output_device>> outputs;
+
+private:
+  // Bit input * outputs.size() + output is set when the input feeds the
+  // output
+  std::vector<bool> crosspoints;
+
+  // Derived from the above by index
+  std::vector<input_device *> _live_inputs;
+  std::vector<std::vector<input_device *>> _layers;
+
+  template <typename Device>
+  static auto find(std::vector<std::shared_ptr<Device>> const &devices,
+                   auto const &matches) -> std::optional<std::size_t> {
+    auto const device = std::ranges::find_if(devices, matches);
+    if (device == devices.end()) {
+      return std::nullopt;
+    }
+    return static_cast<std::size_t>(device - devices.begin());
+  }
+
+  // Rebuilds the crosspoints for a new set of outputs, each new output takes
+  // the column of old_column(output) or starts disconnected
+  void remap_outputs(std::size_t num_outputs, auto const &old_column) {
+    auto next = std::vector<bool>(inputs.size() * num_outputs);
+    for (std::size_t input = 0; input < inputs.size(); input += 1) {
+      for (std::size_t output = 0; output < num_outputs; output += 1) {
+        if (auto const column = old_column(output)) {
+          next[input * num_outputs + output] = connected(input, *column);
+        }
+      }
+    }
+    crosspoints = std::move(next);
+  }
+
+public:
+  auto connected(std::size_t input, std::size_t output) const -> bool {
+    return crosspoints[input * outputs.size() + output];
+  }
+
+  auto find_input(std::string_view name) const -> std::optional<std::size_t> {
+    return find(inputs, [&](auto const &input) { return input->name() == name; });
+  }
+  auto find_input(input_device const *input) const
+      -> std::optional<std::size_t> {
+    return find(inputs, [&](auto const &input2) { return input2.get() == input; });
+  }
+  auto find_output(std::string_view name) const -> std::optional<std::size_t> {
+    return find(outputs,
+                [&](auto const &output) { return output->name() == name; });
+  }
+  auto find_output(output_device const *output) const
+      -> std::optional<std::size_t> {
+    return find(outputs,
+                [&](auto const &output2) { return output2.get() == output; });
+  }
+
+  // Inputs feeding at least one output, bottom first
+  auto live_inputs() const -> std::vector<input_device *> const & {
+    return _live_inputs;
+  }
+  // For each output the inputs feeding it, bottom first
+  auto layers() const -> std::vector<std::vector<input_device *>> const & {
+    return _layers;
+  }
+
+  // The rest build the next snapshot, which must be indexed before it is
+  // published
+
+  void set_connected(std::size_t input, std::size_t output, bool value) {
+    crosspoints[input * outputs.size() + output] = value;
+  }
+
+  void add_input(std::shared_ptr<input_device> input) {
+    inputs.push_back(std::move(input));
+    crosspoints.resize(inputs.size() * outputs.size(), false);
+  }
+
+  void add_output(std::shared_ptr<output_device> output) {
+    auto const old_outputs = outputs.size();
+    remap_outputs(old_outputs + 1,
+                  [&](std::size_t i) -> std::optional<std::size_t> {
+                    if (i < old_outputs) {
+                      return i;
+                    }
+                    return std::nullopt;
+                  });
+    outputs.push_back(std::move(output));
+  }
+
+  void remove_input(std::size_t input) {
+    auto const row = crosspoints.begin() +
+                     static_cast<std::ptrdiff_t>(input * outputs.size());
+    crosspoints.erase(row, row + static_cast<std::ptrdiff_t>(outputs.size()));
+    inputs.erase(inputs.begin() + static_cast<std::ptrdiff_t>(input));
+  }
+
+  void remove_output(std::size_t output) {
+    remap_outputs(outputs.size() - 1, [&](std::size_t i) {
+      return std::optional{i < output ? i : i + 1};
+    });
+    outputs.erase(outputs.begin() + static_cast<std::ptrdiff_t>(output));
+  }
+
+  // Swaps two layers along with their crosspoints
+  void swap_inputs(std::size_t a, std::size_t b) {
+    std::swap(inputs[a], inputs[b]);
+    for (std::size_t output = 0; output < outputs.size(); output += 1) {
+      auto const a_connected = connected(a, output);
+      set_connected(a, output, connected(b, output));
+      set_connected(b, output, a_connected);
+    }
+  }
+
+  void index() {
+    _live_inputs.clear();
+    _layers.assign(outputs.size(), {});
+    for (std::size_t input = 0; input < inputs.size(); input += 1) {
+      auto live = false;
+      for (std::size_t output = 0; output < outputs.size(); output += 1) {
+        if (connected(input, output)) {
+          _layers[output].push_back(inputs[input].get());
+          live = true;
+        }
+      }
+      if (live) {
+        _live_inputs.push_back(inputs[input].get());
+      }
+    }
+  }
+};
+
+// One routing change, by device name
+struct salvo_step {
+  enum class kind { connect, disconnect, forward, backward };
+
+  kind kind_;
+  std::string input;
+  std::string output;
+
+  // Returns why the step can't apply, leaving next unchanged if so
+  auto apply(routing &next) const -> std::optional<std::string> {
+    auto const input_ = next.find_input(input);
+    if (kind_ == kind::forward || kind_ == kind::backward) {
+      if (!input_) {
+        return fmt::format("Invalid input: {}", input);
+      }
+      if (kind_ == kind::forward && *input_ + 1 < next.inputs.size()) {
+        next.swap_inputs(*input_, *input_ + 1);
+      } else if (kind_ == kind::backward && *input_ > 0) {
+        next.swap_inputs(*input_, *input_ - 1);
+      }
+      return std::nullopt;
+    }
+
+    auto const output_ = next.find_output(output);
+    if (!input_ && !output_) {
+      return fmt::format("Invalid input: {} and output: {}", input, output);
+    } else if (!input_) {
+      return fmt::format("Invalid input: {}", input);
+    } else if (!output_) {
+      return fmt::format("Invalid output: {}", output);
+    }
+    next.set_connected(*input_, *output_, kind_ == kind::connect);
+    return std::nullopt;
+  }
+};
+
+// Routing changes applied together between two frames, or not at all
+struct salvo {
+  std::vector<salvo_step> steps;
+  // A frame number or an HH:MM:SS:FF time of day, unset for the next frame
+  std::optional<std::string> at;
+
+  auto apply(routing &next) const -> std::optional<std::string> {
+    for (auto const &step : steps) {
+      if (auto error = step.apply(next)) {
+        return error;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // One step a line, optionally after a line saying when:
+  //   at <frame> or at <HH:MM:SS:FF>
+  //   connect <input>&<output>
+  //   disconnect <input>&<output>
+  //   forward <input>
+  //   backward <input>
+  static auto parse(std::string_view body) -> std::optional<salvo> {
+    auto const line_regex = std::regex{
+        R"((at|connect|disconnect|forward|backward) ([^&]+)(?:&(.+))?)"};
+    auto result = salvo{};
+    auto lines = std::istringstream{std::string{body}};
+    for (auto line = std::string{}; std::getline(lines, line);) {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (line.empty()) {
+        continue;
+      }
+      auto match = std::smatch{};
+      if (!std::regex_match(line, match, line_regex)) {
+        return std::nullopt;
+      }
+      auto const verb = match[1].str();
+      auto const paired = verb == "connect" || verb == "disconnect";
+      if (paired != match[3].matched) {
+        return std::nullopt;
+      }
+      if (verb == "at") {
+        if (result.at || !result.steps.empty()) {
+          return std::nullopt;
+        }
+        result.at = match[2].str();
+      } else {
+        result.steps.push_back(
+            {verb == "connect"      ? salvo_step::kind::connect
+             : verb == "disconnect" ? salvo_step::kind::disconnect
+             : verb == "forward"    ? salvo_step::kind::forward
+                                    : salvo_step::kind::backward,
+             match[2].str(), match[3].str()});
+      }
+    }
+    if (result.steps.empty()) {
+      return std::nullopt;
+    }
+    return result;
+  }
+};
+
+struct salvo_status {
+  uint64_t scheduled_frame;
+  std::optional<uint64_t> applied_frame;
+  // Set when the salvo was rejected, so none of it applied
+  std::optional<std::string> error;
+};
+
+// A mosaic of every input, and optionally every output, that the router
+// draws into an input of its own, so it routes like any other source
+// Cells are only drawn again when their source has a new frame, and the
+// mosaic is only written out when a cell changed
+class multiviewer {
+private:
+  std::shared_ptr<input_device> _input;
+  compositor::raster raster;
+
+  // The mosaic as last drawn, copied into the input's segment
+  std::vector<uint8_t> canvas;
+  std::vector<multiview::cell> cells;
+  // What the cells were laid out for, anything else lays them out again
+  std::weak_ptr<routing const> laid_out_for;
+  bool laid_out_with_outputs = false;
+
+  struct job {
+    multiview::rect picture;
+    uint8_t const *frame;
+    std::optional<uint32_t> solid;
+  };
+  std::vector<job> jobs;
+
+  void lay_out(routing const &routing_, bool with_outputs) {
+    auto const count =
+        static_cast<std::size_t>(std::ranges::count_if(
+            routing_.inputs, [&](auto const &input) { return input != _input; })) +
+        (with_outputs ? routing_.outputs.size() : 0);
+    cells = multiview::grid(count, raster);
+    multiview::fill(canvas.data(), raster, {0, 0, raster.width, raster.height},
+                    0xff000000);
+
+    auto cell = cells.begin();
+    for (std::size_t i = 0;
+         i < routing_.inputs.size() && cell != cells.end(); i += 1) {
+      if (routing_.inputs[i] != _input) {
+        multiview::label(canvas.data(), raster, (cell++)->label,
+                         fmt::format("IN {}", i + 1));
+      }
+    }
+    for (std::size_t i = 0;
+         with_outputs && i < routing_.outputs.size() && cell != cells.end();
+         i += 1) {
+      multiview::label(canvas.data(), raster, (cell++)->label,
+                       fmt::format("OUT {}", i + 1));
+    }
+  }
+
+public:
+  multiviewer(std::shared_ptr<input_device> input, media_format const &format)
+      : _input{std::move(input)}, raster{raster_of(format)},
+        canvas(format.video_size()) {}
+
+  auto input() const -> std::shared_ptr<input_device> const & {
+    return _input;
+  }
+
+  // Laying out draws every cell again, so outputs must all be composited
+  auto needs_layout(std::shared_ptr<routing const> const &routing_,
+                    bool with_outputs) const -> bool {
+    return laid_out_for.lock() != routing_ ||
+           with_outputs != laid_out_with_outputs;
+  }
+
+  // Called on the ticks the mosaic updates, after the inputs were read and
+  // the changed outputs composited but before they were handed on
+  void draw(std::shared_ptr<routing const> const &routing_, bool with_outputs,
+            std::span<std::size_t const> changed, worker_pool &pool) {
+    auto const layout = needs_layout(routing_, with_outputs);
+    if (layout) {
+      lay_out(*routing_, with_outputs);
+      laid_out_for = routing_;
+      laid_out_with_outputs = with_outputs;
+    }
+
+    jobs.clear();
+    auto cell = cells.begin();
+    for (auto const &input : routing_->inputs) {
+      if (cell == cells.end()) {
+        break;
+      }
+      if (input == _input) {
+        continue;
+      }
+      if (layout || input->novel) {
+        auto const &frame = input->read();
+        jobs.push_back(
+            {cell->picture, frame.video_frame().data(), frame.solid()});
+      }
+      ++cell;
+    }
+    for (std::size_t i = 0; with_outputs && i < routing_->outputs.size() &&
+                            cell != cells.end();
+         i += 1, ++cell) {
+      if (!layout && std::ranges::find(changed, i) == changed.end()) {
+        continue;
+      }
+      // A passed through output has the pixels of its one input
+      auto const &written = routing_->outputs[i]->write();
+      auto const &frame = written.passthrough()
+                              ? routing_->layers()[i].front()->read()
+                              : written;
+      jobs.push_back({cell->picture, frame.video_frame().data(), std::nullopt});
+    }
+    if (!layout && jobs.empty()) {
+      return;
+    }
+
+    pool.run(jobs.size(), [&](std::size_t i) {
+      auto const &job_ = jobs[i];
+      if (job_.solid) {
+        // Over black, the same as downscale
+        auto const pixel = *job_.solid;
+        multiview::fill(canvas.data(), raster, job_.picture,
+                        pixel | 0xff000000);
+      } else {
+        multiview::downscale(canvas.data(), raster, job_.picture, job_.frame,
+                             raster);
+      }
+    });
+
+    std::ranges::copy(canvas, _input->write().video_frame().begin());
+    _input->done_writing();
+  }
+};
+
+// Small pictures of every input and output for the router's page
+// The tick only draws them, on the ticks they update and only for devices
+// that changed since, and hands them to a thread of its own to encode and
+// send, so neither a slow encode nor a slow client ever holds up a tick
+class previewer {
+public:
+  // The device's name, a newline and a PNG, sent as a binary message
+  using message = std::shared_ptr<std::string const>;
+  // Passed the device's name along with its message
+  using sender = std::function<void(std::string const &, message)>;
+
+private:
+  compositor::raster source;
+  compositor::raster raster;
+  sender send;
+
+  struct job {
+    std::vector<uint8_t> *pixels;
+    uint8_t const *frame;
+    std::optional<uint32_t> solid;
+  };
+  std::vector<job> jobs;
+
+  // Only touched by the tick thread, drawn pictures wait here by device name
+  // if the encoder had the handoff locked
+  std::map<std::string, std::vector<uint8_t>> drawn;
+  std::vector<std::string> devices;
+
+  struct handoff_state {
+    std::map<std::string, std::vector<uint8_t>> pictures;
+    // Every device routed, so the encoder forgets the others
+    std::vector<std::string> devices;
+    bool fresh = false;
+  };
+  std::mutex handoff_mutex;
+  std::condition_variable_any handed_off;
+  handoff_state handoff;
+
+  // The last message sent for each device, for clients that connect later
+  synchronised<std::map<std::string, message>> latest;
+
+  // Last, so it stops before anything it uses is destroyed
+  std::jthread encoder;
+
+  void encode(std::stop_token stop) {
+    // The pixels of each message sent, so a picture that came out the same
+    // isn't encoded again
+    auto sent = std::map<std::string, std::vector<uint8_t>>{};
+    auto taken = handoff_state{};
+    while (true) {
+      {
+        auto lock = std::unique_lock{handoff_mutex};
+        if (!handed_off.wait(lock, stop, [&] { return handoff.fresh; })) {
+          return;
+        }
+        std::swap(taken, handoff);
+        handoff.fresh = false;
+      }
+
+      auto const routed = [&](std::string const &name) {
+        return std::ranges::find(taken.devices, name) != taken.devices.end();
+      };
+      std::erase_if(sent, [&](auto const &entry) {
+        return !routed(entry.first);
+      });
+      std::erase_if(latest.lock().get(), [&](auto const &entry) {
+        return !routed(entry.first);
+      });
+
+      for (auto &[name, pixels] : taken.pictures) {
+        if (!routed(name)) {
+          continue;
+        }
+        auto &last = sent[name];
+        if (last == pixels) {
+          continue;
+        }
+        auto encoded = name + '\n';
+        preview::encode_png(encoded, pixels.data(), raster);
+        std::swap(last, pixels);
+        auto const message_ =
+            std::make_shared<std::string const>(std::move(encoded));
+        latest->insert_or_assign(name, message_);
+        send(name, message_);
+      }
+      taken.pictures.clear();
+    }
+  }
+
+public:
+  previewer(media_format const &format, sender send)
+      : source{raster_of(format)}, raster{preview::raster_for(source)},
+        send{std::move(send)},
+        encoder{[this](std::stop_token stop) { encode(std::move(stop)); }} {}
+
+  // The newest picture of every device, for a client that just connected
+  void each_latest(auto &&f) {
+    for (auto const &[name, message_] : latest.lock().get()) {
+      f(name, message_);
+    }
+  }
+
+  // Called on the ticks previews update, after the changed outputs were
+  // handed on
+  void draw(routing const &routing_, worker_pool &pool) {
+    jobs.clear();
+    devices.clear();
+    auto const add = [&](std::string const &name, auto const &frame,
+                         std::optional<uint32_t> solid) {
+      auto &pixels = drawn[name];
+      pixels.resize(raster.pitch * raster.height);
+      jobs.push_back({&pixels, frame.video_frame().data(), solid});
+    };
+
+    // Held until the next draw, which is after the jobs below are done
+    for (auto const &input : routing_.inputs) {
+      devices.push_back(input->name());
+      if (auto const *frame = input->about_to_preview()) {
+        add(input->name(), *frame, frame->solid());
+      }
+    }
+    for (std::size_t i = 0; i < routing_.outputs.size(); i += 1) {
+      auto &output = *routing_.outputs[i];
+      devices.push_back(output.name());
+      auto const &published = output.published();
+      if (output.previewed == published.sequence()) {
+        continue;
+      }
+      output.previewed = published.sequence();
+      // A passed through output has the pixels of its one input, which is
+      // read every tick and so still has the frame passed through
+      add(output.name(),
+          published.passthrough() ? routing_.layers()[i].front()->read()
+                                  : published,
+          std::nullopt);
+    }
+
+    pool.run(jobs.size(), [&](std::size_t i) {
+      auto const &job_ = jobs[i];
+      auto const whole = multiview::rect{0, 0, raster.width, raster.height};
+      if (job_.solid) {
+        // Over black, the same as downscale
+        multiview::fill(job_.pixels->data(), raster, whole,
+                        *job_.solid | 0xff000000);
+      } else {
+        multiview::downscale(job_.pixels->data(), raster, whole, job_.frame,
+                             source);
+      }
+    });
+
+    // Never waits, if the encoder has the lock they go with the next ones
+    if (auto lock = std::unique_lock{handoff_mutex, std::try_to_lock}) {
+      for (auto &[name, pixels] : drawn) {
+        std::swap(handoff.pictures[name], pixels);
+      }
+      drawn.clear();
+      handoff.devices = devices;
+      handoff.fresh = true;
+      handed_off.notify_one();
+    }
+  }
+};
+
+class matrix {
+public:
+  // Every device the router creates uses this format
+  media_format const format;
+
+  std::function<void()> reload_clients = [] {};
+
+  // Ticks between updates of the mosaic, which is left as it is while zero
+  std::atomic<uint32_t> multiview_every = 5;
+  // Whether the mosaic shows the outputs after the inputs
+  std::atomic<bool> multiview_outputs = false;
+  // Ticks between updates of the previews, which are left as they are while
+  // zero
+  std::atomic<uint32_t> preview_every = 0;
+
+private:
+  static constexpr auto statuses_kept = std::size_t{256};
+
+  struct control_state {
+    // The routing the control threads last published
+    std::shared_ptr<routing const> latest = std::make_shared<routing const>();
+    // Waiting for their frame, in the order they were scheduled within one
+    std::multimap<uint64_t, std::pair<uint64_t, salvo>> scheduled;
+    // Of the most recent salvos, by id
+    std::map<uint64_t, salvo_status> statuses;
+    uint64_t next_salvo_id = 0;
+  };
+
+  // The lock also keeps control threads from building two snapshots from
+  // the same one
+  synchronised<control_state> control;
+  // Published but not yet picked up by the tick thread, owned by whichever
+  // thread exchanges it out
+  std::atomic<std::shared_ptr<routing const> *> pending = nullptr;
+  // The routing the tick thread is using, only touched by that thread
+  std::shared_ptr<routing const> ticking = std::make_shared<routing const>();
+
+  // The number of the next tick to run
+  std::atomic<uint64_t> _frame = 0;
+  // The time of day frame zero was, or would have been, going by the clock
+  // the matrix runs on, moved on by ticks the clock skipped
+  std::atomic<std::chrono::sys_time<std::chrono::nanoseconds>> frame_zero =
+      std::chrono::system_clock::now();
+
+  // Set up once before the tick thread starts, if at all
+  std::optional<multiviewer> multiviewer_;
+  std::optional<previewer> previewer_;
+  // The earliest frame a salvo is scheduled for
+  std::atomic<uint64_t> next_salvo_frame =
+      std::numeric_limits<uint64_t>::max();
+
+  void publish(control_state &state, routing next) {
+    next.index();
+    state.latest = std::make_shared<routing const>(std::move(next));
+    // A snapshot the tick thread never picked up is superseded
+    delete pending.exchange(new std::shared_ptr<routing const>{state.latest},
+                            std::memory_order_acq_rel);
+  }
+
+  // Builds a new snapshot from the latest and publishes it, unless change
+  // returns false
+  void update(auto &&change) {
+    auto locked = control.lock();
+    auto next = *locked->latest;
+    if (!change(next)) {
+      return;
+    }
+    publish(locked.get(), std::move(next));
+  }
+
+  // Called by the tick thread before each frame, the control lock is only
+  // taken on frames where a salvo falls due
+  void apply_due_salvos(uint64_t frame_) {
+    if (frame_ < next_salvo_frame.load(std::memory_order_acquire)) {
+      return;
+    }
+    auto applied = false;
+    {
+      auto locked = control.lock();
+      auto &state = locked.get();
+      auto next = *state.latest;
+      while (!state.scheduled.empty() &&
+             state.scheduled.begin()->first <= frame_) {
+        auto const node = state.scheduled.extract(state.scheduled.begin());
+        auto const &[id, salvo_] = node.mapped();
+        auto trial = next;
+        auto error = salvo_.apply(trial);
+        if (!error) {
+          next = std::move(trial);
+          applied = true;
+        }
+        if (auto status = state.statuses.find(id);
+            status != state.statuses.end()) {
+          status->second.applied_frame = frame_;
+          status->second.error = std::move(error);
+        }
+      }
+      next_salvo_frame.store(state.scheduled.empty()
+                                 ? std::numeric_limits<uint64_t>::max()
+                                 : state.scheduled.begin()->first,
+                             std::memory_order_release);
+      if (applied) {
+        publish(state, std::move(next));
+      }
+    }
+    if (applied) {
+      reload_clients();
+    }
+  }
+
+  // Picks up the latest snapshot, called by the tick thread between frames
+  // Dropping the old one there may destroy devices no longer routed
+  auto current() -> routing const & {
+    if (auto *next = pending.exchange(nullptr, std::memory_order_acquire)) {
+      ticking = std::move(*next);
+      delete next;
+    }
+    return *ticking;
+  }
+
+  // The frame a time of day timecode falls on, if it is still to come
+  auto frame_at_timecode(std::string_view timecode) const
+      -> std::optional<uint64_t> {
+    auto match = std::cmatch{};
+    if (!std::regex_match(timecode.begin(), timecode.end(), match,
+                          std::regex{R"((\d\d):(\d\d):(\d\d)[:;](\d\d))"})) {
+      return std::nullopt;
+    }
+    auto const field = [&](std::size_t i) { return std::stoi(match[i]); };
+    auto const frames_per_second =
+        (format.frame_rate_num + format.frame_rate_den - 1) /
+        format.frame_rate_den;
+    if (field(1) > 23 || field(2) > 59 || field(3) > 59 ||
+        field(4) >= static_cast<int>(frames_per_second)) {
+      return std::nullopt;
+    }
+
+    auto const now = time_of(frame());
+    auto const time = std::chrono::system_clock::to_time_t(
+        std::chrono::floor<std::chrono::seconds>(now));
+    auto local = std::tm{};
+    localtime_r(&time, &local);
+    using seconds = std::chrono::duration<double>;
+    auto const since_midnight =
+        std::chrono::hours{local.tm_hour} +
+        std::chrono::minutes{local.tm_min} +
+        std::chrono::seconds{local.tm_sec} +
+        (now - std::chrono::floor<std::chrono::seconds>(now));
+    auto const target = std::chrono::hours{field(1)} +
+                        std::chrono::minutes{field(2)} +
+                        std::chrono::seconds{field(3)} +
+                        format.frame_duration() * field(4);
+    if (target <= since_midnight) {
+      return std::nullopt;
+    }
+    return frame() + static_cast<uint64_t>(std::llround(
+                         seconds{target - since_midnight} /
+                         seconds{format.frame_duration()}));
+  }
+
+public:
+  explicit matrix(media_format const &format) : format{format} {}
+
+  matrix(matrix const &) = delete;
+
+  ~matrix() { delete pending.load(); }
+
+  // Adds the mosaic as an input, with its page served by the router on port
+  // Only before run
+  void enable_multiview(unsigned short port) {
+    multiviewer_.emplace(
+        std::make_shared<input_device>(port, format, std::string{"/multiview"}), format);
+    add_input(multiviewer_->input());
+  }
+  auto multiview_enabled() const -> bool { return multiviewer_.has_value(); }
+
+  // Draws previews of every device, encoded and passed to send off the tick
+  // Only before run
+  void enable_previews(previewer::sender send) {
+    previewer_.emplace(format, std::move(send));
+  }
+
+  // Passes f the newest preview of every device that has one
+  void each_preview(auto &&f) {
+    if (previewer_) {
+      previewer_->each_latest(f);
+    }
+  }
+
+  // For control threads, stays valid however the routing changes after
+  auto snapshot() -> std::shared_ptr<routing const> {
+    return control.lock()->latest;
+  }
+
+  // The number of the next tick, which salvos can be scheduled from
+  auto frame() const -> uint64_t {
+    return _frame.load(std::memory_order_relaxed);
+  }
+
+  // The time of day a frame is due, on the clock's timeline rather than the
+  // system's, so a simulated clock's frames have the times it gives them
+  auto time_of(uint64_t frame_) const
+      -> std::chrono::sys_time<std::chrono::nanoseconds> {
+    return frame_zero.load(std::memory_order_relaxed) +
+           format.frame_duration() * static_cast<int64_t>(frame_);
+  }
+
+  // Queues a salvo for the frame it asks for, returns its id and that frame
+  // or why it can't be scheduled
+  auto schedule(salvo salvo_)
+      -> std::variant<std::pair<uint64_t, uint64_t>, std::string> {
+    auto frame_ = frame();
+    if (salvo_.at) {
+      auto number = uint64_t{};
+      auto const &at = *salvo_.at;
+      if (std::from_chars(at.data(), at.data() + at.size(), number).ptr ==
+          at.data() + at.size()) {
+        if (number < frame_) {
+          return fmt::format("Frame {} has passed, now at {}", number, frame_);
+        }
+        frame_ = number;
+      } else if (auto const timecode_frame = frame_at_timecode(at)) {
+        frame_ = *timecode_frame;
+      } else {
+        return fmt::format("Invalid or past time: {}", at);
+      }
+    }
+
+    auto locked = control.lock();
+    auto &state = locked.get();
+    auto const id = state.next_salvo_id++;
+    state.statuses[id] = {frame_, std::nullopt, std::nullopt};
+    if (state.statuses.size() > statuses_kept) {
+      state.statuses.erase(state.statuses.begin());
+    }
+    state.scheduled.emplace(frame_, std::pair{id, std::move(salvo_)});
+    next_salvo_frame.store(state.scheduled.begin()->first,
+                           std::memory_order_release);
+    return std::pair{id, frame_};
+  }
+
+  auto status(uint64_t id) -> std::optional<salvo_status> {
+    auto locked = control.lock();
+    if (auto status = locked->statuses.find(id);
+        status != locked->statuses.end()) {
+      return status->second;
+    }
+    return std::nullopt;
+  }
+
+  void add_input(std::shared_ptr<input_device> input) {
+    update([&](routing &next) {
+      next.add_input(std::move(input));
+      return true;
+    });
+  }
+
+  void add_output(std::shared_ptr<output_device> output) {
+    output->write().clear();
+    output->done_writing();
+    update([&](routing &next) {
+      next.add_output(std::move(output));
+      return true;
+    });
+  }
+
+  // When the device's process disconnects
+  void remove_input(input_device const *input) {
+    update([&](routing &next) {
+      if (auto const i = next.find_input(input)) {
+        next.remove_input(*i);
+        return true;
+      }
+      return false;
+    });
+    reload_clients();
+  }
+
+  void remove_output(output_device const *output) {
+    update([&](routing &next) {
+      if (auto const i = next.find_output(output)) {
+        next.remove_output(*i);
+        return true;
+      }
+      return false;
+    });
+    reload_clients();
+  }
+
+  // A single step applies at the next frame without going through the
+  // schedule
+  void apply(salvo_step const &step) {
+    update([&](routing &next) {
+      if (auto const error = step.apply(next)) {
+        std::cerr << *error << '\n';
+        return false;
+      }
+      return true;
+    });
+    reload_clients();
+  }
+
+  void bring_input_forward(std::string_view name) {
+    apply({salvo_step::kind::forward, std::string{name}, {}});
+  }
+
+  void bring_input_backward(std::string_view name) {
+    apply({salvo_step::kind::backward, std::string{name}, {}});
+  }
+
+  void connect(std::string_view input_name, std::string_view output_name,
+               bool value = true) {
+    apply({value ? salvo_step::kind::connect : salvo_step::kind::disconnect,
+           std::string{input_name}, std::string{output_name}});
+  }
+
+  // Stats from every segment in Prometheus text format
+  auto metrics() -> std::string {
+    auto const routing_ = snapshot();
+    auto devices = std::vector<pipeline_stats::labelled>{};
+    for (auto const &input : routing_->inputs) {
+      devices.push_back(
+          {fmt::format(R"(device="input",port="{}")", input->port()),
+           &input->stats()});
+    }
+    for (auto const &output : routing_->outputs) {
+      devices.push_back(
+          {fmt::format(R"(device="output",port="{}")", output->port()),
+           &output->stats()});
+    }
+    return pipeline_stats::metrics(devices);
+  }
+
+  // The bottom input feeding any output, which an input_clock follows
+  auto wait_for_clock_input(std::chrono::nanoseconds timeout) -> bool {
+    auto const &routing_ = current();
+    if (!routing_.live_inputs().empty()) {
+      return routing_.live_inputs().front()->wait_for_novel(timeout);
+    }
+    std::this_thread::sleep_for(timeout);
+    return false;
+  }
+
+  // Ticks on the clock until the frame until is due, for ever unless asked
+  // to stop, and can be run again to carry on from there
+  void run(worker_pool &pool, frame_clock &clock,
+           uint64_t until = std::numeric_limits<uint64_t>::max()) {
+    auto const raster = raster_of(format);
+    auto const tile_rows =
+        (raster.height + compositor::tile_size - 1) / compositor::tile_size;
+
+    auto timing = tick_timing{};
+
+    // Indices of the outputs that need writing this tick, and of those the
+    // ones composited rather than passed through
+    auto changed = std::vector<std::size_t>{};
+    auto composited = std::vector<std::size_t>{};
+    auto classifying = std::vector<input_device *>{};
+    // The layers of each composited output, in the same order
+    auto composited_layers = std::vector<std::vector<compositor::layer>>{};
+
+    // When on the clock's timeline the tick was due
+    auto const tick = [&](std::chrono::nanoseconds time) {
+      auto const tick_start = std::chrono::steady_clock::now();
+      auto const trace_start = trace::enabled() ? trace::now() : 0;
+
+      auto const frame_ = _frame.load(std::memory_order_relaxed);
+      frame_zero.store(clock.started() + time -
+                           format.frame_duration() *
+                               static_cast<int64_t>(frame_),
+                       std::memory_order_relaxed);
+      _frame.store(frame_ + 1, std::memory_order_relaxed);
+      apply_due_salvos(frame_);
+      // Held for the whole tick, so routing changes land between frames
+      auto const &routing_ = current();
+      auto const &outputs = routing_.outputs;
+      auto const &layers = routing_.layers();
+
+      // The mosaic shows inputs that feed no output too, so on its ticks
+      // every input is read
+      // The previews read the inputs themselves
+      auto const every = multiview_every.load(std::memory_order_relaxed);
+      auto const mosaic_tick =
+          multiviewer_ && every != 0 && frame_ % every == 0;
+      auto const with_outputs =
+          multiview_outputs.load(std::memory_order_relaxed);
+      auto const every_preview = preview_every.load(std::memory_order_relaxed);
+      auto const preview_tick =
+          previewer_ && every_preview != 0 && frame_ % every_preview == 0;
+      if (mosaic_tick) {
+        for (auto const &input : routing_.inputs) {
+          input->about_to_read();
+        }
+        // Output cells are drawn from the composite, so a new layout needs
+        // every output composited
+        if (with_outputs && multiviewer_->needs_layout(ticking, with_outputs)) {
+          for (auto const &output : outputs) {
+            output->composited_from.reset();
+          }
+        }
+      } else {
+        for (auto const &input : routing_.inputs) {
+          input->keep_alive();
+        }
+        for (auto *input : routing_.live_inputs()) {
+          input->about_to_read();
+        }
+      }
+
+      // An output with the same layers as last time, none with a new frame,
+      // would come out the same, so it is left alone and its readers keep
+      // the last composite
+      changed.clear();
+      for (std::size_t i = 0; i < outputs.size(); i += 1) {
+        auto &from = outputs[i]->composited_from;
+        if (!from || !std::ranges::equal(*from, layers[i], {}, {},
+                                         &input_device::id) ||
+            std::ranges::any_of(layers[i], &input_device::novel)) {
+          from.emplace();
+          std::ranges::transform(layers[i], std::back_inserter(*from),
+                                 &input_device::id);
+          changed.push_back(i);
+        }
+      }
+      if (changed.empty()) {
+        if (mosaic_tick) {
+          multiviewer_->draw(ticking, with_outputs, {}, pool);
+        }
+        if (preview_tick) {
+          previewer_->draw(routing_, pool);
+        }
+        timing.record(std::chrono::steady_clock::now() - tick_start);
+        return;
+      }
+
+      // An output fed by one input is handed a reference to its frame instead
+      // of a copy, when the output's reader can follow one
+      composited.clear();
+      classifying.clear();
+      for (auto const i : changed) {
+        if (layers[i].size() == 1 && !layers[i].front()->solid() &&
+            outputs[i]->accepts_passthrough()) {
+          layers[i].front()->pass_through(outputs[i]->write());
+          continue;
+        }
+        composited.push_back(i);
+        for (auto *input : layers[i]) {
+          if (input->needs_classifying() &&
+              std::ranges::find(classifying, input) == classifying.end()) {
+            classifying.push_back(input);
+          }
+        }
+      }
+      composited_layers.resize(composited.size());
+      for (std::size_t j = 0; j < composited.size(); j += 1) {
+        composited_layers[j].clear();
+        std::ranges::transform(layers[composited[j]],
+                               std::back_inserter(composited_layers[j]),
+                               &input_device::layer);
+      }
+
+      // Each task covers one band of tile rows across every composited output
+      if (!composited.empty()) {
+        pool.run(tile_rows, [&](std::size_t row) {
+          for (auto *input : classifying) {
+            input->classify(row);
+          }
+          // Every layer of the band at once, so each output is written to
+          // memory once a tick rather than once per layer
+          for (std::size_t j = 0; j < composited.size(); j += 1) {
+            compositor::composite(
+                outputs[composited[j]]->write().video_frame().data(),
+                composited_layers[j], raster, row);
+          }
+        });
+        for (auto *input : classifying) {
+          input->done_classifying();
+        }
+      }
+
+      for (auto const i : changed) {
+        auto &dst = outputs[i]->write();
+        if (layers[i].empty()) {
+          std::ranges::fill(dst.audio_frame(), 0);
+          continue;
+        }
+        std::ranges::copy(layers[i].front()->read().audio_frame(),
+                          dst.audio_frame().begin());
+        for (auto *input : layers[i] | std::views::drop(1)) {
+          mix_audio(dst, input->read());
+        }
+      }
+
+      // Output cells are drawn from the composites before they are handed on
+      if (mosaic_tick) {
+        multiviewer_->draw(ticking, with_outputs, changed, pool);
+      }
+
+      for (auto const i : changed) {
+        auto &dst = outputs[i]->write();
+        // An output is as old as the oldest frame composited into it
+        auto oldest = uint64_t{0};
+        for (auto *input : layers[i]) {
+          auto const time = input->read().source_time();
+          if (time != 0 && (oldest == 0 || time < oldest)) {
+            oldest = time;
+          }
+        }
+        dst.set_source_time(oldest);
+        outputs[i]->done_writing();
+
+        // The reader only reads the slot, so its header is still ours to read
+        if (trace_start != 0) {
+          trace::global().span("composite", trace_start, trace::now(),
+                               dst.sequence(), dst.source_time());
+        }
+      }
+      for (auto const &input : routing_.inputs) {
+        input->trigger_sync();
+      }
+      for (auto &output : outputs) {
+        output->trigger_sync();
+      }
+      // From what was handed on, so previews never hold up the outputs
+      if (preview_tick) {
+        previewer_->draw(routing_, pool);
+      }
+
+      timing.record(std::chrono::steady_clock::now() - tick_start);
+    };
+
+    while (frame() < until) {
+      // Ticks caught up on were due a period apart up to the clock's now
+      for (auto ticks = clock.next(); ticks > 0 && frame() < until;
+           ticks -= 1) {
+        tick(clock.now() -
+             format.frame_duration() * static_cast<int64_t>(ticks - 1));
+      }
+    }
+  }
+};
+
+#endif // MATRIX_HPP
@@ -1,5 +1,6 @@
 
 #include "base64.hpp"
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
 #include "triple_buffer.hpp"
@@ -277,7 +278,7 @@ private:
   std::mutex mutex;
   std::condition_variable condition;
 
-  triple_buffer &output_buffer;
+  broadcast_buffer &output_buffer;
 
   std::jthread worker;
 
@@ -299,7 +300,7 @@ private:
   }
 
 public:
-  frame_queue(triple_buffer &output_buffer)
+  frame_queue(broadcast_buffer &output_buffer)
       : output_buffer{output_buffer}, worker{[this] { work(); }} {}
 
   void schedule(triple_buffer::buffer buffer,
@@ -821,7 +822,7 @@ int main(int argc, char **argv) {
 
   auto key = std::optional<std::string>{};
 
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto websocket_delegate_ = std::make_shared<websocket::tracking_delegate>();
   auto reload_clients = [&] { websocket_delegate_->send(""s); };
@@ -3,7 +3,7 @@
 use dioxus::prelude::*;
 use futures::stream::StreamExt;
 use ipc_shared_object::IpcUnmanagedObject;
-use triple_buffer::TripleBuffer;
+use triple_buffer::{BroadcastBuffer, MediaFormat};
 
 mod srt;
 mod srt_c;
@@ -141,16 +141,21 @@ async fn renderer(
         }
     });
 
-    let mut cpp_output_buffer: IpcUnmanagedObject<triple_buffer::CppTripleBuffer> =
+    let mut cpp_output_buffer: IpcUnmanagedObject<triple_buffer::CppBroadcastBuffer> =
         IpcUnmanagedObject::new(name);
-    let mut output_buffer = TripleBuffer::new(cpp_output_buffer.get_mut());
+    let mut output_buffer = BroadcastBuffer::new(cpp_output_buffer.get_mut());
+    let format = output_buffer.format();
+    // The resampler only makes stereo
+    if format.num_channels != 2 {
+        panic!("Only stereo output is supported");
+    }
 
     /*
     let mut media =
-        MediaStream::open_file("/Users/jonathantanner/Downloads/2021-06-14 20-04-31.mp4").unwrap();
+        MediaStream::open_file("/Users/jonathantanner/Downloads/2021-06-14 20-04-31.mp4", &format).unwrap();
         */
     //let mut media = open_srt("35.178.107.156", 30000).await.unwrap();
-    let mut media = MediaStream::open_srt("127.0.0.1", 30000).unwrap();
+    let mut media = MediaStream::open_srt("127.0.0.1", 30000, &format).unwrap();
 
     tokio::time::sleep(core::time::Duration::from_secs(1));
 
@@ -215,21 +220,16 @@ impl<T: Copy> PartialCopyFromSlice<T> for [T] {
 }
 
 trait Media {
-    fn get_next_video_frame(
-        &mut self,
-        dst: &mut triple_buffer::VideoFrame,
-    ) -> Result<bool, ffmpeg::Error>;
-    fn get_next_audio_frame(
-        &mut self,
-        dst: &mut triple_buffer::AudioFrame,
-    ) -> Result<bool, ffmpeg::Error>;
+    fn get_next_video_frame(&mut self, dst: &mut [u8]) -> Result<bool, ffmpeg::Error>;
+    fn get_next_audio_frame(&mut self, dst: &mut [i32]) -> Result<bool, ffmpeg::Error>;
     fn get_next_triple_buffer(
         &mut self,
-        dst: &mut triple_buffer::Buffer,
+        dst: core::pin::Pin<&mut triple_buffer::Buffer>,
     ) -> Result<bool, ffmpeg::Error>;
 }
 
 struct MediaStream<T> {
+    format: MediaFormat,
     demuxer: ffmpeg::Demuxer<T>,
     video_stream_index: core::ffi::c_int,
     video_decoder: ffmpeg::Decoder,
@@ -242,7 +242,10 @@ struct MediaStream<T> {
 }
 
 impl<T> MediaStream<T> {
-    fn new(demuxer: ffmpeg::Demuxer<T>) -> Result<MediaStream<T>, ffmpeg::Error> {
+    fn new(
+        demuxer: ffmpeg::Demuxer<T>,
+        format: &MediaFormat,
+    ) -> Result<MediaStream<T>, ffmpeg::Error> {
         let (video_stream_index, video_stream, video_decoder) =
             demuxer.find_best_stream(ffmpeg::MediaType::Video, -1)?;
 
@@ -253,8 +256,8 @@ impl<T> MediaStream<T> {
             video_stream.width(),
             video_stream.height(),
             video_stream.pixel_format(),
-            triple_buffer::WIDTH as i32,
-            triple_buffer::HEIGHT as i32,
+            format.width as i32,
+            format.height as i32,
             ffmpeg::AV_PIX_FMT_BGRA,
         );
 
@@ -264,10 +267,11 @@ impl<T> MediaStream<T> {
             audio_stream.sample_rate(),
             ffmpeg::AV_CHANNEL_LAYOUT_STEREO,
             ffmpeg::AV_SAMPLE_FMT_S32,
-            triple_buffer::SAMPLE_RATE as i32,
+            format.sample_rate as i32,
         )?;
 
         Ok(MediaStream {
+            format: *format,
             demuxer: demuxer,
             video_stream_index: video_stream_index,
             video_decoder: video_decoder,
@@ -282,14 +286,18 @@ impl<T> MediaStream<T> {
 }
 
 impl MediaStream<()> {
-    fn open_file(path: &str) -> Result<MediaStream<()>, ffmpeg::Error> {
+    fn open_file(path: &str, format: &MediaFormat) -> Result<MediaStream<()>, ffmpeg::Error> {
         let demuxer = ffmpeg::Demuxer::open_file(path)?;
-        MediaStream::new(demuxer)
+        MediaStream::new(demuxer, format)
     }
 }
 
 impl MediaStream<srt::SrtSocket> {
-    fn open_srt(name: &str, port: u16) -> Result<MediaStream<srt::SrtSocket>, ffmpeg::Error> {
+    fn open_srt(
+        name: &str,
+        port: u16,
+        format: &MediaFormat,
+    ) -> Result<MediaStream<srt::SrtSocket>, ffmpeg::Error> {
         let mut srt = match srt::SrtSocket::new() {
             Ok(srt) => srt,
             Err(err) => panic!("unable to create srt socket: {}", err),
@@ -300,7 +308,7 @@ impl MediaStream<srt::SrtSocket> {
         }
 
         let demuxer = ffmpeg::Demuxer::from_read_stream(srt)?;
-        MediaStream::new(demuxer)
+        MediaStream::new(demuxer, format)
     }
 }
 
@@ -327,15 +335,20 @@ impl<T> MediaStream<T> {
 }
 
 impl<T> Media for MediaStream<T> {
-    fn get_next_video_frame(
-        &mut self,
-        dst: &mut triple_buffer::VideoFrame,
-    ) -> Result<bool, ffmpeg::Error> {
+    fn get_next_video_frame(&mut self, dst: &mut [u8]) -> Result<bool, ffmpeg::Error> {
         loop {
             match self.video_queue.pop_front() {
                 Some(frame) => {
-                    let frame = self.video_scaler.scale(&frame)?;
-                    dst.copy_from_slice(frame.data());
+                    let mut frame = self.video_scaler.scale(&frame)?;
+                    // Each side may pad its rows differently
+                    let linesize = frame.linesize()[0] as usize;
+                    let row_size = self.format.width as usize * 4;
+                    for (dst_row, src_row) in dst
+                        .chunks_exact_mut(self.format.pitch as usize)
+                        .zip(frame.data().chunks_exact(linesize))
+                    {
+                        dst_row[..row_size].copy_from_slice(&src_row[..row_size]);
+                    }
                     return Ok(true);
                 }
                 None => {
@@ -347,11 +360,8 @@ impl<T> Media for MediaStream<T> {
         }
     }
 
-    fn get_next_audio_frame(
-        &mut self,
-        dst: &mut triple_buffer::AudioFrame,
-    ) -> Result<bool, ffmpeg::Error> {
-        let mut dst: &mut [i32] = &mut dst[..];
+    fn get_next_audio_frame(&mut self, dst: &mut [i32]) -> Result<bool, ffmpeg::Error> {
+        let mut dst: &mut [i32] = dst;
 
         while dst.len() > 0 {
             match self.audio_queue.pop_front() {
@@ -370,9 +380,9 @@ impl<T> Media for MediaStream<T> {
 
     fn get_next_triple_buffer(
         &mut self,
-        dst: &mut triple_buffer::Buffer,
+        dst: core::pin::Pin<&mut triple_buffer::Buffer>,
     ) -> Result<bool, ffmpeg::Error> {
-        Ok(self.get_next_video_frame(&mut dst.video_frame)?
-            && self.get_next_audio_frame(&mut dst.audio_frame)?)
+        let (video_frame, audio_frame) = dst.frames_mut();
+        Ok(self.get_next_video_frame(video_frame)? && self.get_next_audio_frame(audio_frame)?)
     }
 }
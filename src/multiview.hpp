@@ -0,0 +1,262 @@
+#ifndef MULTIVIEW_HPP
+#define MULTIVIEW_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "compositor.hpp"
+
+// Pieces of the mosaic the router builds of its inputs and outputs
+namespace multiview {
+
+// So a cell is never so small that a box sums more lines than fit in 16 bits
+static constexpr auto max_columns = std::size_t{16};
+
+struct rect {
+  std::size_t x;
+  std::size_t y;
+  std::size_t width;
+  std::size_t height;
+};
+
+// A picture keeping the frame's aspect, with a strip under it for its label
+struct cell {
+  rect picture;
+  rect label;
+};
+
+// The most square grid that holds count cells, in reading order, on a frame
+// of the given raster, or none if the frame is too small for them
+inline auto grid(std::size_t count, compositor::raster const &format)
+    -> std::vector<cell> {
+  auto const columns =
+      std::min(max_columns, static_cast<std::size_t>(std::ceil(
+                                std::sqrt(static_cast<double>(count)))));
+  if (columns == 0) {
+    return {};
+  }
+  auto const rows = std::min(max_columns, (count + columns - 1) / columns);
+  auto const cell_width = format.width / columns;
+  auto const cell_height = format.height / rows;
+  auto const margin = std::max<std::size_t>(cell_width / 64, 2);
+  auto const label_height = std::max<std::size_t>(cell_height / 8, 9);
+
+  // Too small a frame to fit a picture and its label in each cell
+  if (cell_width <= 2 * margin || cell_height <= label_height + 2 * margin) {
+    return {};
+  }
+  auto const box_width = cell_width - 2 * margin;
+  auto const box_height = cell_height - label_height - 2 * margin;
+  auto const width =
+      std::min(box_width, box_height * format.width / format.height);
+  auto const height = width * format.height / format.width;
+  if (width == 0 || height == 0) {
+    return {};
+  }
+
+  auto cells = std::vector<cell>{};
+  for (std::size_t i = 0; i < std::min(count, columns * rows); i += 1) {
+    auto const x = i % columns * cell_width;
+    auto const y = i / columns * cell_height;
+    cells.push_back(
+        {{x + (cell_width - width) / 2, y + margin, width, height},
+         {x + margin, y + margin + height, box_width, label_height}});
+  }
+  return cells;
+}
+
+// Adds each byte of a line to its 16 bit lane
+inline void add_line_scalar(uint16_t *sums, uint8_t const *line,
+                            std::size_t size) {
+  for (std::size_t i = 0; i < size; i += 1) {
+    sums[i] = static_cast<uint16_t>(sums[i] + line[i]);
+  }
+}
+
+#if defined(COMPOSITOR_X86)
+
+[[gnu::target("sse2")]] inline void
+add_line_sse2(uint16_t *sums, uint8_t const *line, std::size_t size) {
+  auto const zero = _mm_setzero_si128();
+  auto i = std::size_t{0};
+  for (; i + 16 <= size; i += 16) {
+    auto const pixels =
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(line + i));
+    auto *const lo = reinterpret_cast<__m128i *>(sums + i);
+    auto *const hi = reinterpret_cast<__m128i *>(sums + i + 8);
+    _mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo),
+                                       _mm_unpacklo_epi8(pixels, zero)));
+    _mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi),
+                                       _mm_unpackhi_epi8(pixels, zero)));
+  }
+  add_line_scalar(sums + i, line + i, size - i);
+}
+
+#endif // COMPOSITOR_X86
+
+inline void add_line(uint16_t *sums, uint8_t const *line, std::size_t size) {
+#if defined(COMPOSITOR_X86)
+  static auto const sse2 = compositor::supported(compositor::isa::sse2);
+  if (sse2) {
+    add_line_sse2(sums, line, size);
+    return;
+  }
+#endif
+  add_line_scalar(sums, line, size);
+}
+
+// Box filters a whole premultiplied BGRA frame into a rect of dst, each
+// pixel the average of the block of source pixels it covers, over black so a
+// key shows its fill as it would go to air over nothing
+// The lines of a block are summed with SIMD first, which is the bulk of the
+// work, then each run of columns is summed from that
+inline void downscale(uint8_t *dst, compositor::raster const &dst_format,
+                      rect const &to, uint8_t const *src,
+                      compositor::raster const &src_format) {
+  thread_local auto sums = std::vector<uint16_t>{};
+  thread_local auto columns = std::vector<std::size_t>{};
+  sums.resize(src_format.width * 4);
+  columns.resize(to.width + 1);
+  for (std::size_t x = 0; x <= to.width; x += 1) {
+    columns[x] = x * src_format.width / to.width;
+  }
+
+  for (std::size_t y = 0; y < to.height; y += 1) {
+    auto const y0 = y * src_format.height / to.height;
+    auto const y1 = std::max(y0 + 1, (y + 1) * src_format.height / to.height);
+    std::ranges::fill(sums, uint16_t{0});
+    for (auto line = y0; line < y1; line += 1) {
+      add_line(sums.data(), src + line * src_format.pitch, sums.size());
+    }
+
+    auto *const out = dst + (to.y + y) * dst_format.pitch + to.x * 4;
+    for (std::size_t x = 0; x < to.width; x += 1) {
+      auto const x0 = columns[x];
+      auto const x1 = std::max(x0 + 1, columns[x + 1]);
+      // Dividing by a multiply and shift, exact for sums this small
+      auto const count = static_cast<uint32_t>((y1 - y0) * (x1 - x0));
+      auto const reciprocal = ((uint64_t{1} << 32) + count - 1) / count;
+      auto totals = std::array<uint32_t, 3>{};
+      for (auto column = x0; column < x1; column += 1) {
+        for (std::size_t channel = 0; channel < 3; channel += 1) {
+          totals[channel] += sums[column * 4 + channel];
+        }
+      }
+      for (std::size_t channel = 0; channel < 3; channel += 1) {
+        out[x * 4 + channel] = static_cast<uint8_t>(
+            ((totals[channel] + count / 2) * reciprocal) >> 32);
+      }
+      // Premultiplied, so over black is just opaque
+      out[x * 4 + 3] = 0xff;
+    }
+  }
+}
+
+// Premultiplied BGRA, as one little endian word
+inline void fill(uint8_t *dst, compositor::raster const &format,
+                 rect const &to, uint32_t pixel) {
+  for (auto y = to.y; y < to.y + to.height; y += 1) {
+    auto *const line = dst + y * format.pitch + to.x * 4;
+    for (std::size_t x = 0; x < to.width; x += 1) {
+      std::memcpy(line + x * 4, &pixel, sizeof(pixel));
+    }
+  }
+}
+
+// 5 by 7, a bit per pixel from the left in the low bits of each line
+// Only letters, digits and a little punctuation, anything else is blank
+inline auto glyph(char c) -> std::array<uint8_t, 7> {
+  static constexpr auto digits = std::array<std::array<uint8_t, 7>, 10>{{
+      {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+      {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+      {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+      {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+      {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+      {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+      {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+      {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+      {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+      {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+  }};
+  static constexpr auto letters = std::array<std::array<uint8_t, 7>, 26>{{
+      {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // A
+      {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, // B
+      {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, // C
+      {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, // D
+      {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, // E
+      {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, // F
+      {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, // G
+      {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // H
+      {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, // I
+      {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, // J
+      {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+      {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, // L
+      {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+      {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+      {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // O
+      {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, // P
+      {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, // Q
+      {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, // R
+      {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, // S
+      {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+      {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // U
+      {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, // V
+      {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, // W
+      {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, // X
+      {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, // Y
+      {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, // Z
+  }};
+  if (c >= '0' && c <= '9') {
+    return digits[static_cast<std::size_t>(c - '0')];
+  } else if (c >= 'A' && c <= 'Z') {
+    return letters[static_cast<std::size_t>(c - 'A')];
+  } else if (c >= 'a' && c <= 'z') {
+    return letters[static_cast<std::size_t>(c - 'a')];
+  }
+  switch (c) {
+  case '-':
+    return {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00};
+  case '.':
+    return {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c};
+  case ':':
+    return {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00};
+  default:
+    return {};
+  }
+}
+
+// White text centred in the rect, scaled up to its height, cut short if it
+// doesn't fit
+inline void label(uint8_t *dst, compositor::raster const &format,
+                  rect const &to, std::string_view text) {
+  static constexpr auto white = uint32_t{0xffffffff};
+  auto const scale = std::max<std::size_t>((to.height - 2) / 8, 1);
+  auto const advance = 6 * scale;
+  auto const fits = std::min(text.size(), to.width / advance);
+  auto const x0 = to.x + (to.width - fits * advance + scale) / 2;
+  auto const y0 = to.y + (to.height - 7 * scale) / 2;
+
+  for (std::size_t i = 0; i < fits; i += 1) {
+    auto const rows = glyph(text[i]);
+    for (std::size_t row = 0; row < 7; row += 1) {
+      for (std::size_t column = 0; column < 5; column += 1) {
+        if ((rows[row] >> (4 - column) & 1) != 0) {
+          fill(dst, format,
+               {x0 + i * advance + column * scale, y0 + row * scale, scale,
+                scale},
+               white);
+        }
+      }
+    }
+  }
+}
+
+} // namespace multiview
+
+#endif // MULTIVIEW_HPP
@@ -1,6 +1,7 @@
 
 #include "NDI.hpp"
 
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
 #include "triple_buffer.hpp"
@@ -88,7 +89,7 @@ public:
 };
 
 int main(int argc, char **argv) {
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto const ndi = NDIlib{};
 
@@ -1,37 +1,165 @@
 
 #include "NDI.hpp"
 
+#include "audio_convert.hpp"
+#include "colour_convert.hpp"
 #include "ipc_shared_object.hpp"
+#include "passthrough.hpp"
 #include "server/server.hpp"
+#include "server/synchronised.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
+#include "worker_pool.hpp"
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
 #include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using fmt::operator""_a;
 
 using namespace std::literals;
 
+// NDI keeps reading an async frame until the next async send, so with two
+// buffers the copy into one overlaps with NDI encoding the other
+class video_ring {
+private:
+  std::array<std::vector<uint8_t>, 2> buffers;
+  std::size_t next = 0;
+
+public:
+  // Only the buffer NDI has already released is handed out, and it stays the
+  // one handed out until commit, so a frame given up on before it was sent
+  // is converted into the same buffer again
+  auto take(std::size_t size) -> std::span<uint8_t> {
+    auto &buffer = buffers[next];
+    buffer.resize(size);
+    return buffer;
+  }
+  // Right after the buffer taken was sent, NDI keeps it until the next send
+  void commit() { next = (next + 1) % buffers.size(); }
+};
+
+// Latency is from picking up a frame to NDI accepting it
+// Repeated counts router ticks that brought no new frame, dropped counts
+// frames the router wrote that were overwritten before being sent
+class send_stats {
+private:
+  static constexpr auto report_every = 250;
+
+  std::chrono::steady_clock::duration total{};
+  std::chrono::steady_clock::duration longest{};
+  int frames = 0;
+  std::size_t repeated = 0;
+  std::size_t dropped = 0;
+
+public:
+  void record_repeated() { repeated += 1; }
+  void record_dropped(std::size_t count) { dropped += count; }
+
+  void record(std::chrono::steady_clock::duration duration) {
+    total += duration;
+    longest = std::max(longest, duration);
+    frames += 1;
+
+    if (frames == report_every) {
+      using ms = std::chrono::duration<double, std::milli>;
+      std::cerr << fmt::format(
+          "Send latency over {} frames: mean {:.2f}ms, max {:.2f}ms, {} "
+          "repeated, {} dropped\n",
+          frames, std::chrono::duration_cast<ms>(total).count() / frames,
+          std::chrono::duration_cast<ms>(longest).count(), repeated, dropped);
+      total = {};
+      longest = {};
+      frames = 0;
+      repeated = 0;
+      dropped = 0;
+    }
+  }
+};
+
+// UYVY is much cheaper for NDI to encode, UYVA when the keys are needed
+enum class send_format { bgra, uyvy, uyva };
+
+// Converts in bands of rows across the pool, returns the line stride
+auto convert_frame(worker_pool &pool, send_format format,
+                   media_format const &input, std::span<uint8_t const> bgra,
+                   std::span<uint8_t> output) -> std::size_t {
+  if (format == send_format::bgra) {
+    std::ranges::copy(bgra, output.begin());
+    return input.pitch;
+  }
+
+  static constexpr auto band = std::size_t{64};
+  auto const stride = std::size_t{input.width} * 2;
+  auto *const alpha = format == send_format::uyva
+                          ? output.data() + stride * input.height
+                          : nullptr;
+  pool.run((input.height + band - 1) / band, [&](std::size_t i) {
+    auto const last = std::min<std::size_t>((i + 1) * band, input.height);
+    for (auto y = i * band; y < last; y += 1) {
+      colour::bgra_to_uyvy(output.data() + y * stride,
+                           alpha == nullptr ? nullptr : alpha + y * input.width,
+                           bgra.data() + y * input.pitch, input.width);
+    }
+  });
+  return stride;
+}
+
+auto frame_size(send_format format, media_format const &input)
+    -> std::size_t {
+  switch (format) {
+  case send_format::uyvy:
+    return std::size_t{input.width} * 2 * input.height;
+  case send_format::uyva:
+    return std::size_t{input.width} * 3 * input.height;
+  default:
+    return input.video_size();
+  }
+}
+
+auto fourcc(send_format format) -> NDIlib_FourCC_video_type_e {
+  switch (format) {
+  case send_format::uyvy:
+    return NDIlib_FourCC_type_UYVY;
+  case send_format::uyva:
+    return NDIlib_FourCC_type_UYVA;
+  default:
+    return NDIlib_FourCC_type_BGRA;
+  }
+}
+
 template <typename ReloadSender> class http_delegate {
 public:
   using body_type = beast::http::string_body;
 
 private:
   std::string &name;
+  // Read by the main loop once a frame
+  std::atomic<send_format> &format;
   ReloadSender const &reload_sender;
 
 public:
   std::function<void()> reload_clients = [] {};
 
-  http_delegate(std::string &name, ReloadSender const &reload_sender)
-      : name{name}, reload_sender{reload_sender} {}
+  http_delegate(std::string &name, std::atomic<send_format> &format,
+                ReloadSender const &reload_sender)
+      : name{name}, format{format}, reload_sender{reload_sender} {}
 
   template <typename Body, typename Allocator>
   void handle_request(
       beast::http::request<Body, beast::http::basic_fields<Allocator>> &&req,
       auto &&send) {
     if (req.target() == "/") {
+      auto const format_ = format.load(std::memory_order_relaxed);
       auto body = fmt::format(
           R"html(
 <html>
@@ -44,6 +172,13 @@ public:
       value="{name}"
     >
     </input>
+    <br/>
+    Format
+    <select onchange="fetch('/format', {{method: 'POST', body: event.target.value}})">
+      <option value="bgra" {bgra_selected}>BGRA</option>
+      <option value="uyvy" {uyvy_selected}>UYVY</option>
+      <option value="uyva" {uyva_selected}>UYVA</option>
+    </select>
     <script>
       let ws;
       
@@ -67,7 +202,13 @@ public:
   </body>
 </html>
 )html"sv,
-          "name"_a = name);
+          "name"_a = name,
+          "bgra_selected"_a =
+              format_ == send_format::bgra ? "selected"sv : ""sv,
+          "uyvy_selected"_a =
+              format_ == send_format::uyvy ? "selected"sv : ""sv,
+          "uyva_selected"_a =
+              format_ == send_format::uyva ? "selected"sv : ""sv);
       auto mime_type = "text/html"sv;
 
       return http::string_response(req, std::move(body), mime_type, send);
@@ -77,6 +218,14 @@ public:
       reload_sender();
       reload_clients();
       return send(http::empty_response(req));
+    } else if (req.target() == "/format" &&
+               req.method() == beast::http::verb::post) {
+      format.store(req.body() == "uyvy"sv   ? send_format::uyvy
+                   : req.body() == "uyva"sv ? send_format::uyva
+                                            : send_format::bgra,
+                   std::memory_order_relaxed);
+      reload_clients();
+      return send(http::empty_response(req));
     } else {
       return send(http::not_found(req));
     }
@@ -89,90 +238,151 @@ int main(int argc, char **argv) {
   auto const ndi = NDIlib{};
 
   auto name = argc >= 2 ? std::string{argv[1]} : "Open Video Matrix"s;
+  auto format = std::atomic<send_format>{send_format::bgra};
+
+  auto pool = worker_pool{
+      std::clamp(std::thread::hardware_concurrency(), 1u, 4u)};
 
   NDIlib_send_instance_t sender;
 
+  // Of the last frame sent from the current segment
+  auto last_sequence = std::optional<uint32_t>{};
+
   auto reload_sender = [&] {
     auto const send_create =
-        NDIlib_send_create_t{name.c_str(), nullptr, true, false};
+        NDIlib_send_create_t{name.c_str(), nullptr, false, false};
     sender = ndi->send_create(&send_create);
   };
 
   reload_sender();
 
   auto http_delegate_ =
-      std::make_shared<http_delegate<decltype(reload_sender)>>(name,
-                                                               reload_sender);
+      std::make_shared<http_delegate<decltype(reload_sender)>>(
+          name, format, reload_sender);
   auto websocket_delegate_ = std::make_shared<websocket::tracking_delegate>();
   auto server_ = server{http_delegate_, websocket_delegate_, "0.0.0.0", 0, 4};
 
   http_delegate_->reload_clients = [&] { websocket_delegate_->send(""s); };
 
+  // Named by the router's websocket, the main loop maps it between frames
+  auto next_segment = synchronised<std::optional<std::string>>{};
+
   // TODO terminate on disconnect
   auto router_websocket_delegate_ = websocket::make_read_client_delegate(
       [&](std::any &, beast::flat_buffer &buffer) {
-        auto name = std::string{static_cast<char const *>(buffer.data().data()),
-                                buffer.data().size()};
-        input_buffer.emplace(name.c_str());
+        next_segment->emplace(static_cast<char const *>(buffer.data().data()),
+                              buffer.data().size());
       });
   auto router_websocket = server_.connect_to_websocket(
       router_websocket_delegate_, "127.0.0.1", 8080,
       fmt::format("/output_{port}", "port"_a = server_.port()));
 
+  auto video_frames = video_ring{};
+  auto audio_frame_float32_planar = std::vector<float>{};
+  auto stats = send_stats{};
+  auto passthrough = passthrough_reader{};
+
   while (true) {
+    if (auto segment_name =
+            std::exchange(next_segment.lock().get(), std::nullopt)) {
+      input_buffer.emplace(segment_name->c_str());
+      // Every frame is converted out of the segment, so it can just as well
+      // be converted out of the input it was passed through from
+      (*input_buffer)->accept_passthrough();
+      last_sequence = std::nullopt;
+    }
+
     if (input_buffer) {
+      auto const &input_format = (*input_buffer)->format();
+
+      // The router writes once a tick, so this sends each of its frames once
+      // A tick with nothing new is left for receivers to repeat rather than
+      // encoding the same frame again
+      if (!(*input_buffer)->wait_for_novel(input_format.frame_duration() * 3 / 2)) {
+        stats.record_repeated();
+        (*input_buffer)->stats().record_repeated();
+        continue;
+      }
       (*input_buffer)->about_to_read();
+      auto const picked_up = std::chrono::steady_clock::now();
+
+      auto const sequence = (*input_buffer)->read_sequence();
+      if (last_sequence) {
+        stats.record_dropped(
+            triple_buffer::frames_between(*last_sequence, sequence) - 1);
+      }
+      last_sequence = sequence;
+
+      auto const &buffer = (*input_buffer)->read();
+      auto span = trace::span{"display"};
+      span.set_frame(buffer.sequence(), buffer.source_time());
+
+      auto const source = passthrough.acquire(buffer);
+      if (!source) {
+        // The input frame was already gone, so receivers repeat the last one
+        stats.record_repeated();
+        (*input_buffer)->stats().record_repeated();
+        continue;
+      }
+
+      // Once a frame, so it can't change halfway through one
+      // 4:2:2 needs pairs of pixels
+      auto const output_format = input_format.width % 2 == 0
+                                     ? format.load(std::memory_order_relaxed)
+                                     : send_format::bgra;
+      auto const video =
+          video_frames.take(frame_size(output_format, input_format));
+      auto const stride = [&] {
+        auto &stats = (*input_buffer)->stats();
+        auto const timer = output_format == send_format::bgra
+                               ? stats.copy.time()
+                               : stats.convert.time();
+        return convert_frame(pool, output_format, input_format, *source,
+                             video);
+      }();
+      if (!passthrough.release()) {
+        // The input's writer began on the frame while it was converted
+        stats.record_repeated();
+        (*input_buffer)->stats().record_repeated();
+        continue;
+      }
 
       auto video_frame = NDIlib_video_frame_v2_t{
-          triple_buffer::width,
-          triple_buffer::height,
-          NDIlib_FourCC_type_BGRA,
-          25000,
-          1000,
+          static_cast<int>(input_format.width),
+          static_cast<int>(input_format.height),
+          fourcc(output_format),
+          static_cast<int>(input_format.frame_rate_num * 1000),
+          static_cast<int>(input_format.frame_rate_den * 1000),
           0.0f,
           NDIlib_frame_format_type_progressive,
           0,
-          const_cast<uint8_t *>((*input_buffer)->read().video_frame),
-          triple_buffer::pitch};
-
-      static constexpr auto audio_channel_stride =
-          triple_buffer::audio_samples_per_frame_per_channel;
-      auto audio_frame_float32_planar =
-          std::array<float,
-                     triple_buffer::audio_samples_per_frame_all_channels>{};
-
-      for (std::size_t sample = 0;
-           sample < triple_buffer::audio_samples_per_frame_per_channel;
-           sample += 1) {
-        for (std::size_t channel = 0; channel < triple_buffer::num_channels;
-             channel += 1) {
-          static constexpr auto audio_conversion_factor =
-              static_cast<float>((std::numeric_limits<int32_t>::max)());
-
-          audio_frame_float32_planar[channel * audio_channel_stride + sample] =
-              static_cast<float>(
-                  (*input_buffer)
-                      ->read()
-                      .audio_frame[sample * triple_buffer::num_channels +
-                                   channel]) /
-              audio_conversion_factor;
-        }
-      }
+          video.data(),
+          static_cast<int>(stride)};
+
+      auto const audio_channel_stride =
+          input_format.audio_samples_per_frame_per_channel();
+      audio_frame_float32_planar.resize(
+          input_format.audio_samples_per_frame_all_channels());
+
+      audio::deinterleave(buffer.audio_frame(), input_format.num_channels,
+                          audio_frame_float32_planar.data(),
+                          audio_channel_stride);
 
       auto audio_frame = NDIlib_audio_frame_v3_t{
-          triple_buffer::sample_rate,
-          triple_buffer::num_channels,
-          triple_buffer::audio_samples_per_frame_per_channel,
+          static_cast<int>(input_format.sample_rate),
+          static_cast<int>(input_format.num_channels),
+          static_cast<int>(audio_channel_stride),
           NDIlib_send_timecode_synthesize,
           NDIlib_FourCC_type_FLTP,
           reinterpret_cast<uint8_t *>(audio_frame_float32_planar.data()),
-          audio_channel_stride * sizeof(float)};
+          static_cast<int>(audio_channel_stride * sizeof(float))};
 
-      // Using the async version would require holding the lock too long
-      ndi->send_send_video_v2(sender, &video_frame);
+      ndi->send_send_video_async_v2(sender, &video_frame);
+      video_frames.commit();
+      stats.record(std::chrono::steady_clock::now() - picked_up);
       ndi->send_send_audio_v3(sender, &audio_frame);
     } else {
-      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::this_thread::sleep_for(10ms);
     }
   }
 }
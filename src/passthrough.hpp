@@ -0,0 +1,70 @@
+#ifndef PASSTHROUGH_HPP
+#define PASSTHROUGH_HPP
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+#include <boost/interprocess/exceptions.hpp>
+
+#include "broadcast_buffer.hpp"
+#include "ipc_shared_object.hpp"
+#include "triple_buffer.hpp"
+
+// For output processes that accept_passthrough, follows frames the router
+// passed through by reference to the input segment they were read from
+// Nothing is held between acquire and release, so the input never waits for
+// an output, instead release says whether the input's writer began writing
+// over the frame meanwhile, and anything made from it must then be dropped
+// Copy or convert the frame straight out and release, don't keep it
+class passthrough_reader {
+private:
+  std::string source_name;
+  std::optional<ipc_unmanaged_object<broadcast_buffer>> source;
+  std::optional<broadcast_buffer::borrowed> borrowed;
+
+public:
+  passthrough_reader() = default;
+  passthrough_reader(passthrough_reader const &) = delete;
+
+  // The video of the frame, or nothing if it referred to a frame that is
+  // already gone from the input
+  auto acquire(triple_buffer::buffer const &frame)
+      -> std::optional<std::span<uint8_t const>> {
+    borrowed.reset();
+    auto const reference = frame.passthrough();
+    if (!reference) {
+      return frame.video_frame();
+    }
+
+    if (!source || source_name != reference->name) {
+      source.reset();
+      source_name = reference->name;
+      try {
+        source.emplace(source_name.c_str());
+      } catch (ipc::interprocess_exception const &) {
+        // The input was removed since
+        return std::nullopt;
+      }
+    }
+
+    borrowed = (*source)->borrow(reference->sequence);
+    if (!borrowed ||
+        borrowed->frame->video_frame().size() != frame.video_frame().size()) {
+      borrowed.reset();
+      return std::nullopt;
+    }
+    return borrowed->frame->video_frame();
+  }
+
+  // Whether the frame acquired was still whole once used, always so for a
+  // frame that wasn't passed through
+  auto release() -> bool {
+    auto const intact = !borrowed || (*source)->intact(*borrowed);
+    borrowed.reset();
+    return intact;
+  }
+};
+
+#endif // PASSTHROUGH_HPP
@@ -1,7 +1,9 @@
 
 #include "base64.hpp"
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
 
 #include <poppler-document.h>
@@ -214,16 +216,17 @@ auto make_thumbnail(poppler::page const &page, std::optional<std::string> key)
   return encode_image(thumb_img);
 }
 
-auto make_slide(poppler::page const &page, std::optional<std::string> key)
-    -> std::unique_ptr<triple_buffer::buffer> {
+auto make_slide(poppler::page const &page, std::optional<std::string> key,
+                media_format const &format)
+    -> std::unique_ptr<triple_buffer::frame> {
   auto page_rect = page.page_rect();
   auto width_pdf = page_rect.width();
   auto height_pdf = page_rect.height();
   auto width_in = width_pdf / 72;
   auto height_in = height_pdf / 72;
 
-  auto dpi_x = triple_buffer::width / width_in;
-  auto dpi_y = triple_buffer::height / height_in;
+  auto dpi_x = format.width / width_in;
+  auto dpi_y = format.height / height_in;
 
   auto renderer = poppler::page_renderer{};
   // It seems that endianness is backwards so this is actually bgra
@@ -235,9 +238,15 @@ auto make_slide(poppler::page const &page, std::optional<std::string> key)
     key_image(image, *key);
   }
 
-  auto buffer = std::make_unique<triple_buffer::buffer>();
-  std::copy_n(image.const_data(), triple_buffer::size,
-              std::begin(buffer->video_frame));
+  auto buffer = std::make_unique<triple_buffer::frame>(format);
+  auto const rows =
+      std::min(std::size_t{format.height}, static_cast<size_t>(image.height()));
+  auto const row_bytes = std::min(std::size_t{format.width} * 4,
+                                  static_cast<size_t>(image.bytes_per_row()));
+  for (std::size_t y = 0; y < rows; y += 1) {
+    std::copy_n(image.const_data() + y * image.bytes_per_row(), row_bytes,
+                buffer->video_frame().begin() + y * format.pitch);
+  }
   return buffer;
 }
 
@@ -511,7 +520,7 @@ int main(int argc, char **argv) {
 
   auto key = std::optional<std::string>{};
 
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto websocket_delegate_ = std::make_shared<websocket::tracking_delegate>();
   auto reload_clients = [&] { websocket_delegate_->send(""s); };
@@ -520,10 +529,21 @@ int main(int argc, char **argv) {
     if (document) {
       if (active_slide < document->pages()) {
         if (output_buffer) {
+          auto span = trace::span{"produce"};
           auto page = std::unique_ptr<poppler::page>{
               document->create_page(active_slide)};
-          (*output_buffer)->write() = *make_slide(*page, key);
+          auto &stats = (*output_buffer)->stats();
+          auto const slide = [&] {
+            auto const timer = stats.convert.time();
+            return make_slide(*page, key, (*output_buffer)->format());
+          }();
+          {
+            auto const timer = stats.copy.time();
+            slide->copy_to((*output_buffer)->write());
+          }
+          auto const &written = (*output_buffer)->write();
           (*output_buffer)->done_writing();
+          span.set_frame(written.sequence(), written.source_time());
         }
       } else {
         std::cerr << "Slide out of bounds\n";
@@ -0,0 +1,194 @@
+#ifndef PIPELINE_STATS_HPP
+#define PIPELINE_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+// Counters kept in each triple_buffer segment, bumped by the processes on
+// either side and read by the router for /metrics
+// Only relaxed atomics on memory that is already mapped, so recording never
+// makes a syscall
+class pipeline_stats {
+public:
+  // Upper bounds of the latency histogram, the last bucket is unbounded
+  static constexpr auto latency_bounds =
+      std::array<std::chrono::microseconds, 8>{
+          std::chrono::microseconds{500}, std::chrono::milliseconds{1},
+          std::chrono::milliseconds{2},   std::chrono::milliseconds{5},
+          std::chrono::milliseconds{10},  std::chrono::milliseconds{20},
+          std::chrono::milliseconds{40},  std::chrono::milliseconds{80}};
+
+  struct duration_total {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> nanoseconds = 0;
+
+    void record(std::chrono::nanoseconds duration) {
+      count.fetch_add(1, std::memory_order_relaxed);
+      nanoseconds.fetch_add(static_cast<uint64_t>(duration.count()),
+                            std::memory_order_relaxed);
+    }
+
+    // Records the time until it goes out of scope
+    struct scoped_timer {
+      duration_total &total;
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+
+      scoped_timer(duration_total &total) : total{total} {}
+      scoped_timer(scoped_timer const &) = delete;
+      ~scoped_timer() { total.record(std::chrono::steady_clock::now() - start); }
+    };
+
+    auto time() -> scoped_timer { return {*this}; }
+  };
+
+  static auto now() -> uint64_t {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+  // Writer side
+  alignas(64) std::atomic<uint64_t> frames_written = 0;
+  // Steady clock nanoseconds, the same across processes on one machine
+  std::atomic<uint64_t> last_write = 0;
+
+  // Reader side
+  alignas(64) std::atomic<uint64_t> frames_read = 0;
+  // Written but overwritten before the reader picked them up
+  std::atomic<uint64_t> frames_dropped = 0;
+  // Times the reader wanted a frame and had to reuse the last one
+  std::atomic<uint64_t> frames_repeated = 0;
+  // Time spent copying frames in or out of the segment
+  duration_total copy;
+  // Time spent converting frames to or from another format
+  duration_total convert;
+
+  // From a frame being written to it being read
+  std::array<std::atomic<uint64_t>, latency_bounds.size() + 1>
+      latency_buckets{};
+  duration_total latency;
+
+  void record_write() {
+    frames_written.fetch_add(1, std::memory_order_relaxed);
+    last_write.store(now(), std::memory_order_relaxed);
+  }
+
+  void record_read(uint32_t dropped) {
+    frames_read.fetch_add(1, std::memory_order_relaxed);
+    frames_dropped.fetch_add(dropped, std::memory_order_relaxed);
+
+    auto const written = last_write.load(std::memory_order_relaxed);
+    auto const read = now();
+    auto const age = std::chrono::nanoseconds{
+        read > written ? static_cast<int64_t>(read - written) : 0};
+    auto bucket = std::size_t{0};
+    while (bucket < latency_bounds.size() && age > latency_bounds[bucket]) {
+      bucket += 1;
+    }
+    latency_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    latency.record(age);
+  }
+
+  void record_repeated() {
+    frames_repeated.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  struct labelled {
+    // Prometheus labels, like device="input",port="8081"
+    std::string labels;
+    pipeline_stats const *stats;
+  };
+
+  // Prometheus text format, each metric with all its devices together
+  static auto metrics(std::vector<labelled> const &devices) -> std::string {
+    auto out = std::string{};
+    auto const family = [&](std::string_view name, std::string_view type,
+                            std::string_view help, auto const &samples) {
+      fmt::format_to(std::back_inserter(out),
+                     "# HELP ovm_{0} {2}\n# TYPE ovm_{0} {1}\n", name, type,
+                     help);
+      for (auto const &device : devices) {
+        samples(device.labels, *device.stats);
+      }
+    };
+    auto const sample = [&](std::string_view name, std::string_view labels,
+                            auto value) {
+      fmt::format_to(std::back_inserter(out), "ovm_{}{{{}}} {}\n", name,
+                     labels, value);
+    };
+    auto const seconds = [](uint64_t nanoseconds) {
+      return static_cast<double>(nanoseconds) / 1e9;
+    };
+    auto const counter = [&](std::string_view name, std::string_view help,
+                             auto field) {
+      family(name, "counter", help,
+             [&](std::string_view labels, pipeline_stats const &stats) {
+               sample(name, labels, field(stats));
+             });
+    };
+
+    counter("frames_written_total", "Frames written to the segment",
+            [](auto const &stats) { return stats.frames_written.load(); });
+    family("last_write_seconds", "gauge",
+           "Steady clock time of the last frame written",
+           [&](std::string_view labels, pipeline_stats const &stats) {
+             sample("last_write_seconds", labels,
+                    seconds(stats.last_write.load()));
+           });
+    counter("frames_read_total", "Frames read from the segment",
+            [](auto const &stats) { return stats.frames_read.load(); });
+    counter("frames_dropped_total",
+            "Frames overwritten before they were read",
+            [](auto const &stats) { return stats.frames_dropped.load(); });
+    counter("frames_repeated_total",
+            "Times a reader reused the last frame for want of a new one",
+            [](auto const &stats) { return stats.frames_repeated.load(); });
+    counter("copy_seconds_total", "Time spent copying frames",
+            [&](auto const &stats) {
+              return seconds(stats.copy.nanoseconds.load());
+            });
+    counter("convert_seconds_total",
+            "Time spent converting frames between formats",
+            [&](auto const &stats) {
+              return seconds(stats.convert.nanoseconds.load());
+            });
+
+    family("latency_seconds", "histogram",
+           "Time from a frame being written to it being read",
+           [&](std::string_view labels, pipeline_stats const &stats) {
+             auto cumulative = uint64_t{0};
+             for (std::size_t i = 0; i < stats.latency_buckets.size();
+                  i += 1) {
+               cumulative += stats.latency_buckets[i].load();
+               auto const bound =
+                   i < latency_bounds.size()
+                       ? fmt::format("{}", std::chrono::duration<double>{
+                                               latency_bounds[i]}
+                                               .count())
+                       : std::string{"+Inf"};
+               sample("latency_seconds_bucket",
+                      fmt::format("{},le=\"{}\"", labels, bound),
+                      cumulative);
+             }
+             sample("latency_seconds_sum", labels,
+                    seconds(stats.latency.nanoseconds.load()));
+             sample("latency_seconds_count", labels,
+                    stats.latency.count.load());
+           });
+
+    return out;
+  }
+};
+
+#endif // PIPELINE_STATS_HPP
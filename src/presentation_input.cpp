@@ -1,6 +1,8 @@
 
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
 
 #pragma clang diagnostic push
@@ -135,16 +137,25 @@ template <> struct fmt::formatter<thumbnail> {
   }
 };
 
-void convert_slide(Magick::Image &img, triple_buffer::buffer &buffer,
+void convert_slide(Magick::Image &img, triple_buffer::frame &slide,
                    thumbnail &thumbnail_) {
+  auto const &format = slide.format();
   try {
-    img.resize({triple_buffer::width, triple_buffer::height});
+    img.resize({format.width, format.height});
     auto bg_colour = Magick::ColorRGB(0, 0, 0);
     bg_colour.alpha(0);
-    img.extent({triple_buffer::width, triple_buffer::height}, bg_colour,
+    img.extent({format.width, format.height}, bg_colour,
                Magick::CenterGravity);
-    img.write(0, 0, triple_buffer::width, triple_buffer::height, "BGRA",
-              Magick::CharPixel, buffer.video_frame);
+    if (format.pitch == format.width * 4) {
+      img.write(0, 0, format.width, format.height, "BGRA", Magick::CharPixel,
+                slide.video_frame().data());
+    } else {
+      for (std::size_t y = 0; y < format.height; y += 1) {
+        img.write(0, static_cast<ssize_t>(y), format.width, 1, "BGRA",
+                  Magick::CharPixel,
+                  slide.video_frame().data() + y * format.pitch);
+      }
+    }
 
     img.resize({192, 108});
     auto thumbnail_blob = Magick::Blob{};
@@ -164,7 +175,8 @@ public:
 private:
   std::string_view name;
   std::string_view root_dir;
-  std::vector<triple_buffer::buffer> &slides;
+  std::vector<triple_buffer::frame> &slides;
+  media_format const &format;
   std::vector<thumbnail> &thumbnails;
   std::size_t &active_slide;
   WriteFrame const &write_frame;
@@ -173,11 +185,12 @@ public:
   std::function<void()> reload_clients = [] {};
 
   http_delegate(std::string_view name, std::string_view root_dir,
-                std::vector<triple_buffer::buffer> &slides,
-                std::vector<thumbnail> &thumbnails, std::size_t &active_slide,
-                WriteFrame const &write_frame)
-      : name{name}, root_dir{root_dir}, slides{slides}, thumbnails{thumbnails},
-        active_slide{active_slide}, write_frame{write_frame} {}
+                std::vector<triple_buffer::frame> &slides,
+                media_format const &format, std::vector<thumbnail> &thumbnails,
+                std::size_t &active_slide, WriteFrame const &write_frame)
+      : name{name}, root_dir{root_dir}, slides{slides}, format{format},
+        thumbnails{thumbnails}, active_slide{active_slide},
+        write_frame{write_frame} {}
 
   template <typename Body, typename Allocator>
   void handle_request(
@@ -321,12 +334,13 @@ public:
             std::cerr << "Magick exception: " << e.what() << '\n';
           }
           slides.clear();
-          slides.resize(magick_slides.size());
+          slides.reserve(magick_slides.size());
           thumbnails.clear();
           thumbnails.reserve(magick_slides.size());
           for (std::size_t i = 0; i < magick_slides.size(); i += 1) {
+            auto &slide = slides.emplace_back(format);
             auto &thumbnail_ = thumbnails.emplace_back(i, active_slide);
-            convert_slide(magick_slides[i], slides[i], thumbnail_);
+            convert_slide(magick_slides[i], slide, thumbnail_);
           }
           active_slide = 0;
           write_frame();
@@ -414,17 +428,30 @@ int main(int argc, char **argv) {
 
   Magick::InitializeMagick(nullptr);
 
-  auto slides = std::vector<triple_buffer::buffer>{};
+  auto slides = std::vector<triple_buffer::frame>{};
   auto thumbnails = std::vector<thumbnail>{};
   auto active_slide = std::size_t{0};
 
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
+  // Slides are rendered ahead of time, so at the router's format if known
+  auto format = media_format{};
 
   auto write_frame = [&] {
     if (active_slide < slides.size()) {
       if (output_buffer) {
-        (*output_buffer)->write() = slides[active_slide];
-        (*output_buffer)->done_writing();
+        if (slides[active_slide].format() == format) {
+          auto span = trace::span{"produce"};
+          {
+            auto const timer = (*output_buffer)->stats().copy.time();
+            slides[active_slide].copy_to((*output_buffer)->write());
+          }
+          auto const &written = (*output_buffer)->write();
+          (*output_buffer)->done_writing();
+          span.set_frame(written.sequence(), written.source_time());
+        } else {
+          std::cerr << "Slides were rendered at a different format, please "
+                       "reopen the file\n";
+        }
       }
     } else {
       std::cerr << "Slide out of bounds\n";
@@ -432,7 +459,7 @@ int main(int argc, char **argv) {
   };
 
   auto http_delegate_ = std::make_shared<http_delegate<decltype(write_frame)>>(
-      name, root_dir, slides, thumbnails, active_slide, write_frame);
+      name, root_dir, slides, format, thumbnails, active_slide, write_frame);
   auto websocket_delegate_ = std::make_shared<websocket::tracking_delegate>();
   auto server_ = server{http_delegate_, websocket_delegate_, "0.0.0.0", 0, 4};
 
@@ -444,6 +471,7 @@ int main(int argc, char **argv) {
         auto name = std::string{static_cast<char const *>(buffer.data().data()),
                                 buffer.data().size()};
         output_buffer.emplace(name.c_str());
+        format = (*output_buffer)->format();
         write_frame();
       });
   auto router_websocket = server_.connect_to_websocket(
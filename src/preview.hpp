@@ -0,0 +1,75 @@
+#ifndef PREVIEW_HPP
+#define PREVIEW_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "compositor.hpp"
+
+// The small pictures of each device shown on the router's page
+namespace preview {
+
+static constexpr auto width = std::size_t{320};
+
+// 320 wide, keeping the aspect of the frames it is made from
+inline auto raster_for(compositor::raster const &format)
+    -> compositor::raster {
+  auto const height =
+      std::max<std::size_t>(width * format.height / format.width, 1);
+  return {width, height, width * 4};
+}
+
+// Appends a PNG of an opaque BGRA picture to out
+// Only the fastest zlib level, a preview is sent once and soon replaced
+inline void encode_png(std::string &out, uint8_t const *pixels,
+                       compositor::raster const &format) {
+  auto *png = png_create_write_struct(
+      PNG_LIBPNG_VER_STRING, nullptr,
+      [](png_structp, png_const_charp message) {
+        std::cerr << "Cannot encode preview: " << message << '\n';
+        std::terminate();
+      },
+      nullptr);
+  auto *info = png == nullptr ? nullptr : png_create_info_struct(png);
+  if (info == nullptr) {
+    std::cerr << "Cannot create PNG encoder\n";
+    std::terminate();
+  }
+
+  png_set_write_fn(
+      png, &out,
+      [](png_structp png, png_bytep data, png_size_t size) {
+        static_cast<std::string *>(png_get_io_ptr(png))
+            ->append(reinterpret_cast<char const *>(data), size);
+      },
+      nullptr);
+  png_set_compression_level(png, 1);
+  png_set_IHDR(png, info, static_cast<png_uint_32>(format.width),
+               static_cast<png_uint_32>(format.height), 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+  // Written straight from BGRA, dropping the alpha
+  png_set_bgr(png);
+  png_set_filler(png, 0, PNG_FILLER_AFTER);
+
+  thread_local auto rows = std::vector<png_bytep>{};
+  rows.resize(format.height);
+  for (std::size_t y = 0; y < format.height; y += 1) {
+    rows[y] = const_cast<png_bytep>(pixels + y * format.pitch);
+  }
+  png_write_image(png, rows.data());
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+}
+
+} // namespace preview
+
+#endif // PREVIEW_HPP
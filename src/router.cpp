@@ -1,13 +1,31 @@
 #include <algorithm>
 #include <atomic>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
 #include <regex>
+#include <span>
+#include <sstream>
+#include <stop_token>
+#include <string>
 #include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
 
 #include <boost/process/child.hpp>
 #include <boost/process/io.hpp>
@@ -15,314 +33,26 @@
 
 #include <fmt/format.h>
 
+#include <range/v3/view/iota.hpp>
 #include <range/v3/view/transform.hpp>
 
+#include "broadcast_buffer.hpp"
+#include "compositor.hpp"
+#include "frame_clock.hpp"
 #include "ipc_shared_object.hpp"
+#include "matrix.hpp"
+#include "multiview.hpp"
+#include "preview.hpp"
 #include "server/server.hpp"
+#include "server/synchronised.hpp"
+#include "trace.hpp"
 #include "triple_buffer.hpp"
+#include "worker_pool.hpp"
 
 namespace ipc = boost::interprocess;
 
 using fmt::operator""_a;
 
-void alpha_over(triple_buffer::video_frame_t &dst,
-                triple_buffer::video_frame_t const &src) {
-  for (std::size_t i = 0; i < triple_buffer::size; i += 4) {
-    // Div by 256 is much cheaper, so factor should range from 1 to 256
-    // mult by 1 div by 256 will be 0
-
-    auto factor = 256 - src[i + 3];
-    for (std::size_t j = i; j < i + 4; j += 1) {
-      dst[j] = static_cast<uint8_t>(src[j] + (dst[j] * factor) / 256);
-    }
-  }
-}
-
-void alpha_over(triple_buffer::buffer &dst, triple_buffer::buffer const &src) {
-  alpha_over(dst.video_frame, src.video_frame);
-
-  //  std::transform(std::begin(src.audio_frame), std::end(src.audio_frame),
-  //                 std::begin(dst.audio_frame), std::begin(dst.audio_frame),
-  //                 std::plus{});
-  std::copy(std::begin(src.audio_frame), std::end(src.audio_frame),
-            std::begin(dst.audio_frame));
-}
-
-class io_device {
-private:
-  unsigned short _port;
-
-  ipc_managed_object<triple_buffer> buffer;
-
-public:
-  io_device(io_device const &) = delete;
-  io_device(io_device &&) = delete;
-
-  io_device(unsigned short port) : _port{port} {}
-
-  auto name() const -> std::string const & { return buffer.name(); }
-  auto port() const -> unsigned short { return _port; }
-
-  auto operator->() const -> triple_buffer const * { return buffer.data(); }
-  auto operator->() -> triple_buffer * { return buffer.data(); }
-};
-
-class output_device {
-private:
-  io_device device;
-
-public:
-  output_device(auto &&...args)
-      : device{std::forward<decltype(args)>(args)...} {}
-
-  auto name() const -> std::string const & { return device.name(); }
-  auto port() const -> unsigned short { return device.port(); }
-
-  void done_writing() { device->done_writing(); }
-  auto write() -> triple_buffer::buffer & { return device->write(); }
-
-  void trigger_sync() { device->trigger_sync(); }
-  void wait_for_sync() { device->wait_for_sync(); }
-};
-
-class input_device {
-private:
-  io_device device;
-
-public:
-  std::vector<std::weak_ptr<output_device>> outputs;
-
-  input_device(auto &&...args)
-      : device{std::forward<decltype(args)>(args)...} {}
-
-  auto name() const -> std::string const & { return device.name(); }
-  auto port() const -> unsigned short { return device.port(); }
-
-  void about_to_read() { device->about_to_read(); }
-  auto read() const -> triple_buffer::buffer const & { return device->read(); }
-
-  void trigger_sync() { device->trigger_sync(); }
-  void wait_for_sync() { device->wait_for_sync(); }
-
-  auto has_output(output_device const *output) -> bool {
-    for (auto &output2 : outputs) {
-      if (output == output2.lock().get()) {
-        return true;
-      }
-    }
-    return false;
-  }
-
-  void add_output(std::shared_ptr<output_device> output) {
-    if (!has_output(output.get())) {
-      outputs.push_back(output);
-    }
-  }
-
-  void remove_output(output_device const *output) {
-    std::erase_if(outputs, [&](std::weak_ptr<output_device> const &output2) {
-      return output == output2.lock().get();
-    });
-  }
-};
-
-class matrix {
-public:
-  std::vector<std::weak_ptr<input_device>> inputs;
-  std::vector<std::weak_ptr<output_device>> outputs;
-
-  std::function<void()> reload_clients = [] {};
-
-private:
-  struct has_name {
-    std::string_view name;
-
-    auto operator()(auto const &device) -> bool {
-      return device.lock()->name() == name;
-    }
-  };
-
-  auto find_input(std::string_view name) -> std::shared_ptr<input_device> {
-    auto input = std::find_if(inputs.begin(), inputs.end(), has_name{name});
-    if (input == inputs.end()) {
-      return {};
-    } else {
-      return input->lock();
-    }
-  }
-
-  auto find_output(std::string_view name) -> std::shared_ptr<output_device> {
-    auto output = std::find_if(outputs.begin(), outputs.end(), has_name{name});
-    if (output == outputs.end()) {
-      return {};
-    } else {
-      return output->lock();
-    }
-  }
-
-public:
-  void add_input(std::weak_ptr<input_device> input) {
-    inputs.push_back(std::move(input));
-  }
-
-  void add_output(std::shared_ptr<output_device> output) {
-    auto empty = std::make_unique<triple_buffer::buffer>();
-    output->write().clear();
-    output->done_writing();
-    outputs.push_back(output);
-  }
-
-  void remove_input(std::string_view name) {
-    if (auto input = find_input(name)) {
-      std::erase_if(inputs, [&](std::weak_ptr<input_device> const &input2) {
-        return input == input2.lock();
-      });
-    } else {
-      std::cerr << "Invalid input: " << name << '\n';
-    }
-  }
-
-  void remove_output(std::string_view name) {
-    if (auto output = find_output(name)) {
-      for (auto &_input : inputs) {
-        if (auto input = _input.lock()) {
-          input->remove_output(output.get());
-        }
-      }
-      std::erase_if(outputs, [&](std::weak_ptr<output_device> const &output2) {
-        return output == output2.lock();
-      });
-    } else {
-      std::cerr << "Invalid output: " << name << '\n';
-    }
-  }
-
-  void bring_input_forward(std::string_view name) {
-    auto input = std::find_if(inputs.begin(), inputs.end(), has_name{name});
-    if (input != inputs.end() && input + 1 != inputs.end()) {
-      std::swap(*input, *(input + 1));
-    }
-    reload_clients();
-  }
-
-  void bring_input_backward(std::string_view name) {
-    auto input = std::find_if(inputs.begin(), inputs.end(), has_name{name});
-    if (input != inputs.end() && input != inputs.begin()) {
-      std::swap(*input, *(input - 1));
-    }
-    reload_clients();
-  }
-
-  auto is_connected(std::string_view input_name, std::string_view output_name)
-      -> bool {
-    auto input = find_input(input_name);
-    auto output = find_output(output_name);
-
-    if (input) {
-      if (output) {
-        return input->has_output(output.get());
-      } else {
-        std::cerr << "Invalid output: " << output_name << '\n';
-        return false;
-      }
-    } else {
-      if (output) {
-        std::cerr << "Invalid input: " << input_name << '\n';
-        return false;
-      } else {
-        std::cerr << "Invalid input: " << input_name
-                  << " and output: " << output_name << '\n';
-        return false;
-      }
-    }
-  }
-
-  void connect(std::string_view input_name, std::string_view output_name,
-               bool value = true) {
-    auto input = find_input(input_name);
-    auto output = find_output(output_name);
-
-    if (input) {
-      if (output) {
-        if (value) {
-          input->add_output(output);
-        } else {
-          input->remove_output(output.get());
-        }
-      } else {
-        std::cerr << "Invalid output: " << output_name << '\n';
-      }
-    } else {
-      if (output) {
-        std::cerr << "Invalid input: " << input_name << '\n';
-      } else {
-        std::cerr << "Invalid input: " << input_name
-                  << " and output: " << output_name << '\n';
-      }
-    }
-
-    reload_clients();
-  }
-
-  void run(auto duration) {
-    auto nextFrame = std::chrono::steady_clock::now();
-
-    while (true) {
-      std::this_thread::sleep_until(nextFrame);
-      nextFrame += duration;
-
-      std::erase_if(inputs, [](std::weak_ptr<input_device> const &input) {
-        return input.expired();
-      });
-      std::erase_if(outputs, [](std::weak_ptr<output_device> const &output) {
-        return output.expired();
-      });
-      for (auto &_input : inputs) {
-        if (auto input = _input.lock()) {
-          std::erase_if(input->outputs,
-                        [](std::weak_ptr<output_device> const &output) {
-                          return output.expired();
-                        });
-        }
-      }
-      // TODO if anything was erased, reload
-
-      for (auto &_output : outputs) {
-        if (auto output = _output.lock()) {
-          output->write().clear();
-        }
-      }
-      for (auto &_input : inputs) {
-        if (auto input = _input.lock()) {
-          if (!input->outputs.empty()) {
-            input->about_to_read();
-            for (auto &_output : input->outputs) {
-              if (auto output = _output.lock()) {
-                alpha_over(output->write(), input->read());
-              }
-            }
-          }
-        }
-      }
-      for (auto &_output : outputs) {
-        if (auto output = _output.lock()) {
-          output->done_writing();
-        }
-      }
-      for (auto &_input : inputs) {
-        if (auto input = _input.lock()) {
-          input->trigger_sync();
-        }
-      }
-      for (auto &_output : outputs) {
-        if (auto output = _output.lock()) {
-          output->trigger_sync();
-        }
-      }
-    }
-  }
-};
-
 #include "router_html.hpp"
 
 struct http_delegate {
@@ -337,26 +67,25 @@ struct http_delegate {
       beast::http::request<Body, beast::http::basic_fields<Allocator>> &&req,
       auto &&send) {
     if (req.target() == "/") {
+      auto const routing_ = matrix_.snapshot();
       auto body = fmt::format(
           router_html,
           "output_headers"_a =
-              fmt::join(matrix_.outputs |
+              fmt::join(routing_->outputs |
                             ranges::views::transform(device_header_cell::make),
                         ""),
-          "input_rows"_a =
-              fmt::join(matrix_.inputs |
-                            ranges::views::transform(
-                                [&](std::weak_ptr<input_device> const &_input) {
-                                  if (auto input = _input.lock()) {
-                                    return input_row{*input, matrix_.outputs};
-                                  } else {
-                                    return input_row{};
-                                  }
-                                }),
-                        ""));
+          "input_rows"_a = fmt::join(
+              ranges::views::iota(std::size_t{0}, routing_->inputs.size()) |
+                  ranges::views::transform([&](std::size_t input) {
+                    return input_row{*routing_, input};
+                  }),
+              ""));
       auto mime_type = "text/html"sv;
 
       return http::string_response(req, std::move(body), mime_type, send);
+    } else if (req.target() == "/metrics") {
+      return http::string_response(req, matrix_.metrics(),
+                                   "text/plain; version=0.0.4"sv, send);
     } else if (req.target() == "/bring_input_forward") {
       matrix_.bring_input_forward(req.body());
       return send(http::empty_response(req));
@@ -376,6 +105,67 @@ struct http_delegate {
         }
       }
       return send(http::bad_request(req, "Cannot parse body"));
+    } else if (req.target() == "/salvo" &&
+               req.method() == beast::http::verb::post) {
+      auto salvo_ = salvo::parse(req.body());
+      if (!salvo_) {
+        return send(http::bad_request(req, "Cannot parse salvo"));
+      }
+      auto const scheduled = matrix_.schedule(std::move(*salvo_));
+      if (auto const *error = std::get_if<std::string>(&scheduled)) {
+        return send(http::bad_request(req, *error));
+      }
+      auto const [id, frame] = std::get<std::pair<uint64_t, uint64_t>>(scheduled);
+      return http::string_response(
+          req, fmt::format("Salvo {} scheduled for frame {}\n", id, frame),
+          "text/plain"sv, send);
+    } else if (auto match = std::cmatch{}; std::regex_match(
+                   req.target().begin(), req.target().end(), match,
+                   std::regex{R"(/salvo/(\d+))"})) {
+      auto const id = std::stoull(match[1]);
+      auto const status = matrix_.status(id);
+      if (!status) {
+        return send(http::not_found(req));
+      }
+      auto body = !status->applied_frame
+                      ? fmt::format("Salvo {} pending for frame {}\n", id,
+                                    status->scheduled_frame)
+                  : status->error
+                      ? fmt::format("Salvo {} rejected at frame {}: {}\n", id,
+                                    *status->applied_frame, *status->error)
+                      : fmt::format("Salvo {} applied at frame {}\n", id,
+                                    *status->applied_frame);
+      return http::string_response(req, std::move(body), "text/plain"sv, send);
+    } else if (req.target() == "/multiview" && matrix_.multiview_enabled()) {
+      auto const every = matrix_.multiview_every.load();
+      auto body = fmt::format(
+          multiview_html,
+          "every_options"_a = fmt::join(
+              multiview_rates |
+                  ranges::views::transform(multiview_rate_option::make(every)),
+              ""),
+          "outputs_checked"_a =
+              matrix_.multiview_outputs.load() ? "checked"sv : ""sv);
+      return http::string_response(req, std::move(body), "text/html"sv, send);
+    } else if (req.target() == "/multiview/every" &&
+               req.method() == beast::http::verb::post &&
+               matrix_.multiview_enabled()) {
+      auto every = uint32_t{};
+      auto const &body = req.body();
+      if (std::from_chars(body.data(), body.data() + body.size(), every).ptr !=
+          body.data() + body.size()) {
+        return send(http::bad_request(req, "Cannot parse body"));
+      }
+      matrix_.multiview_every = every;
+      return send(http::empty_response(req));
+    } else if (req.target() == "/multiview/outputs" &&
+               req.method() == beast::http::verb::post &&
+               matrix_.multiview_enabled()) {
+      matrix_.multiview_outputs = req.body() == "true"sv;
+      return send(http::empty_response(req));
+    } else if (req.target() == "/frame") {
+      return http::string_response(
+          req, fmt::format("{}\n", matrix_.frame()), "text/plain"sv, send);
     } else {
       return send(http::not_found(req));
     }
@@ -395,27 +185,112 @@ public:
     if (auto matches = std::smatch{};
         std::regex_match(target, matches, std::regex{R"(/input_(\d*))"})) {
       auto port = static_cast<unsigned short>(std::stoi(matches[1]));
-      auto device = std::make_shared<input_device>(port);
+      auto device = std::make_shared<input_device>(port, _matrix.format);
       websocket::send(client.shared_from_this(),
                       std::make_shared<std::string>(device->name()));
       _matrix.add_input(device);
       return device;
     } else if (auto matches = std::smatch{}; std::regex_match(
-                   target, matches, std::regex{R"(/output_(\d*))"})) {
+                   target, matches,
+                   std::regex{R"(/output_(\d*)(?:\?hold=(\d+))?)"})) {
       auto port = static_cast<unsigned short>(std::stoi(matches[1]));
-      auto device = std::make_shared<output_device>(port);
+      auto const held_slots =
+          matches[2].matched ? std::min(std::stoul(matches[2]),
+                                        triple_buffer::max_held_slots)
+                             : std::size_t{0};
+      auto device =
+          std::make_shared<output_device>(port, _matrix.format, held_slots);
       websocket::send(client.shared_from_this(),
                       std::make_shared<std::string>(device->name()));
       _matrix.add_output(device);
       return device;
     } else {
-      return this->websocket::tracking_delegate::on_connect(client, target);
+      auto user_data =
+          this->websocket::tracking_delegate::on_connect(client, target);
+      _matrix.each_preview(
+          [&](std::string const &device, previewer::message const &message) {
+            websocket::send(client.shared_from_this(), message, device);
+          });
+      return user_data;
     }
   }
+
+  void on_disconnect(std::any &user_data, websocket::session &client) override {
+    if (auto *input = std::any_cast<std::shared_ptr<input_device>>(&user_data)) {
+      _matrix.remove_input(input->get());
+    } else if (auto *output =
+                   std::any_cast<std::shared_ptr<output_device>>(&user_data)) {
+      _matrix.remove_output(output->get());
+    }
+    this->websocket::tracking_delegate::on_disconnect(user_data, client);
+  }
 };
 
-int main(int, char **) {
-  auto matrix_ = matrix{};
+int main(int argc, char **argv) {
+  auto num_threads = std::size_t{std::thread::hardware_concurrency()};
+  auto format = media_format{};
+  auto clock_name = "timer"sv;
+  auto policy = late_policy::skip;
+  auto multiview = false;
+  auto multiview_every = uint32_t{5};
+  auto multiview_outputs = false;
+  auto preview_every = std::optional<uint32_t>{};
+  // Runs for ever unless set
+  auto frames = std::numeric_limits<uint64_t>::max();
+  for (auto i = 1; i < argc; i += 1) {
+    if (argv[i] == "--threads"sv && i + 1 < argc) {
+      num_threads = static_cast<std::size_t>(std::stoul(argv[++i]));
+    } else if (argv[i] == "--format"sv && i + 1 < argc) {
+      if (auto parsed = media_format::parse(argv[++i])) {
+        format = *parsed;
+      } else {
+        std::cerr << "Invalid format: " << argv[i] << '\n';
+        return 1;
+      }
+    } else if (argv[i] == "--clock"sv && i + 1 < argc &&
+               (argv[i + 1] == "timer"sv || argv[i + 1] == "realtime"sv ||
+                argv[i + 1] == "input"sv || argv[i + 1] == "simulated"sv)) {
+      clock_name = argv[++i];
+    } else if (argv[i] == "--late"sv && i + 1 < argc &&
+               (argv[i + 1] == "skip"sv || argv[i + 1] == "catch-up"sv)) {
+      policy = argv[++i] == "skip"sv ? late_policy::skip
+                                     : late_policy::catch_up;
+    } else if (argv[i] == "--multiview"sv) {
+      multiview = true;
+    } else if (argv[i] == "--multiview-every"sv && i + 1 < argc) {
+      multiview = true;
+      multiview_every = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (argv[i] == "--multiview-outputs"sv) {
+      multiview = true;
+      multiview_outputs = true;
+    } else if (argv[i] == "--preview-every"sv && i + 1 < argc) {
+      preview_every = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (argv[i] == "--frames"sv && i + 1 < argc) {
+      frames = static_cast<uint64_t>(std::stoull(argv[++i]));
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--threads N] [--format 1080p25]"
+                   " [--clock timer|realtime|input|simulated]"
+                   " [--late skip|catch-up]"
+                   " [--multiview] [--multiview-every N]"
+                   " [--multiview-outputs] [--preview-every N]"
+                   " [--frames N]\n";
+      return 1;
+    }
+  }
+
+  num_threads = std::max(num_threads, std::size_t{1});
+
+  std::cerr << "Compositing with "
+            << compositor::isa_name(compositor::best_isa()) << " on "
+            << num_threads << " threads\n";
+  auto pool = worker_pool{num_threads};
+
+  std::cerr << fmt::format("Format {}x{} at {}/{} fps\n", format.width,
+                           format.height, format.frame_rate_num,
+                           format.frame_rate_den);
+
+  auto matrix_ = matrix{format};
 
   auto http_delegate_ = std::make_shared<http_delegate>(matrix_);
   auto websocket_delegate_ = std::make_shared<websocket_delegate>(matrix_);
@@ -424,5 +299,38 @@ int main(int, char **) {
 
   matrix_.reload_clients = [&] { websocket_delegate_->send(""s); };
 
-  matrix_.run(40ms);
+  // About two a second unless asked otherwise
+  matrix_.preview_every = preview_every.value_or(std::max<uint32_t>(
+      format.frame_rate_num / format.frame_rate_den / 2, 1));
+  matrix_.enable_previews(
+      [&](std::string const &device, previewer::message message) {
+        websocket_delegate_->send(message, device);
+      });
+
+  matrix_.multiview_every = multiview_every;
+  matrix_.multiview_outputs = multiview_outputs;
+  if (multiview) {
+    matrix_.enable_multiview(server_.port());
+    std::cerr << fmt::format("Multiview updating every {} frames\n",
+                             multiview_every);
+  }
+
+  auto clock = [&]() -> std::unique_ptr<frame_clock> {
+    if (clock_name == "input"sv) {
+      return std::make_unique<input_clock>(
+          format.frame_duration(), policy,
+          [&](std::chrono::nanoseconds timeout) {
+            return matrix_.wait_for_clock_input(timeout);
+          });
+    } else if (clock_name == "simulated"sv) {
+      // As fast as the ticks run, with salvos and timecodes on its timeline
+      return std::make_unique<simulated_clock>(format.frame_duration(), policy);
+    } else {
+      return std::make_unique<timer_clock>(format.frame_duration(), policy,
+                                           clock_name == "realtime"sv);
+    }
+  }();
+  std::cerr << fmt::format("Ticking from the {} clock\n", clock_name);
+
+  matrix_.run(pool, *clock, frames);
 }
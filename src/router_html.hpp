@@ -2,6 +2,8 @@
 #define ROUTER_HTML_HPP
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <string_view>
 #include <vector>
@@ -18,22 +20,15 @@ struct device_header_cell {
 public:
   std::string const &name;
   unsigned short port;
+  std::string const &page;
 
-private:
-  static inline auto const empty_name = ""s;
-  device_header_cell(auto const &, int) : name{empty_name}, port{0} {}
-
-public:
   template <typename Device>
-  device_header_cell(Device const &dev) : name{dev.name()}, port{dev.port()} {}
+  device_header_cell(Device const &dev)
+      : name{dev.name()}, port{dev.port()}, page{dev.page()} {}
 
   static constexpr auto make =
-      []<typename Device>(std::weak_ptr<Device> const &_dev) {
-        if (auto dev = _dev.lock()) {
-          return device_header_cell{*dev};
-        } else {
-          return device_header_cell{_dev, 0};
-        }
+      []<typename Device>(std::shared_ptr<Device> const &dev) {
+        return device_header_cell{*dev};
       };
 };
 
@@ -49,42 +44,34 @@ template <> struct fmt::formatter<device_header_cell> {
     auto iframe_id = fmt::format("header_iframe_{}", dev.name);
     return fmt::format_to(ctx.out(), R"html(
 <th>
+  <img class="preview" id="preview_{name}" />
+  <br />
   <iframe class="header_iframe" id="{iframe_id}">
   </iframe>
   <script>
-    document.getElementById("{iframe_id}").src = `http://${{window.location.hostname}}:{port}`;
+    document.getElementById("{iframe_id}").src = `http://${{window.location.hostname}}:{port}{page}`;
   </script>
 </th>
 )html",
-                          "iframe_id"_a = iframe_id, "port"_a = dev.port);
+                          "iframe_id"_a = iframe_id, "name"_a = dev.name,
+                          "port"_a = dev.port,
+                          "page"_a = dev.page);
   }
 };
 
 class matrix_cell {
 private:
-  struct data_t {
-    input_device const &input;
-    output_device const &output;
-
-    data_t(input_device const &input, output_device const &output)
-        : input{input}, output{output} {}
-  };
-
-  std::optional<data_t> data;
+  routing const &routing_;
+  std::size_t input;
+  std::size_t output;
 
 public:
-  matrix_cell() = default;
-
-  matrix_cell(input_device const &input, output_device const &output)
-      : data{std::in_place, input, output} {}
-
-  static constexpr auto make(input_device const &input) {
-    return [&input](std::weak_ptr<output_device> const &_output) {
-      if (auto output = _output.lock()) {
-        return matrix_cell{input, *output};
-      } else {
-        return matrix_cell{};
-      }
+  matrix_cell(routing const &routing_, std::size_t input, std::size_t output)
+      : routing_{routing_}, input{input}, output{output} {}
+
+  static constexpr auto make(routing const &routing_, std::size_t input) {
+    return [&routing_, input](std::size_t output) {
+      return matrix_cell{routing_, input, output};
     };
   }
 
@@ -99,15 +86,9 @@ template <> struct fmt::formatter<matrix_cell> {
   }
 
   auto format(matrix_cell const &cell, auto &ctx) const -> decltype(ctx.out()) {
-    if (cell.data) {
-      auto checked =
-          std::find_if(cell.data->input.outputs.begin(),
-                       cell.data->input.outputs.end(),
-                       [&](std::weak_ptr<output_device> const &output) {
-                         return output.lock().get() == &cell.data->output;
-                       }) != cell.data->input.outputs.end();
-      return fmt::format_to(ctx.out(),
-                            R"html(
+    return fmt::format_to(
+        ctx.out(),
+        R"html(
 <td>
   <input
     type="checkbox"
@@ -116,34 +97,22 @@ template <> struct fmt::formatter<matrix_cell> {
   />
 </td>
 )html",
-                            "checked"_a = checked ? "checked"sv : ""sv,
-                            "input"_a = cell.data->input.name(),
-                            "output"_a = cell.data->output.name());
-    } else {
-      return fmt::format_to(ctx.out(), "");
-    }
+        "checked"_a = cell.routing_.connected(cell.input, cell.output)
+                          ? "checked"sv
+                          : ""sv,
+        "input"_a = cell.routing_.inputs[cell.input]->name(),
+        "output"_a = cell.routing_.outputs[cell.output]->name());
   }
 };
 
 class input_row {
 private:
-  struct data_t {
-    input_device const &input;
-    std::vector<std::weak_ptr<output_device>> const &outputs;
-
-    data_t(input_device const &input,
-           std::vector<std::weak_ptr<output_device>> const &outputs)
-        : input{input}, outputs{outputs} {}
-  };
-
-  std::optional<data_t> data;
+  routing const &routing_;
+  std::size_t input;
 
 public:
-  input_row() = default;
-
-  input_row(input_device const &input,
-            std::vector<std::weak_ptr<output_device>> const &outputs)
-      : data{std::in_place, input, outputs} {}
+  input_row(routing const &routing_, std::size_t input)
+      : routing_{routing_}, input{input} {}
 
   template <typename, typename, typename> friend struct fmt::formatter;
 };
@@ -156,10 +125,10 @@ template <> struct fmt::formatter<input_row> {
   }
 
   auto format(input_row const &row, auto &ctx) const -> decltype(ctx.out()) {
-    if (row.data) {
-      return fmt::format_to(
-          ctx.out(),
-          R"html(
+    auto const &input = *row.routing_.inputs[row.input];
+    return fmt::format_to(
+        ctx.out(),
+        R"html(
 <tr>
   <th>
     <table>
@@ -183,15 +152,13 @@ template <> struct fmt::formatter<input_row> {
   {cells}
 </tr>
 )html",
-          "name"_a = std::string{row.data->input.name()},
-          "header"_a = device_header_cell{row.data->input},
-          "cells"_a = fmt::join(
-              row.data->outputs |
-                  ranges::views::transform(matrix_cell::make(row.data->input)),
-              ""));
-    } else {
-      return fmt::format_to(ctx.out(), "");
-    }
+        "name"_a = std::string{input.name()},
+        "header"_a = device_header_cell{input},
+        "cells"_a = fmt::join(
+            ranges::views::iota(std::size_t{0}, row.routing_.outputs.size()) |
+                ranges::views::transform(
+                    matrix_cell::make(row.routing_, row.input)),
+            ""));
   }
 };
 
@@ -215,6 +182,13 @@ constexpr auto router_html = R"html(
         vertical-align: middle;
       }}
 
+      .preview {{
+        width: 300px;
+        aspect-ratio: 16 / 9;
+        object-fit: contain;
+        background-color: black;
+      }}
+
       .header_iframe {{
         width: 300px;
         height: 200px;
@@ -328,16 +302,39 @@ constexpr auto router_html = R"html(
         }}
       }});
 
+      // A preview is the device's name, a newline and a PNG, an empty
+      // message means the routing changed
+      function show_preview(data) {{
+        const bytes = new Uint8Array(data);
+        const newline = bytes.indexOf(10);
+        const name = new TextDecoder().decode(bytes.subarray(0, newline));
+        const img = document.getElementById(`preview_${{name}}`);
+        if (img === null) {{
+          return;
+        }}
+        const old_src = img.src;
+        img.src = URL.createObjectURL(
+          new Blob([bytes.subarray(newline + 1)], {{type: "image/png"}}));
+        if (old_src.startsWith("blob:")) {{
+          URL.revokeObjectURL(old_src);
+        }}
+      }}
+
       let ws;
 
       function open_ws() {{
         ws = new WebSocket(`ws://${{window.location.host}}`);
+        ws.binaryType = "arraybuffer";
         ws.onopen = function(ev) {{}};
         ws.onclose = function(ev) {{
           console.log(`Close: ${{ev}}`);
         }};
         ws.onmessage = function(ev) {{
-          window.location.reload();
+          if (ev.data.byteLength > 0) {{
+            show_preview(ev.data);
+          }} else {{
+            window.location.reload();
+          }}
         }};
         ws.onerror = function(ev) {{
           console.log(`Error: ${{ev}}`);
@@ -351,4 +348,68 @@ constexpr auto router_html = R"html(
 </html>
 )html"sv;
 
+// The mosaic's own page, shown in its header cell
+constexpr auto multiview_html = R"html(
+<html>
+  <head>
+  </head>
+  <body>
+    <h2>Multiview</h2>
+    Update
+    <select onchange="fetch('/multiview/every', {{method: 'POST', body: event.target.value}})">
+      {every_options}
+    </select>
+    <br/>
+    <label>
+      <input
+        type="checkbox"
+        {outputs_checked}
+        onclick="fetch('/multiview/outputs', {{method: 'POST', body: `${{event.target.checked}}`}})"
+      />
+      Show outputs
+    </label>
+  </body>
+</html>
+)html";
+
+// Ticks between mosaic updates offered on its page, zero is paused
+constexpr auto multiview_rates = std::array<uint32_t, 6>{1, 2, 5, 10, 25, 0};
+
+struct multiview_rate_option {
+  bool selected;
+  uint32_t every;
+
+  static constexpr auto make(uint32_t selected_every) {
+    return [selected_every](uint32_t every) {
+      return multiview_rate_option{selected_every == every, every};
+    };
+  }
+};
+
+template <> struct fmt::formatter<multiview_rate_option> {
+  constexpr auto parse(format_parse_context &ctx) -> decltype(ctx.begin()) {
+    if (ctx.begin() != ctx.end() && *ctx.begin() != '}')
+      throw format_error("invalid format");
+    return ctx.begin();
+  }
+
+  auto format(multiview_rate_option const &rate, auto &ctx) const
+      -> decltype(ctx.out()) {
+    auto const selected = rate.selected ? "selected"sv : ""sv;
+    if (rate.every == 0) {
+      return fmt::format_to(
+          ctx.out(), R"html(<option value="0" {}>Paused</option>)html",
+          selected);
+    } else if (rate.every == 1) {
+      return fmt::format_to(
+          ctx.out(), R"html(<option value="1" {}>Every frame</option>)html",
+          selected);
+    }
+    return fmt::format_to(
+        ctx.out(),
+        R"html(<option value="{every}" {selected}>Every {every} frames</option>)html",
+        "every"_a = rate.every, "selected"_a = selected);
+  }
+};
+
 #endif // ROUTER_HTML_HPP
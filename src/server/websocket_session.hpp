@@ -6,6 +6,7 @@
 #include "net.hpp"
 #include "synchronised.hpp"
 
+#include <algorithm>
 #include <any>
 #include <cstdlib>
 #include <memory>
@@ -39,7 +40,14 @@ private:
   std::shared_ptr<delegate> _delegate;
   beast::flat_buffer _buffer;
   beast::websocket::stream<beast::tcp_stream> ws_;
-  std::vector<std::shared_ptr<std::string const>> queue_;
+  struct queued {
+    std::shared_ptr<std::string const> message;
+    // A message still waiting is replaced by a later one with the same key,
+    // never if empty
+    std::string key;
+  };
+  // The front is the one being written
+  std::vector<queued> queue_;
 
   std::any user_data;
 
@@ -79,7 +87,7 @@ private:
 
     // Send the next message if any
     if (!queue.empty()) {
-      ws.async_write(net::buffer(*queue.front()),
+      ws.async_write(net::buffer(*queue.front().message),
                      [self = std::move(self)](beast::error_code ec,
                                               std::size_t bytes_transferred) {
                        on_write(std::move(self), ec, bytes_transferred);
@@ -108,7 +116,8 @@ public:
                                 std::any user_data) -> std::shared_ptr<session>;
 
   friend void send(std::shared_ptr<session> self,
-                   std::shared_ptr<std::string const> const &ss);
+                   std::shared_ptr<std::string const> const &ss,
+                   std::string key);
 };
 
 template <typename Body, typename Allocator>
@@ -213,19 +222,32 @@ inline auto connect_to_server(std::shared_ptr<delegate> _delegate,
   return self;
 }
 
+// Messages with a key, say the picture of one device, replace any still
+// waiting with the same key, so a slow client only ever has the newest of each
+// queued
 inline void send(std::shared_ptr<session> self,
-                 std::shared_ptr<std::string const> const &ss) {
+                 std::shared_ptr<std::string const> const &ss,
+                 std::string key = {}) {
   auto &ws = self->ws_;
   // Post our work to the strand, this ensures
   // that the members of `this` will not be
   // accessed concurrently.
 
-  net::post(ws.get_executor(), [self = std::move(self), ss] {
+  net::post(ws.get_executor(), [self = std::move(self), ss,
+                                key = std::move(key)]() mutable {
     auto &ws = self->ws_;
     auto &queue = self->queue_;
 
-    // Always add to queue
-    queue.push_back(ss);
+    if (!key.empty() && queue.size() > 1) {
+      auto const waiting =
+          std::find_if(std::next(queue.begin()), queue.end(),
+                       [&](auto const &queued_) { return queued_.key == key; });
+      if (waiting != queue.end()) {
+        waiting->message = ss;
+        return;
+      }
+    }
+    queue.push_back({ss, std::move(key)});
 
     // Are we already writing?
     if (queue.size() > 1)
@@ -233,7 +255,7 @@ inline void send(std::shared_ptr<session> self,
 
     // We are not currently writing, so send this immediately
     ws.async_write(
-        net::buffer(*queue.front()),
+        net::buffer(*queue.front().message),
         beast::bind_front_handler(&session::on_write, std::move(self)));
   });
 }
@@ -283,11 +305,14 @@ public:
   void on_read(std::any &, beast::flat_buffer &) override {}
 
   void send(std::string msg) {
-    auto shared_msg = std::make_shared<std::string const>(std::move(msg));
+    send(std::make_shared<std::string const>(std::move(msg)));
+  }
 
+  void send(std::shared_ptr<std::string const> const &shared_msg,
+            std::string const &key = {}) {
     auto locked_clients = clients.lock();
     for (auto client : locked_clients.get()) {
-      websocket::send(client->shared_from_this(), shared_msg);
+      websocket::send(client->shared_from_this(), shared_msg, key);
     }
   }
 };
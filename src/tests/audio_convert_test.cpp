@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "../audio_convert.hpp"
+
+// Round trips through every conversion stay within the precision of the
+// narrower format, and the AVX2 kernels match the scalar loops bit for bit
+
+namespace {
+
+auto ok = true;
+
+void expect(bool condition, char const *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << '\n';
+    ok = false;
+  }
+}
+
+auto random_int32(std::mt19937 &rng, std::size_t count)
+    -> std::vector<int32_t> {
+  auto dist = std::uniform_int_distribution<int32_t>{
+      std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()};
+  auto samples = std::vector<int32_t>(count);
+  for (auto &sample : samples) {
+    sample = dist(rng);
+  }
+  // The ends of the range, and small values that floats hold exactly
+  if (count >= 4) {
+    samples[0] = std::numeric_limits<int32_t>::min();
+    samples[1] = std::numeric_limits<int32_t>::max();
+    samples[2] = 0;
+    samples[3] = -1;
+  }
+  return samples;
+}
+
+// Out of range as well, to check clipping
+auto random_float(std::mt19937 &rng, std::size_t count) -> std::vector<float> {
+  auto dist = std::uniform_real_distribution<float>{-1.5f, 1.5f};
+  auto samples = std::vector<float>(count);
+  for (auto &sample : samples) {
+    sample = dist(rng);
+  }
+  if (count >= 4) {
+    samples[0] = -1.0f;
+    samples[1] = 1.0f;
+    samples[2] = 0.0f;
+    samples[3] = std::nextafter(1.0f, 0.0f);
+  }
+  return samples;
+}
+
+// A float has 24 bits of mantissa, so an int32 loses at most its low 7 bits
+auto within_float_precision(int32_t a, int32_t b) -> bool {
+  return std::abs(static_cast<int64_t>(a) - static_cast<int64_t>(b)) <= 128;
+}
+
+void test_round_trips(std::mt19937 &rng) {
+  auto const count = std::size_t{4099};
+
+  auto const ints = random_int32(rng, count);
+  auto floats = std::vector<float>(count);
+  auto back = std::vector<int32_t>(count);
+  audio::convert(std::span<int32_t const>{ints}, std::span{floats});
+  audio::convert(std::span<float const>{floats}, std::span{back});
+  auto all_close = true;
+  for (std::size_t i = 0; i < count; i += 1) {
+    all_close = all_close && within_float_precision(ints[i], back[i]);
+  }
+  expect(all_close, "int32 to float to int32 within float precision");
+  expect(back[2] == 0 && back[3] == -1, "small int32 survive float exactly");
+
+  auto const shorts = [&] {
+    auto shorts = std::vector<int16_t>(count);
+    for (std::size_t i = 0; i < count; i += 1) {
+      shorts[i] = static_cast<int16_t>(ints[i] >> 16);
+    }
+    return shorts;
+  }();
+  auto widened = std::vector<int32_t>(count);
+  auto narrowed = std::vector<int16_t>(count);
+  audio::convert(std::span<int16_t const>{shorts}, std::span{widened});
+  audio::convert(std::span<int32_t const>{widened}, std::span{narrowed});
+  expect(narrowed == shorts, "int16 to int32 to int16 is exact");
+
+  // Floats within range come back to within one int32 step
+  auto const in_range = [&] {
+    auto in_range = random_float(rng, count);
+    for (auto &sample : in_range) {
+      sample = std::clamp(sample, -1.0f, std::nextafter(1.0f, 0.0f));
+    }
+    return in_range;
+  }();
+  auto as_ints = std::vector<int32_t>(count);
+  auto as_floats = std::vector<float>(count);
+  audio::convert(std::span<float const>{in_range}, std::span{as_ints});
+  audio::convert(std::span<int32_t const>{as_ints}, std::span{as_floats});
+  auto float_close = true;
+  for (std::size_t i = 0; i < count; i += 1) {
+    float_close = float_close &&
+                  std::abs(as_floats[i] - in_range[i]) <= 1.0f / 2147483648.0f;
+  }
+  expect(float_close, "float to int32 to float within one int32 step");
+
+  expect(audio::int32_to_float(std::numeric_limits<int32_t>::min()) == -1.0f,
+         "int32 minimum is -1");
+  expect(audio::float_to_int32(1.0f) == 2147483520,
+         "1 clips to the largest float below full scale");
+  expect(audio::float_to_int32(-2.0f) == std::numeric_limits<int32_t>::min(),
+         "below -1 clips to the int32 minimum");
+  expect(audio::float_to_int32(std::numeric_limits<float>::quiet_NaN()) ==
+             std::numeric_limits<int32_t>::min(),
+         "NaN goes to the int32 minimum");
+
+  for (std::size_t channels : {1, 2, 3, 8}) {
+    auto const samples = std::size_t{1923};
+    auto const stride = samples + 5;
+    auto const interleaved = random_int32(rng, samples * channels);
+    auto planes = std::vector<float>(stride * channels);
+    auto again = std::vector<int32_t>(samples * channels);
+    audio::deinterleave(interleaved, channels, planes.data(), stride);
+    audio::interleave(planes.data(), stride, channels, again);
+
+    auto planar_close = true;
+    for (std::size_t i = 0; i < interleaved.size(); i += 1) {
+      planar_close =
+          planar_close && within_float_precision(interleaved[i], again[i]);
+    }
+    // Each plane starts stride after the last
+    for (std::size_t channel = 0; channel < channels; channel += 1) {
+      auto const sample = interleaved[7 * channels + channel];
+      planar_close = planar_close && planes[channel * stride + 7] ==
+                                         audio::int32_to_float(sample);
+    }
+    expect(planar_close, "deinterleave and interleave round trip");
+  }
+}
+
+#if defined(AUDIO_CONVERT_X86)
+
+void test_kernels(std::mt19937 &rng) {
+  for (std::size_t count = 0; count <= 70; count += 1) {
+    auto const ints = random_int32(rng, count);
+    auto const floats = [&] {
+      auto floats = random_float(rng, count);
+      // In the first eight lanes and the next eight, the tail for short runs
+      if (count >= 12) {
+        floats[4] = std::numeric_limits<float>::quiet_NaN();
+        floats[10] = std::numeric_limits<float>::quiet_NaN();
+        floats[11] = -std::numeric_limits<float>::infinity();
+      }
+      return floats;
+    }();
+    auto const shorts = [&] {
+      auto shorts = std::vector<int16_t>(count);
+      for (std::size_t i = 0; i < count; i += 1) {
+        shorts[i] = static_cast<int16_t>(ints[i]);
+      }
+      return shorts;
+    }();
+
+    auto float_out = std::vector<float>(count);
+    auto float_expected = std::vector<float>(count);
+    audio::int32_to_float_avx2(float_out.data(), ints.data(), count);
+    for (std::size_t i = 0; i < count; i += 1) {
+      float_expected[i] = audio::int32_to_float(ints[i]);
+    }
+    expect(float_out == float_expected, "int32_to_float_avx2 matches scalar");
+
+    auto int_out = std::vector<int32_t>(count);
+    auto int_expected = std::vector<int32_t>(count);
+    audio::float_to_int32_avx2(int_out.data(), floats.data(), count);
+    for (std::size_t i = 0; i < count; i += 1) {
+      int_expected[i] = audio::float_to_int32(floats[i]);
+    }
+    expect(int_out == int_expected, "float_to_int32_avx2 matches scalar");
+
+    audio::int16_to_int32_avx2(int_out.data(), shorts.data(), count);
+    for (std::size_t i = 0; i < count; i += 1) {
+      int_expected[i] = audio::int16_to_int32(shorts[i]);
+    }
+    expect(int_out == int_expected, "int16_to_int32_avx2 matches scalar");
+
+    auto short_out = std::vector<int16_t>(count);
+    auto short_expected = std::vector<int16_t>(count);
+    audio::int32_to_int16_avx2(short_out.data(), ints.data(), count);
+    for (std::size_t i = 0; i < count; i += 1) {
+      short_expected[i] = audio::int32_to_int16(ints[i]);
+    }
+    expect(short_out == short_expected, "int32_to_int16_avx2 matches scalar");
+
+    auto const samples = count / 2;
+    auto left = std::vector<float>(samples);
+    auto right = std::vector<float>(samples);
+    audio::stereo_to_float_planar_avx2(left.data(), right.data(), ints.data(),
+                                       samples);
+    auto planar_match = true;
+    for (std::size_t i = 0; i < samples; i += 1) {
+      planar_match = planar_match &&
+                     left[i] == audio::int32_to_float(ints[2 * i]) &&
+                     right[i] == audio::int32_to_float(ints[2 * i + 1]);
+    }
+    expect(planar_match, "stereo_to_float_planar_avx2 matches scalar");
+
+    auto stereo = std::vector<int32_t>(samples * 2);
+    audio::float_planar_to_stereo_avx2(stereo.data(), floats.data(),
+                                       floats.data() + samples, samples);
+    auto stereo_match = true;
+    for (std::size_t i = 0; i < samples; i += 1) {
+      stereo_match =
+          stereo_match &&
+          stereo[2 * i] == audio::float_to_int32(floats[i]) &&
+          stereo[2 * i + 1] == audio::float_to_int32(floats[samples + i]);
+    }
+    expect(stereo_match, "float_planar_to_stereo_avx2 matches scalar");
+  }
+}
+
+#endif // AUDIO_CONVERT_X86
+
+} // namespace
+
+auto main() -> int {
+  auto rng = std::mt19937{7};
+  test_round_trips(rng);
+#if defined(AUDIO_CONVERT_X86)
+  if (audio::use_avx2()) {
+    test_kernels(rng);
+  } else {
+    std::cout << "AVX2 not supported, kernels not compared\n";
+  }
+#endif
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../broadcast_buffer.hpp"
+#include "../ipc_shared_object.hpp"
+#include "frame_pattern.hpp"
+
+// One writer process writes flat out while readers in processes of their own
+// read at different rates, every frame each reader reads must be whole, move
+// forwards, and stay as it was for as long as the reader holds it
+// One reader is stopped while it holds a frame until its cursor goes to a new
+// reader, and once it carries on it must find itself detached without
+// touching anything its successor holds
+// The writer must never find every slot held
+
+namespace {
+
+using namespace std::chrono_literals;
+
+auto test_format() -> media_format {
+  auto format = media_format{};
+  format.width = 320;
+  format.height = 180;
+  format.pitch = format.width * 4;
+  return format;
+}
+
+[[noreturn]] void fail(char const *what) {
+  std::cerr << what << '\n';
+  std::exit(1);
+}
+
+[[noreturn]] void write_frames(char const *name) {
+  auto segment = ipc_unmanaged_object<broadcast_buffer>{name};
+  for (auto number = uint64_t{1};; number += 1) {
+    frame_pattern::fill(segment->write(), number);
+    segment->done_writing();
+  }
+}
+
+// Reads for the duration, holding each frame for the pause
+void read_frames(broadcast_buffer::reader &reader,
+                 std::chrono::nanoseconds pause,
+                 std::chrono::nanoseconds duration) {
+  auto const end = std::chrono::steady_clock::now() + duration;
+  auto last = uint64_t{0};
+  auto reads = 0;
+  while (std::chrono::steady_clock::now() < end) {
+    if (!reader.wait_for_novel(5s)) {
+      fail("Writer stalled");
+    }
+    if (!reader.about_to_read()) {
+      fail("Reader lost its cursor");
+    }
+    auto const &frame = reader.read();
+    if (frame_pattern::check(frame) != frame.sequence()) {
+      fail("Read a torn frame");
+    }
+    if (frame.sequence() <= last) {
+      fail("Read an older frame");
+    }
+    last = frame.sequence();
+    reads += 1;
+
+    std::this_thread::sleep_for(pause);
+    if (frame_pattern::check(frame) != last) {
+      fail("Frame written over while held");
+    }
+  }
+  if (reads == 0) {
+    fail("Read nothing");
+  }
+}
+
+[[noreturn]] void reader_(char const *name, std::chrono::nanoseconds pause) {
+  auto segment = ipc_unmanaged_object<broadcast_buffer>{name};
+  auto reader = segment->attach();
+  if (!reader) {
+    fail("No cursor for a reader");
+  }
+  read_frames(*reader, pause, 5s);
+  std::exit(0);
+}
+
+[[noreturn]] void stalled(char const *name) {
+  auto segment = ipc_unmanaged_object<broadcast_buffer>{name};
+  auto reader = segment->attach();
+  if (!reader || !reader->wait_for_novel(5s) || !reader->about_to_read()) {
+    fail("Stalled reader read nothing");
+  }
+  raise(SIGSTOP);
+
+  auto const end = std::chrono::steady_clock::now() + 1s;
+  while (std::chrono::steady_clock::now() < end) {
+    if (reader->attached() || reader->about_to_read()) {
+      fail("Stalled reader kept its cursor");
+    }
+    std::this_thread::sleep_for(1ms);
+  }
+  std::exit(0);
+}
+
+// Tells the parent through ready once it has the stalled reader's cursor
+[[noreturn]] void successor(char const *name, int ready) {
+  auto segment = ipc_unmanaged_object<broadcast_buffer>{name};
+  auto reader = segment->attach();
+  if (!reader) {
+    fail("Stalled reader's cursor not handed on");
+  }
+  if (write(ready, "", 1) != 1) {
+    fail("Cannot signal the parent");
+  }
+  read_frames(*reader, 10ms, 2s);
+  std::exit(0);
+}
+
+auto exited_ok(pid_t pid) -> bool {
+  auto status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+} // namespace
+
+auto main() -> int {
+  auto segment = ipc_managed_object<broadcast_buffer>{test_format(), 3};
+  auto const *name = segment.name().c_str();
+
+  auto const writer_ = fork();
+  if (writer_ == 0) {
+    write_frames(name);
+  }
+  auto const fast = fork();
+  if (fast == 0) {
+    reader_(name, 0ms);
+  }
+  auto const slow = fork();
+  if (slow == 0) {
+    reader_(name, 20ms);
+  }
+  auto const stalled_ = fork();
+  if (stalled_ == 0) {
+    stalled(name);
+  }
+
+  waitpid(stalled_, nullptr, WUNTRACED);
+  std::this_thread::sleep_for(2500ms);
+
+  int ready[2];
+  if (pipe(ready) != 0) {
+    std::cerr << "Cannot make a pipe\n";
+    return 1;
+  }
+  auto const successor_ = fork();
+  if (successor_ == 0) {
+    successor(name, ready[1]);
+  }
+  close(ready[1]);
+  auto ok = true;
+  char byte;
+  if (read(ready[0], &byte, 1) == 1) {
+    if (segment->attach()) {
+      std::cerr << "Attached with every cursor in use\n";
+      ok = false;
+    }
+  }
+  kill(stalled_, SIGCONT);
+
+  for (auto pid : {fast, slow, stalled_, successor_}) {
+    ok = exited_ok(pid) && ok;
+  }
+  if (waitpid(writer_, nullptr, WNOHANG) != 0) {
+    std::cerr << "Writer died\n";
+    ok = false;
+  }
+  kill(writer_, SIGKILL);
+  waitpid(writer_, nullptr, 0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../colour_convert.hpp"
+
+// BGRA to UYVY against BT.709 worked out in floating point, round trips back
+// to BGRA through the inverse, and the AVX2 kernel against the scalar one
+
+namespace {
+
+auto ok = true;
+
+void expect(bool condition, char const *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << '\n';
+    ok = false;
+  }
+}
+
+// BT.709 in limited range, the reference the fixed point must stay near
+struct ycbcr {
+  double y;
+  double cb;
+  double cr;
+};
+
+auto reference(double b, double g, double r) -> ycbcr {
+  auto const luma = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+  return {16 + 219 * luma / 255, 128 + 224 * (b - luma) / 1.8556 / 255,
+          128 + 224 * (r - luma) / 1.5748 / 255};
+}
+
+// The inverse, as a receiver of the UYVY would decode it
+auto to_bgra(double y, double cb, double cr) -> std::array<double, 3> {
+  auto const luma = (y - 16) * 255 / 219;
+  auto const pb = (cb - 128) * 255 / 224;
+  auto const pr = (cr - 128) * 255 / 224;
+  auto const r = luma + 1.5748 * pr;
+  auto const b = luma + 1.8556 * pb;
+  auto const g = (luma - 0.2126 * r - 0.0722 * b) / 0.7152;
+  return {b, g, r};
+}
+
+auto random_row(std::mt19937 &rng, std::size_t width) -> std::vector<uint8_t> {
+  auto dist = std::uniform_int_distribution<int>{0, 255};
+  auto row = std::vector<uint8_t>(width * 4);
+  for (auto &byte : row) {
+    byte = static_cast<uint8_t>(dist(rng));
+  }
+  return row;
+}
+
+void test_accuracy(std::mt19937 &rng) {
+  auto const width = std::size_t{4096};
+  auto bgra = random_row(rng, width);
+  // Both pixels of a pair the same colour, so chroma subsampling loses
+  // nothing and the round trip shows only the error of the conversion
+  for (std::size_t x = 0; x < width; x += 2) {
+    std::copy_n(bgra.begin() + static_cast<std::ptrdiff_t>(x * 4), 4,
+                bgra.begin() + static_cast<std::ptrdiff_t>(x * 4 + 4));
+  }
+  auto uyvy = std::vector<uint8_t>(width * 2);
+  colour::bgra_to_uyvy_scalar(uyvy.data(), nullptr, bgra.data(), width);
+
+  auto worst_y = 0.0;
+  auto worst_c = 0.0;
+  auto worst_round_trip = 0.0;
+  for (std::size_t x = 0; x < width; x += 2) {
+    auto const *p = bgra.data() + x * 4;
+    auto const *out = uyvy.data() + x * 2;
+    auto const expected = reference(p[0], p[1], p[2]);
+    worst_y = std::max(worst_y, std::abs(out[1] - expected.y));
+    worst_y = std::max(worst_y, std::abs(out[3] - expected.y));
+    worst_c = std::max(worst_c, std::abs(out[0] - expected.cb));
+    worst_c = std::max(worst_c, std::abs(out[2] - expected.cr));
+
+    auto const back = to_bgra(out[1], out[0], out[2]);
+    for (std::size_t c = 0; c < 3; c += 1) {
+      worst_round_trip = std::max(worst_round_trip, std::abs(back[c] - p[c]));
+    }
+  }
+  std::cout << "Worst error: luma " << worst_y << ", chroma " << worst_c
+            << ", round trip " << worst_round_trip << '\n';
+  // Rounding to the nearest code, plus the Q15 coefficients
+  expect(worst_y <= 0.51, "luma within rounding of BT.709");
+  expect(worst_c <= 0.51, "chroma within rounding of BT.709");
+  // A code of limited range luma is more than one code of full range, and
+  // a code of chroma moves red or blue by nearly two
+  expect(worst_round_trip <= 2.0, "BGRA round trips within 2 codes");
+
+  // The ends of the range exactly
+  auto const black_white =
+      std::vector<uint8_t>{0, 0, 0, 255, 0, 0, 0, 255, 255, 255, 255, 255,
+                           255, 255, 255, 255};
+  auto out = std::vector<uint8_t>(8);
+  colour::bgra_to_uyvy_scalar(out.data(), nullptr, black_white.data(), 4);
+  expect(out == std::vector<uint8_t>{128, 16, 128, 16, 128, 235, 128, 235},
+         "black and white are 16 and 235 with no chroma");
+
+  // Greys never have any chroma
+  auto grey = std::vector<uint8_t>(256 * 2 * 4);
+  for (std::size_t v = 0; v < 256; v += 1) {
+    for (std::size_t i = 0; i < 8; i += 1) {
+      grey[v * 8 + i] = i % 4 == 3 ? 255 : static_cast<uint8_t>(v);
+    }
+  }
+  auto grey_out = std::vector<uint8_t>(256 * 2 * 2);
+  colour::bgra_to_uyvy_scalar(grey_out.data(), nullptr, grey.data(), 512);
+  auto neutral = true;
+  for (std::size_t v = 0; v < 256; v += 1) {
+    neutral = neutral && grey_out[v * 4] == 128 && grey_out[v * 4 + 2] == 128;
+  }
+  expect(neutral, "greys have no chroma");
+}
+
+#if defined(COLOUR_CONVERT_X86)
+
+void test_kernel(std::mt19937 &rng) {
+  for (std::size_t width = 0; width <= 98; width += 2) {
+    auto const bgra = random_row(rng, width);
+    auto expected = std::vector<uint8_t>(width * 2);
+    auto expected_alpha = std::vector<uint8_t>(width);
+    auto actual = expected;
+    auto actual_alpha = expected_alpha;
+    colour::bgra_to_uyvy_scalar(expected.data(), expected_alpha.data(),
+                                bgra.data(), width);
+    colour::bgra_to_uyvy_avx2(actual.data(), actual_alpha.data(), bgra.data(),
+                              width);
+    expect(actual == expected, "bgra_to_uyvy_avx2 matches scalar");
+    expect(actual_alpha == expected_alpha,
+           "bgra_to_uyvy_avx2 alpha matches scalar");
+
+    colour::bgra_to_uyvy_avx2(actual.data(), nullptr, bgra.data(), width);
+    expect(actual == expected, "bgra_to_uyvy_avx2 without alpha");
+  }
+}
+
+#endif // COLOUR_CONVERT_X86
+
+} // namespace
+
+auto main() -> int {
+  auto rng = std::mt19937{11};
+  test_accuracy(rng);
+#if defined(COLOUR_CONVERT_X86)
+  if (__builtin_cpu_supports("avx2")) {
+    test_kernel(rng);
+  } else {
+    std::cout << "AVX2 not supported, kernel not compared\n";
+  }
+#endif
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "../compositor.hpp"
+
+// Every alpha_over kernel the CPU supports must give bit-identical results to
+// alpha_over_scalar, over random bytes as well as the alphas at either end
+// composite must give the same result as compositing layer by layer
+
+namespace {
+
+auto random_bytes(std::mt19937 &rng, std::size_t size) -> std::vector<uint8_t> {
+  auto dist = std::uniform_int_distribution<int>{0, 255};
+  auto bytes = std::vector<uint8_t>(size);
+  for (auto &byte : bytes) {
+    byte = static_cast<uint8_t>(dist(rng));
+  }
+  return bytes;
+}
+
+// Alpha of every pixel forced to 0 or 255 so the edges of the factor range
+// are covered and not just hit by chance
+void force_alpha(std::vector<uint8_t> &pixels, uint8_t alpha) {
+  for (std::size_t i = 3; i < pixels.size(); i += 4) {
+    pixels[i] = alpha;
+  }
+}
+
+auto check(compositor::isa isa_, std::vector<uint8_t> const &dst,
+           std::vector<uint8_t> const &src, std::size_t offset) -> bool {
+  auto expected = dst;
+  compositor::alpha_over_scalar(expected.data() + offset, src.data() + offset,
+                                src.size() - offset);
+
+  auto actual = dst;
+  compositor::alpha_over_kernel(isa_)(actual.data() + offset,
+                                      src.data() + offset,
+                                      src.size() - offset);
+
+  if (actual != expected) {
+    for (std::size_t i = 0; i < actual.size(); i += 1) {
+      if (actual[i] != expected[i]) {
+        std::cerr << compositor::isa_name(isa_) << " differs at byte " << i
+                  << " of " << actual.size() << " (offset " << offset
+                  << "): " << +actual[i] << " != " << +expected[i] << '\n';
+        break;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+// A frame with a mix of transparent, opaque and mixed tiles, and ragged
+// tiles at the right and bottom edges
+auto random_layer(std::mt19937 &rng, compositor::raster const &format)
+    -> std::vector<uint8_t> {
+  auto frame = random_bytes(rng, format.pitch * format.height);
+  auto kind = std::uniform_int_distribution<int>{0, 2};
+  for (std::size_t y0 = 0; y0 < format.height; y0 += compositor::tile_size) {
+    for (std::size_t x0 = 0; x0 < format.width; x0 += compositor::tile_size) {
+      auto const tile = kind(rng);
+      for (auto y = y0; y < std::min(y0 + compositor::tile_size, format.height);
+           y += 1) {
+        for (auto x = x0;
+             x < std::min(x0 + compositor::tile_size, format.width); x += 1) {
+          auto *pixel = frame.data() + y * format.pitch + x * 4;
+          if (tile == 0) {
+            std::memset(pixel, 0, 4);
+          } else if (tile == 1) {
+            pixel[3] = 255;
+          }
+        }
+      }
+    }
+  }
+  return frame;
+}
+
+auto check_composite(std::mt19937 &rng, std::size_t count) -> bool {
+  auto const format = compositor::raster{200, 150, 200 * 4 + 64};
+
+  auto frames = std::vector<std::vector<uint8_t>>{};
+  auto maps = std::vector<compositor::alpha_map>{};
+  for (std::size_t i = 0; i < count; i += 1) {
+    frames.push_back(random_layer(rng, format));
+    maps.emplace_back(format);
+    maps.back().classify(frames.back().data(), format);
+  }
+  auto const solid = compositor::solid{0x80402010, format};
+
+  auto layers = std::vector<compositor::layer>{};
+  for (std::size_t i = 0; i < count; i += 1) {
+    layers.emplace_back(frames[i].data(), maps[i]);
+  }
+  layers.emplace_back(solid);
+
+  auto expected = std::vector<uint8_t>(format.pitch * format.height);
+  auto actual = expected;
+  for (std::size_t row = 0; row < maps[0].rows(); row += 1) {
+    compositor::copy(expected.data(), frames[0].data(), maps[0], format, row);
+    for (std::size_t i = 1; i < count; i += 1) {
+      compositor::alpha_over(expected.data(), frames[i].data(), maps[i],
+                             format, row);
+    }
+    compositor::alpha_over(expected.data(), solid, format, row);
+
+    compositor::composite(actual.data(), std::span{layers}, format, row);
+  }
+
+  // The padding at the end of each line is not part of the picture
+  for (std::size_t y = 0; y < format.height; y += 1) {
+    if (std::memcmp(actual.data() + y * format.pitch,
+                    expected.data() + y * format.pitch, format.width * 4) !=
+        0) {
+      std::cerr << "composite of " << count << " layers differs on line " << y
+                << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+auto main() -> int {
+  auto rng = std::mt19937{42};
+  auto ok = true;
+  auto tested = 0;
+
+  for (auto isa_ : {compositor::isa::sse2, compositor::isa::avx2,
+                    compositor::isa::avx512}) {
+    if (!compositor::supported(isa_)) {
+      std::cout << compositor::isa_name(isa_) << ": not supported, skipped\n";
+      continue;
+    }
+    tested += 1;
+
+    // Sizes either side of every vector width, so the scalar tails are used
+    for (std::size_t pixels = 0; pixels <= 67; pixels += 1) {
+      // Unaligned starts as well, kernels use unaligned loads
+      for (std::size_t offset = 0; offset <= 8; offset += 4) {
+        auto const size = pixels * 4 + offset;
+        auto const dst = random_bytes(rng, size);
+        auto src = random_bytes(rng, size);
+        ok = check(isa_, dst, src, offset) && ok;
+        force_alpha(src, 0);
+        ok = check(isa_, dst, src, offset) && ok;
+        force_alpha(src, 255);
+        ok = check(isa_, dst, src, offset) && ok;
+      }
+    }
+
+    // A whole 1080p line several times over
+    for (auto i = 0; i < 16; i += 1) {
+      ok = check(isa_, random_bytes(rng, 1920 * 4), random_bytes(rng, 1920 * 4),
+                 0) &&
+           ok;
+    }
+
+    std::cout << compositor::isa_name(isa_) << ": "
+              << (ok ? "matches scalar" : "FAILED") << '\n';
+  }
+
+  if (tested == 0) {
+    std::cout << "No SIMD kernels supported, nothing to compare\n";
+  }
+
+  for (auto count : {std::size_t{1}, std::size_t{2}, std::size_t{5}}) {
+    ok = check_composite(rng, count) && ok;
+  }
+  std::cout << "composite: " << (ok ? "matches layer by layer" : "FAILED")
+            << '\n';
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <set>
+#include <span>
+#include <vector>
+
+#include "../decklink_playback.hpp"
+#include "../triple_buffer.hpp"
+#include "frame_pattern.hpp"
+
+// Plays an output's segment out through a mock IDeckLinkOutput that records
+// the address of every frame it is handed and, like a card, keeps frames
+// until it has played them
+// Every frame must point straight into a slot of the segment, and no slot the
+// card still has may be written over, however far the writer laps the reader
+// Each slot has one frame for the card, made up front and used again every
+// time the slot comes round, even while the card still has it
+// Scheduled playback must wait out its preroll, count how the card says each
+// frame went, and start again a preroll ahead when the queue runs dry
+
+namespace {
+
+using namespace std::chrono_literals;
+
+auto ok = true;
+
+void expect(bool condition, char const *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << '\n';
+    ok = false;
+  }
+}
+
+auto test_format() -> media_format {
+  auto format = media_format{};
+  format.width = 64;
+  format.height = 36;
+  format.pitch = format.width * 4;
+  return format;
+}
+
+// On the heap rather than in shared memory, sets freed once nothing refers to
+// it any more
+auto make_segment(media_format const &format, std::size_t held_slots,
+                  bool &freed) -> std::shared_ptr<triple_buffer> {
+  auto *memory = ::operator new(
+      triple_buffer::required_size(format, held_slots), std::align_val_t{64});
+  return {::new (memory) triple_buffer{format, held_slots},
+          [&freed](triple_buffer *segment) {
+            segment->~triple_buffer();
+            ::operator delete(segment, std::align_val_t{64});
+            freed = true;
+          }};
+}
+
+class mock_output final : public IDeckLinkOutput {
+public:
+  media_format format;
+
+  std::vector<uint8_t const *> addresses;
+  // Of scheduled frames and audio, in frames and samples
+  std::vector<BMDTimeValue> display_times;
+  std::vector<BMDTimeValue> audio_times;
+  // Displayed synchronously, kept until the next one like a card would
+  decklink_ptr<IDeckLinkVideoFrame> on_air;
+  // Scheduled and not yet completed
+  std::deque<decklink_ptr<IDeckLinkVideoFrame>> queue;
+  // Completed, but not yet released, a card may let go of a frame late
+  std::vector<decklink_ptr<IDeckLinkVideoFrame>> completed;
+
+  IDeckLinkVideoOutputCallback *callback = nullptr;
+  BMDTimeValue stream_time = 0;
+  bool playing = false;
+  // Set to turn frames away, as a card does with a full queue
+  bool refuse = false;
+
+  explicit mock_output(media_format const &format) : format{format} {}
+
+  static auto bytes(IDeckLinkVideoFrame &frame) -> uint8_t const * {
+    void *data;
+    frame.GetBytes(&data);
+    return static_cast<uint8_t const *>(data);
+  }
+
+  // The frame pattern number of a frame the card has, if it is whole
+  auto number(IDeckLinkVideoFrame &frame) const -> std::optional<uint64_t> {
+    return frame_pattern::check({bytes(frame), format.video_size()}, {});
+  }
+
+  void complete(BMDOutputFrameCompletionResult result) {
+    auto frame = std::move(queue.front());
+    queue.pop_front();
+    if (callback != nullptr) {
+      callback->ScheduledFrameCompleted(frame.get(), result);
+    }
+    completed.push_back(std::move(frame));
+  }
+
+  auto QueryInterface(REFIID, LPVOID *ppv) -> HRESULT override {
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+  auto AddRef() -> ULONG override { return 1; }
+  auto Release() -> ULONG override { return 1; }
+
+  auto DoesSupportVideoMode(BMDVideoConnection, BMDDisplayMode, BMDPixelFormat,
+                            BMDVideoOutputConversionMode,
+                            BMDSupportedVideoModeFlags, BMDDisplayMode *,
+                            bool *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetDisplayMode(BMDDisplayMode, IDeckLinkDisplayMode **)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetDisplayModeIterator(IDeckLinkDisplayModeIterator **)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback *)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+
+  auto EnableVideoOutput(BMDDisplayMode, BMDVideoOutputFlags)
+      -> HRESULT override {
+    return S_OK;
+  }
+  auto DisableVideoOutput() -> HRESULT override { return S_OK; }
+  auto SetVideoOutputFrameMemoryAllocator(IDeckLinkMemoryAllocator *)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  // Playout never copies, so never makes frames of the card's own
+  auto CreateVideoFrame(int32_t, int32_t, int32_t, BMDPixelFormat,
+                        BMDFrameFlags, IDeckLinkMutableVideoFrame **)
+      -> HRESULT override {
+    expect(false, "playout creates no frames");
+    return E_FAIL;
+  }
+  auto CreateAncillaryData(BMDPixelFormat, IDeckLinkVideoFrameAncillary **)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto DisplayVideoFrameSync(IDeckLinkVideoFrame *frame) -> HRESULT override {
+    addresses.push_back(bytes(*frame));
+    frame->AddRef();
+    on_air.reset(frame);
+    return S_OK;
+  }
+  auto ScheduleVideoFrame(IDeckLinkVideoFrame *frame, BMDTimeValue time,
+                          BMDTimeValue, BMDTimeScale) -> HRESULT override {
+    if (refuse) {
+      return E_FAIL;
+    }
+    addresses.push_back(bytes(*frame));
+    display_times.push_back(time);
+    frame->AddRef();
+    queue.emplace_back(frame);
+    return S_OK;
+  }
+  auto SetScheduledFrameCompletionCallback(
+      IDeckLinkVideoOutputCallback *callback_) -> HRESULT override {
+    callback = callback_;
+    return S_OK;
+  }
+  auto GetBufferedVideoFrameCount(uint32_t *count) -> HRESULT override {
+    *count = static_cast<uint32_t>(queue.size());
+    return S_OK;
+  }
+
+  auto EnableAudioOutput(BMDAudioSampleRate, BMDAudioSampleType, uint32_t,
+                         BMDAudioOutputStreamType) -> HRESULT override {
+    return S_OK;
+  }
+  auto DisableAudioOutput() -> HRESULT override { return S_OK; }
+  auto WriteAudioSamplesSync(void *, uint32_t count, uint32_t *written)
+      -> HRESULT override {
+    *written = count;
+    return S_OK;
+  }
+  auto BeginAudioPreroll() -> HRESULT override { return S_OK; }
+  auto EndAudioPreroll() -> HRESULT override { return S_OK; }
+  auto ScheduleAudioSamples(void *, uint32_t count, BMDTimeValue time,
+                            BMDTimeScale, uint32_t *written) -> HRESULT override {
+    audio_times.push_back(time);
+    *written = count;
+    return S_OK;
+  }
+  auto GetBufferedAudioSampleFrameCount(uint32_t *count) -> HRESULT override {
+    *count = 0;
+    return S_OK;
+  }
+  auto FlushBufferedAudioSamples() -> HRESULT override { return S_OK; }
+  auto SetAudioCallback(IDeckLinkAudioOutputCallback *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+
+  auto StartScheduledPlayback(BMDTimeValue, BMDTimeScale, double)
+      -> HRESULT override {
+    playing = true;
+    return S_OK;
+  }
+  auto StopScheduledPlayback(BMDTimeValue, BMDTimeValue *, BMDTimeScale)
+      -> HRESULT override {
+    playing = false;
+    return S_OK;
+  }
+  auto IsScheduledPlaybackRunning(bool *active) -> HRESULT override {
+    *active = playing;
+    return S_OK;
+  }
+  auto GetScheduledStreamTime(BMDTimeScale, BMDTimeValue *time,
+                              double *speed) -> HRESULT override {
+    *time = stream_time;
+    *speed = playing ? 1.0 : 0.0;
+    return S_OK;
+  }
+  auto GetReferenceStatus(BMDReferenceStatus *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+
+  auto GetHardwareReferenceClock(BMDTimeScale, BMDTimeValue *, BMDTimeValue *,
+                                 BMDTimeValue *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetFrameCompletionReferenceTimestamp(IDeckLinkVideoFrame *,
+                                            BMDTimeScale, BMDTimeValue *)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+};
+
+// Writes the next frame and reads it, if the reader has a slot to read into
+auto next_frame(playout_source &source, uint64_t &number) -> bool {
+  number += 1;
+  frame_pattern::fill(source->write(), number);
+  source->done_writing();
+  return source.wait_for_slot(0ns) && source->about_to_read();
+}
+
+// The writer and reader going round every slot they can get while the card
+// has frames
+void lap(playout_source &source, uint64_t &number) {
+  for (auto i = 0; i < 8; i += 1) {
+    next_frame(source, number);
+  }
+}
+
+void displayed_as_they_arrive() {
+  auto const format = test_format();
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(0), freed));
+  auto output = mock_output{format};
+  auto playout = decklink_playout{output, format, 0};
+
+  auto number = uint64_t{0};
+  for (auto i = 0; i < 100; i += 1) {
+    expect(next_frame(*source, number), "a slot to read into");
+    auto const expected = frame_pattern::check((*source)->read());
+    playout.display(*source);
+    expect(output.addresses.back() == (*source)->read().video_frame().data(),
+           "the card is pointed at the read slot");
+
+    lap(*source, number);
+    expect(output.number(*output.on_air) == expected,
+           "the frame on air is not written over");
+  }
+}
+
+void scheduled_ahead() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{3};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playout = decklink_playout{output, format, preroll};
+
+  // Every held slot goes to the card, with nothing completed
+  auto number = uint64_t{0};
+  auto expected = std::vector<std::optional<uint64_t>>{};
+  while (output.queue.size() < 100 && next_frame(*source, number)) {
+    expected.push_back(frame_pattern::check((*source)->read()));
+    playout.display(*source);
+    expect(output.playing == (output.queue.size() >= preroll),
+           "playback starts once the preroll is queued");
+  }
+  expect(output.queue.size() == decklink_playout::held_slots(preroll) + 1,
+         "a frame queued for every held slot and the read slot");
+  expect(std::set(output.addresses.begin(), output.addresses.end()).size() ==
+             output.addresses.size(),
+         "every queued frame has a slot of its own");
+
+  lap(*source, number);
+  for (std::size_t i = 0; i < output.queue.size(); i += 1) {
+    expect(output.number(*output.queue[i]) == expected[i],
+           "queued frames are not written over");
+  }
+
+  // The slot goes back as the card says it is done, even though it hasn't
+  // let go of the frame yet
+  output.complete(bmdOutputFrameCompleted);
+  expect(source->wait_for_slot(0ns), "a completed frame's slot goes back");
+  expect(next_frame(*source, number), "reads into the slot handed back");
+  playout.display(*source);
+  expect(output.addresses.back() == mock_output::bytes(*output.queue.back()),
+         "the new frame is queued");
+  expect(!source->wait_for_slot(0ns), "every slot is with the card again");
+
+  lap(*source, number);
+  for (std::size_t i = 0; i + 1 < output.queue.size(); i += 1) {
+    expect(output.number(*output.queue[i]) == expected[i + 1],
+           "queued frames are not written over");
+  }
+}
+
+void frames_outlive_the_output() {
+  auto const format = test_format();
+  auto freed = false;
+  auto output = mock_output{format};
+  {
+    auto source = std::make_shared<playout_source>(
+        make_segment(format, decklink_playout::held_slots(2), freed));
+    auto playout = decklink_playout{output, format, 2};
+    auto number = uint64_t{0};
+    for (auto i = 0; i < 2; i += 1) {
+      expect(next_frame(*source, number), "a slot to read into");
+      playout.display(*source);
+    }
+  }
+  expect(!freed, "the segment stays while the card has frames in it");
+
+  while (!output.queue.empty()) {
+    output.complete(bmdOutputFrameFlushed);
+  }
+  expect(!freed, "the segment stays while the card has references");
+  output.completed.clear();
+  expect(freed, "the segment goes with the last frame");
+}
+
+void frames_recycled() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{2};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playback = scheduled_playback{output, format, preroll};
+
+  auto frames = std::map<uint8_t const *, held_frame *>{};
+  auto recycled = true;
+  auto number = uint64_t{0};
+  for (auto i = 0; i < 100; i += 1) {
+    expect(next_frame(*source, number), "a slot to read into");
+    auto frame = source->hold();
+    auto const bytes = mock_output::bytes(*frame);
+    expect(bytes == (*source)->read().video_frame().data(),
+           "the frame is the read slot's");
+    recycled = recycled && frames.emplace(bytes, frame.get()).first->second ==
+                               frame.get();
+    playback.schedule(*frame);
+
+    // The card lets go of each frame one completion late
+    if (output.queue.size() > preroll) {
+      output.complete(bmdOutputFrameCompleted);
+    }
+    if (output.completed.size() > 1) {
+      output.completed.erase(output.completed.begin());
+    }
+  }
+  expect(recycled, "a slot always comes with the same frame");
+  expect(frames.size() <= (*source)->slots(), "no more frames than slots");
+  expect(playback.counts().skipped == 0, "nothing is skipped");
+}
+
+void starts_after_preroll() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{4};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playback = scheduled_playback{output, format, preroll};
+  expect(output.callback == &playback, "the completion callback is set");
+
+  auto number = uint64_t{0};
+  for (std::size_t i = 0; i < preroll; i += 1) {
+    expect(next_frame(*source, number), "a slot to read into");
+    playback.schedule(*source->hold());
+    expect(output.playing == (i + 1 == preroll),
+           "playback starts with the last frame of the preroll");
+  }
+
+  // At 25/1 a frame is one unit of the time scale
+  auto const samples = static_cast<BMDTimeValue>(
+      format.audio_samples_per_frame_per_channel());
+  expect(output.display_times == std::vector<BMDTimeValue>{0, 1, 2, 3},
+         "frames are queued back to back");
+  expect(output.audio_times ==
+             std::vector<BMDTimeValue>{0, samples, 2 * samples, 3 * samples},
+         "audio is queued alongside its frame");
+}
+
+void completions_counted() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{2};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playback = scheduled_playback{output, format, preroll};
+
+  auto number = uint64_t{0};
+  while (next_frame(*source, number)) {
+    playback.schedule(*source->hold());
+  }
+
+  output.complete(bmdOutputFrameCompleted);
+  expect(source->wait_for_slot(0ns), "a completed frame's slot goes back");
+  output.complete(bmdOutputFrameDisplayedLate);
+  output.complete(bmdOutputFrameDropped);
+  output.complete(bmdOutputFrameFlushed);
+
+  auto const counts = playback.counts();
+  expect(counts.completed == 4, "every completion is counted");
+  expect(counts.late == 1, "late frames are counted");
+  expect(counts.dropped == 1, "dropped frames are counted");
+  expect(counts.flushed == 1, "flushed frames are counted");
+  expect(counts.skipped == 0, "nothing is skipped");
+}
+
+void requeued_after_running_dry() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{3};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playback = scheduled_playback{output, format, preroll};
+
+  auto number = uint64_t{0};
+  auto schedule = [&] {
+    expect(next_frame(*source, number), "a slot to read into");
+    playback.schedule(*source->hold());
+    if (output.queue.size() > 1) {
+      output.complete(bmdOutputFrameCompleted);
+    }
+  };
+  for (std::size_t i = 0; i < preroll; i += 1) {
+    schedule();
+  }
+
+  // The card played on past the last frame queued
+  output.stream_time = 10;
+  schedule();
+  expect(output.display_times.back() == 13,
+         "queued a preroll ahead of the card once it ran dry");
+  schedule();
+  expect(output.display_times.back() == 14,
+         "queued back to back once ahead again");
+}
+
+void refused_frames_skipped() {
+  auto const format = test_format();
+  auto const preroll = std::size_t{2};
+  auto freed = false;
+  auto source = std::make_shared<playout_source>(
+      make_segment(format, decklink_playout::held_slots(preroll), freed));
+  auto output = mock_output{format};
+  auto playback = scheduled_playback{output, format, preroll};
+
+  output.refuse = true;
+  auto number = uint64_t{0};
+  while (next_frame(*source, number)) {
+    playback.schedule(*source->hold());
+    if (playback.counts().skipped > 100) {
+      break;
+    }
+  }
+  expect(playback.counts().skipped > 100,
+         "a refused frame's slot goes back at once");
+  expect(output.queue.empty() && output.audio_times.empty(),
+         "nothing of a refused frame is queued");
+  expect(!output.playing, "playback waits for a preroll of queued frames");
+}
+
+} // namespace
+
+auto main() -> int {
+  displayed_as_they_arrive();
+  scheduled_ahead();
+  frames_outlive_the_output();
+  frames_recycled();
+  starts_after_preroll();
+  completions_counted();
+  requeued_after_running_dry();
+  refused_frames_skipped();
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+
+#include "../frame_clock.hpp"
+
+// The late policies, from a simulated timeline and from the real timer
+
+namespace {
+
+using namespace std::chrono_literals;
+
+auto ok = true;
+
+void expect(bool condition, char const *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << '\n';
+    ok = false;
+  }
+}
+
+} // namespace
+
+auto main() -> int {
+  {
+    auto clock = simulated_clock{40ms, late_policy::skip};
+    expect(clock.next() == 1, "skip runs an on time tick");
+    clock.miss(3);
+    expect(clock.next() == 1, "skip runs a late tick once");
+    expect(clock.now() == 5 * 40ms, "a late tick still moves time on");
+  }
+  {
+    auto clock = simulated_clock{40ms, late_policy::catch_up};
+    clock.miss(3);
+    expect(clock.next() == 4, "catch up runs every missed tick");
+    expect(clock.next() == 1, "catch up runs once when back on time");
+  }
+
+  {
+    auto clock = timer_clock{5ms, late_policy::catch_up, false};
+    clock.next();
+    std::this_thread::sleep_for(23ms);
+    expect(clock.next() >= 4, "the timer counts the ticks it missed");
+  }
+  {
+    auto clock = timer_clock{5ms, late_policy::skip, false};
+    clock.next();
+    std::this_thread::sleep_for(23ms);
+    expect(clock.next() == 1, "skip runs a late timer tick once");
+
+    // A late tick never moves the ticks after it
+    auto const start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < 20; i += 1) {
+      clock.next();
+    }
+    expect(std::chrono::steady_clock::now() - start >= 95ms,
+           "the timer ticks at its period");
+  }
+
+  {
+    auto frames = 0;
+    auto clock = input_clock{10ms, late_policy::skip,
+                             [&](std::chrono::nanoseconds timeout) {
+                               frames += 1;
+                               if (frames > 3) {
+                                 std::this_thread::sleep_for(timeout);
+                                 return false;
+                               }
+                               return true;
+                             }};
+    // Frames arriving tick straight away
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < 3; i += 1) {
+      clock.next();
+    }
+    expect(std::chrono::steady_clock::now() - start < 10ms,
+           "the input clock follows its frames");
+
+    // Without frames it falls back to the nominal period
+    start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < 5; i += 1) {
+      clock.next();
+    }
+    expect(std::chrono::steady_clock::now() - start >= 40ms,
+           "the input clock ticks on without frames");
+  }
+
+  return ok ? 0 : 1;
+}
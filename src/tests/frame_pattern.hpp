@@ -0,0 +1,66 @@
+#ifndef FRAME_PATTERN_HPP
+#define FRAME_PATTERN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+// Fills a frame with a pattern unique to a number, so a reader can tell
+// which frame it has and whether any of it came from another frame
+
+namespace frame_pattern {
+
+inline auto word(uint64_t number, std::size_t i) -> uint64_t {
+  return number * 0x9e3779b97f4a7c15 + i;
+}
+
+inline void fill(std::span<uint8_t> video, std::span<int32_t> audio,
+                 uint64_t number) {
+  for (std::size_t i = 0; i * 8 + 8 <= video.size(); i += 1) {
+    auto const value = word(number, i);
+    std::memcpy(video.data() + i * 8, &value, 8);
+  }
+  for (std::size_t i = 0; i < audio.size(); i += 1) {
+    audio[i] = static_cast<int32_t>(word(number, i));
+  }
+}
+
+// The number the frame was filled with, or nothing if it is torn
+inline auto check(std::span<uint8_t const> video,
+                  std::span<int32_t const> audio)
+    -> std::optional<uint64_t> {
+  if (video.size() < 8) {
+    return std::nullopt;
+  }
+  // The first word is number times an odd constant, so multiplying by its
+  // inverse mod 2^64 gives the number back
+  auto first = uint64_t{};
+  std::memcpy(&first, video.data(), 8);
+  auto const number = first * 0xf1de83e19937733d;
+  for (std::size_t i = 0; i * 8 + 8 <= video.size(); i += 1) {
+    auto value = uint64_t{};
+    std::memcpy(&value, video.data() + i * 8, 8);
+    if (value != word(number, i)) {
+      return std::nullopt;
+    }
+  }
+  for (std::size_t i = 0; i < audio.size(); i += 1) {
+    if (audio[i] != static_cast<int32_t>(word(number, i))) {
+      return std::nullopt;
+    }
+  }
+  return number;
+}
+
+inline void fill(auto &frame, uint64_t number) {
+  fill(frame.video_frame(), frame.audio_frame(), number);
+}
+inline auto check(auto const &frame) -> std::optional<uint64_t> {
+  return check(frame.video_frame(), frame.audio_frame());
+}
+
+} // namespace frame_pattern
+
+#endif // FRAME_PATTERN_HPP
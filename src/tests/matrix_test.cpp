@@ -0,0 +1,123 @@
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include <fmt/format.h>
+
+#include "../frame_clock.hpp"
+#include "../matrix.hpp"
+#include "../worker_pool.hpp"
+
+// Runs the matrix on a simulated clock, far faster than real time, and checks
+// every salvo lands on exactly the frame it was scheduled for, whether given
+// as a frame number or as a time of day on the clock's timeline
+
+namespace {
+
+auto ok = true;
+
+void expect(bool condition, char const *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << '\n';
+    ok = false;
+  }
+}
+
+// The frame it was scheduled for, or nothing if it couldn't be
+auto schedule(matrix &matrix_, std::string at)
+    -> std::optional<std::pair<uint64_t, uint64_t>> {
+  auto const scheduled = matrix_.schedule(salvo{{}, std::move(at)});
+  if (auto const *id_frame = std::get_if<0>(&scheduled)) {
+    return *id_frame;
+  }
+  return std::nullopt;
+}
+
+auto applied_frame(matrix &matrix_, uint64_t id) -> std::optional<uint64_t> {
+  auto const status = matrix_.status(id);
+  return status ? status->applied_frame : std::nullopt;
+}
+
+// As HH:MM:SS:FF in local time
+auto timecode(std::chrono::sys_time<std::chrono::nanoseconds> time,
+              media_format const &format) -> std::string {
+  auto const seconds = std::chrono::floor<std::chrono::seconds>(time);
+  auto const time_t_ = std::chrono::system_clock::to_time_t(seconds);
+  auto local = std::tm{};
+  localtime_r(&time_t_, &local);
+  return fmt::format("{:02}:{:02}:{:02}:{:02}", local.tm_hour, local.tm_min,
+                     local.tm_sec, (time - seconds) / format.frame_duration());
+}
+
+// Midday today, so no timecode in the test crosses midnight
+auto midday() -> std::chrono::system_clock::time_point {
+  auto const now = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  auto local = std::tm{};
+  localtime_r(&now, &local);
+  local.tm_hour = 12;
+  local.tm_min = 0;
+  local.tm_sec = 0;
+  return std::chrono::system_clock::from_time_t(std::mktime(&local));
+}
+
+} // namespace
+
+auto main() -> int {
+  auto format = media_format{};
+  format.width = 64;
+  format.height = 36;
+  format.pitch = format.width * 4;
+  auto const period = format.frame_duration();
+
+  auto const started = midday();
+  auto clock = simulated_clock{period, late_policy::skip, started};
+  auto matrix_ = matrix{format};
+  auto pool = worker_pool{1};
+
+  auto const real_start = std::chrono::steady_clock::now();
+
+  matrix_.run(pool, clock, 10);
+  expect(matrix_.frame() == 10, "runs for the frames asked");
+  // The first tick is due a period after the clock starts
+  expect(matrix_.time_of(10) == started + 11 * period,
+         "frames are due when the clock says");
+
+  auto const by_frame = schedule(matrix_, "250");
+  expect(by_frame && by_frame->second == 250, "scheduled by frame number");
+  auto const by_timecode =
+      schedule(matrix_, timecode(matrix_.time_of(500), format));
+  expect(by_timecode && by_timecode->second == 500,
+         "a timecode is the frame due then on the clock");
+  expect(!schedule(matrix_, "5"), "a past frame is turned away");
+  expect(!schedule(matrix_, timecode(started, format)),
+         "a past timecode is turned away");
+
+  // Skipped ticks move the frames after them later in the day
+  clock.miss(3);
+  matrix_.run(pool, clock, 20);
+  expect(matrix_.time_of(20) == started + 24 * period,
+         "skipped ticks move frames on");
+  auto const after_skip =
+      schedule(matrix_, timecode(started + 1004 * period, format));
+  expect(after_skip && after_skip->second == 1000,
+         "a timecode after a skip keeps to the clock");
+
+  matrix_.run(pool, clock, 1100);
+  expect(by_frame && applied_frame(matrix_, by_frame->first) == 250,
+         "a salvo lands on its frame");
+  expect(by_timecode && applied_frame(matrix_, by_timecode->first) == 500,
+         "a salvo lands on its timecode's frame");
+  expect(after_skip && applied_frame(matrix_, after_skip->first) == 1000,
+         "a salvo lands on its timecode's frame after a skip");
+
+  expect(std::chrono::steady_clock::now() - real_start < clock.now(),
+         "the simulated clock runs faster than real time");
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+#include <cstddef>
+#include <iostream>
+
+#include "../multiview.hpp"
+
+// Every cell grid lays out must lie within the frame, down to frames too
+// small for any cell at all
+
+namespace {
+
+auto inside(multiview::rect const &rect, compositor::raster const &format)
+    -> bool {
+  return rect.width > 0 && rect.height > 0 &&
+         rect.x + rect.width <= format.width &&
+         rect.y + rect.height <= format.height;
+}
+
+} // namespace
+
+auto main() -> int {
+  auto ok = true;
+  for (std::size_t height = 1; height <= 200; height += 1) {
+    for (auto width : {height, height * 16 / 9, height * 4}) {
+      auto const format = compositor::raster{width, height, width * 4};
+      for (std::size_t count = 0; count <= 300; count += 1) {
+        for (auto const &cell : multiview::grid(count, format)) {
+          if (!inside(cell.picture, format) || !inside(cell.label, format)) {
+            std::cerr << "Cell outside a " << width << "x" << height
+                      << " frame of " << count << " cells\n";
+            ok = false;
+          }
+        }
+      }
+    }
+  }
+
+  // The grid the router uses for an ordinary frame still has every cell
+  if (multiview::grid(12, {1920, 1080, 1920 * 4}).size() != 12) {
+    std::cerr << "Missing cells on a 1080p frame\n";
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../broadcast_buffer.hpp"
+#include "../ipc_shared_object.hpp"
+#include "../passthrough.hpp"
+#include "../triple_buffer.hpp"
+#include "frame_pattern.hpp"
+
+// Frames passed through by reference across three processes, as from a
+// source, through the router, to an output
+// The source writes an input segment flat out, the router reads it and passes
+// each frame it reads through to an output segment, and the output copies
+// each one out of the input segment, now and then slowly enough that the
+// source is sure to write over it
+// Every copy released as intact must be whole and the frame referred to, and
+// the slow copies must be caught as torn, without the source or the router
+// ever waiting on the output
+
+namespace {
+
+using namespace std::chrono_literals;
+
+static constexpr auto copies = 3000;
+
+auto test_format() -> media_format {
+  auto format = media_format{};
+  format.width = 320;
+  format.height = 180;
+  format.pitch = format.width * 4;
+  return format;
+}
+
+[[noreturn]] void source(char const *input_name) {
+  auto input = ipc_unmanaged_object<broadcast_buffer>{input_name};
+  for (auto number = uint64_t{1};; number += 1) {
+    frame_pattern::fill(input->write(), number);
+    input->done_writing();
+  }
+}
+
+[[noreturn]] void router(char const *input_name, char const *output_name) {
+  auto input = ipc_unmanaged_object<broadcast_buffer>{input_name};
+  auto reader = input->attach(true);
+  auto output = ipc_unmanaged_object<triple_buffer>{output_name};
+  while (true) {
+    if (reader->wait_for_novel(1s) && reader->about_to_read()) {
+      output->write().set_passthrough(input_name, reader->read().sequence());
+      output->done_writing();
+    }
+    // Roughly a tick, so the source's slots turn over under the output
+    std::this_thread::sleep_for(200us);
+  }
+}
+
+[[noreturn]] void output(char const *output_name) {
+  auto output = ipc_unmanaged_object<triple_buffer>{output_name};
+  auto passthrough = passthrough_reader{};
+  auto intact = 0;
+  auto torn = 0;
+  auto gone = 0;
+  for (auto i = 0; intact + torn < copies; i += 1) {
+    if (!output->wait_for_novel(5s)) {
+      std::cerr << "Router stalled\n";
+      std::exit(1);
+    }
+    output->about_to_read();
+    auto &frame = output->read();
+    auto const reference = frame.passthrough();
+    if (!reference) {
+      std::cerr << "Frame not passed through\n";
+      std::exit(1);
+    }
+    auto const sequence = reference->sequence;
+
+    auto const video = passthrough.acquire(frame);
+    if (!video) {
+      passthrough.release();
+      gone += 1;
+      continue;
+    }
+    std::ranges::copy(*video, frame.video_frame().begin());
+    if (i % 10 == 0) {
+      std::this_thread::sleep_for(5ms);
+    }
+    if (!passthrough.release()) {
+      torn += 1;
+      continue;
+    }
+    intact += 1;
+
+    auto const number =
+        frame_pattern::check(frame.video_frame(), std::span<int32_t>{});
+    if (number != sequence) {
+      std::cerr << "Copy of frame " << sequence << " released as intact but "
+                << (number ? "is frame " + std::to_string(*number)
+                           : "torn"s)
+                << '\n';
+      std::exit(1);
+    }
+  }
+  std::cout << intact << " copies intact, " << torn << " caught torn, "
+            << gone << " already gone\n";
+  std::exit(intact > 0 && torn > 0 ? 0 : 1);
+}
+
+} // namespace
+
+auto main() -> int {
+  auto input = ipc_managed_object<broadcast_buffer>{test_format(), 1};
+  auto output_segment = ipc_managed_object<triple_buffer>{test_format()};
+  output_segment->accept_passthrough();
+
+  auto const output_ = fork();
+  if (output_ == 0) {
+    output(output_segment.name().c_str());
+  }
+  auto const router_ = fork();
+  if (router_ == 0) {
+    router(input.name().c_str(), output_segment.name().c_str());
+  }
+  auto const source_ = fork();
+  if (source_ == 0) {
+    source(input.name().c_str());
+  }
+
+  auto status = 0;
+  waitpid(output_, &status, 0);
+  for (auto pid : {router_, source_}) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../trace.hpp"
+
+// Several processes tracing to one file at once must leave every event whole
+// on a line of its own
+
+namespace {
+
+static constexpr auto processes = 8;
+static constexpr auto spans = 20000;
+
+} // namespace
+
+auto main() -> int {
+  auto path = std::string{"/tmp/ovm_trace_test_"} + std::to_string(getpid());
+  std::remove(path.c_str());
+  setenv("OVM_TRACE", path.c_str(), 1);
+
+  for (auto i = 0; i < processes; i += 1) {
+    if (fork() == 0) {
+      {
+        auto writer = trace::writer{};
+        for (auto j = 0; j < spans; j += 1) {
+          // Names of differing lengths, so chunks end at differing places
+          writer.span(j % 2 == 0 ? "a" : "a_much_longer_span_name", 1000,
+                      2000, static_cast<uint64_t>(j), j % 3 == 0 ? 0 : 500);
+        }
+      }
+      std::exit(0);
+    }
+  }
+  auto ok = true;
+  for (auto i = 0; i < processes; i += 1) {
+    auto status = 0;
+    wait(&status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "A tracing process failed\n";
+      ok = false;
+    }
+  }
+
+  auto file = std::ifstream{path};
+  auto line = std::string{};
+  auto events = 0;
+  auto metadata = 0;
+  std::getline(file, line);
+  if (line != "[") {
+    std::cerr << "Trace does not open an array\n";
+    ok = false;
+  }
+  while (std::getline(file, line)) {
+    if (line.starts_with(R"({"name":"process_name","ph":"M")")) {
+      metadata += 1;
+    } else if (line.starts_with(R"({"name":"a)") &&
+               line.find(R"("ph":"X")") != std::string::npos &&
+               line.ends_with("},")) {
+      events += 1;
+    } else {
+      std::cerr << "Torn event: " << line.substr(0, 80) << '\n';
+      ok = false;
+      break;
+    }
+  }
+  std::remove(path.c_str());
+
+  if (metadata != processes || events != processes * spans) {
+    std::cerr << "Expected " << processes << " processes and "
+              << processes * spans << " events, found " << metadata << " and "
+              << events << '\n';
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../ipc_shared_object.hpp"
+#include "../triple_buffer.hpp"
+#include "frame_pattern.hpp"
+
+// A writer and a reader process, each with its own mapping of the segment,
+// hand frames over as fast as they can while the reader checks that every
+// frame it reads is whole, and that frames only ever move forwards
+// The writer checks that the frame it last handed on stays as it was written
+// while the reader takes it
+
+namespace {
+
+using namespace std::chrono_literals;
+
+static constexpr auto frames = uint64_t{20000};
+
+auto test_format() -> media_format {
+  auto format = media_format{};
+  format.width = 320;
+  format.height = 180;
+  format.pitch = format.width * 4;
+  return format;
+}
+
+[[noreturn]] void write_frames(char const *name) {
+  auto segment = ipc_unmanaged_object<triple_buffer>{name};
+  for (auto number = uint64_t{1}; number <= frames; number += 1) {
+    frame_pattern::fill(segment->write(), number);
+    segment->done_writing();
+    auto const &published = segment->published();
+    if (published.sequence() != number ||
+        frame_pattern::check(published) != number) {
+      std::cerr << "Frame " << number << " changed once handed on\n";
+      std::exit(1);
+    }
+  }
+  std::exit(0);
+}
+
+[[noreturn]] void read_frames(char const *name) {
+  auto segment = ipc_unmanaged_object<triple_buffer>{name};
+  auto last = uint64_t{0};
+  auto read = uint64_t{0};
+  while (last < frames) {
+    if (!segment->wait_for_novel(5s)) {
+      std::cerr << "Writer stalled after frame " << last << '\n';
+      std::exit(1);
+    }
+    if (!segment->about_to_read()) {
+      continue;
+    }
+    auto const &frame = segment->read();
+    auto const number = frame_pattern::check(frame);
+    if (!number) {
+      std::cerr << "Torn frame after frame " << last << '\n';
+      std::exit(1);
+    }
+    if (*number <= last || frame.sequence() != *number) {
+      std::cerr << "Frame " << *number << " with sequence "
+                << frame.sequence() << " read after frame " << last << '\n';
+      std::exit(1);
+    }
+    last = *number;
+    read += 1;
+  }
+  std::cout << "Read " << read << " of " << frames << " frames whole\n";
+  std::exit(0);
+}
+
+} // namespace
+
+auto main() -> int {
+  auto segment = ipc_managed_object<triple_buffer>{test_format()};
+
+  auto const reader = fork();
+  if (reader == 0) {
+    read_frames(segment.name().c_str());
+  }
+  auto const writer = fork();
+  if (writer == 0) {
+    write_frames(segment.name().c_str());
+  }
+
+  auto ok = true;
+  for (auto pid : {reader, writer}) {
+    auto status = 0;
+    waitpid(pid, &status, 0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  return ok ? 0 : 1;
+}
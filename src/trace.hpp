@@ -0,0 +1,219 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Spans in the Chrome trace event format, which Perfetto and chrome://tracing
+// both open
+// Every process appends to the file named by OVM_TRACE, and they all stamp
+// events from the steady clock, so the whole pipeline lands on one timeline
+// Without OVM_TRACE nothing is recorded and a span costs one branch
+namespace trace {
+
+// Steady clock nanoseconds, the same as the buffer timestamps
+inline auto now() -> uint64_t {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+class writer {
+private:
+  // Handed to the file once this much has built up, or at exit, small enough
+  // that a process killed mid run loses only the last second or so
+  static constexpr auto flush_size = std::size_t{4096};
+
+  int fd = -1;
+  std::mutex mutex;
+  std::condition_variable_any written;
+  // Whole events only, so each chunk is whole lines of the array
+  std::string pending;
+  std::vector<std::string> chunks;
+  uint64_t pid = 0;
+  // Writes the chunks, so a slow disk never holds up the thread tracing
+  std::jthread thread;
+
+  // Each chunk goes in a single write on an O_APPEND descriptor, so chunks
+  // from every process sharing the file land whole, never interleaved
+  void write_chunks(std::vector<std::string> &to_write) {
+#if defined(__unix__) || defined(__APPLE__)
+    for (auto const &chunk : to_write) {
+      auto const *data = chunk.data();
+      auto size = chunk.size();
+      while (size > 0) {
+        auto const written_ = ::write(fd, data, size);
+        if (written_ < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          std::fprintf(stderr, "Could not write trace: %s\n",
+                       std::strerror(errno));
+          return;
+        }
+        data += written_;
+        size -= static_cast<std::size_t>(written_);
+      }
+    }
+#endif
+    to_write.clear();
+  }
+
+  void run(std::stop_token stop) {
+    auto to_write = std::vector<std::string>{};
+    while (true) {
+      {
+        auto lock = std::unique_lock{mutex};
+        written.wait(lock, stop, [&] { return !chunks.empty(); });
+        if (chunks.empty()) {
+          return;
+        }
+        std::swap(to_write, chunks);
+      }
+      write_chunks(to_write);
+    }
+  }
+
+public:
+  writer() {
+#if defined(__unix__) || defined(__APPLE__)
+    auto const *path = std::getenv("OVM_TRACE");
+    if (path == nullptr || *path == '\0') {
+      return;
+    }
+
+    // The first process to create the file opens the array, the closing
+    // bracket is optional in this format
+    if (auto const created =
+            ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+        created >= 0) {
+      static constexpr auto open_array = std::string_view{"[\n"};
+      if (::write(created, open_array.data(), open_array.size()) < 0) {
+        std::fprintf(stderr, "Could not write trace file %s\n", path);
+      }
+      ::close(created);
+    }
+    fd = ::open(path, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+      std::fprintf(stderr, "Could not open trace file %s\n", path);
+      return;
+    }
+
+    pid = static_cast<uint64_t>(getpid());
+#if defined(__GLIBC__)
+    auto const *name = program_invocation_short_name;
+#else
+    auto const *name = "ovm";
+#endif
+    fmt::format_to(std::back_inserter(pending),
+                   R"({{"name":"process_name","ph":"M","pid":{},"args":)"
+                   R"({{"name":"{}"}}}},)"
+                   "\n",
+                   pid, name);
+    thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+#endif
+  }
+
+  writer(writer const &) = delete;
+
+  ~writer() {
+    if (fd >= 0) {
+      thread.request_stop();
+      thread.join();
+      // Whatever the thread didn't get to, and the last partial chunk
+      chunks.push_back(std::move(pending));
+      write_chunks(chunks);
+#if defined(__unix__) || defined(__APPLE__)
+      ::close(fd);
+#endif
+    }
+  }
+
+  auto enabled() const -> bool { return fd >= 0; }
+
+  // A complete event, with the frame it worked on when there is one
+  void span(std::string_view name, uint64_t start, uint64_t end,
+            uint64_t sequence, uint64_t source_time) {
+    auto const tid = static_cast<uint32_t>(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    auto const lock = std::lock_guard{mutex};
+    fmt::format_to(std::back_inserter(pending),
+                   R"({{"name":"{}","ph":"X","ts":{:.3f},"dur":{:.3f},)"
+                   R"("pid":{},"tid":{})",
+                   name, static_cast<double>(start) / 1e3,
+                   static_cast<double>(end - start) / 1e3, pid, tid);
+    if (source_time != 0) {
+      fmt::format_to(std::back_inserter(pending),
+                     R"(,"args":{{"sequence":{},"age_ms":{:.3f}}})",
+                     sequence,
+                     static_cast<double>(end - source_time) / 1e6);
+    }
+    pending += "},\n";
+    if (pending.size() >= flush_size) {
+      chunks.push_back(std::move(pending));
+      pending = std::string{};
+      pending.reserve(flush_size * 2);
+      written.notify_one();
+    }
+  }
+};
+
+inline auto global() -> writer & {
+  static auto writer_ = writer{};
+  return writer_;
+}
+
+inline auto enabled() -> bool { return global().enabled(); }
+
+// Records from construction until it goes out of scope
+class span {
+private:
+  std::string_view name;
+  uint64_t start;
+  uint64_t sequence = 0;
+  uint64_t source_time = 0;
+
+public:
+  explicit span(std::string_view name)
+      : name{name}, start{enabled() ? now() : 0} {}
+
+  span(span const &) = delete;
+
+  ~span() {
+    if (start != 0) {
+      global().span(name, start, now(), sequence, source_time);
+    }
+  }
+
+  // Tags the span with a frame, so its age shows when the span ends
+  void set_frame(uint64_t sequence_, uint64_t source_time_) {
+    sequence = sequence_;
+    source_time = source_time_;
+  }
+};
+
+} // namespace trace
+
+#endif // TRACE_HPP
@@ -1,83 +1,558 @@
 #ifndef TRIPLE_BUFFER_HPP
 #define TRIPLE_BUFFER_HPP
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <utility>
+#include <vector>
 
-#include <boost/interprocess/offset_ptr.hpp>
 #include <boost/interprocess/sync/interprocess_condition_any.hpp>
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include "pipeline_stats.hpp"
+
+#if defined(__linux__)
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <thread>
+#endif
 
 namespace ipc = boost::interprocess;
 
+enum class pixel_format : uint32_t { bgra8 };
+
+// Written by the router when it creates the segment, every process that
+// attaches sizes its frames from this
+struct media_format {
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  uint32_t pitch = 1920 * 4;
+  pixel_format pixel = pixel_format::bgra8;
+  uint32_t frame_rate_num = 25;
+  uint32_t frame_rate_den = 1;
+  uint32_t sample_rate = 48'000;
+  uint32_t num_channels = 2;
+
+  auto video_size() const -> std::size_t {
+    return std::size_t{pitch} * height;
+  }
+
+  auto audio_samples_per_frame_per_channel() const -> std::size_t {
+    return std::size_t{sample_rate} * frame_rate_den / frame_rate_num;
+  }
+  auto audio_samples_per_frame_all_channels() const -> std::size_t {
+    return audio_samples_per_frame_per_channel() * num_channels;
+  }
+
+  auto frame_duration() const -> std::chrono::nanoseconds {
+    return std::chrono::nanoseconds{std::chrono::seconds{frame_rate_den}} /
+           frame_rate_num;
+  }
+
+  auto supported() const -> bool {
+    return pixel == pixel_format::bgra8 && width > 0 && height > 0 &&
+           pitch >= width * 4 && frame_rate_num > 0 && frame_rate_den > 0 &&
+           num_channels > 0;
+  }
+
+  friend auto operator==(media_format const &, media_format const &)
+      -> bool = default;
+
+  // Parses names like 1080p25 or 720p50, always 16:9 BGRA
+  static auto parse(std::string_view name) -> std::optional<media_format> {
+    auto format = media_format{};
+    auto const p = name.find('p');
+    if (p == std::string_view::npos) {
+      return std::nullopt;
+    }
+    auto const height = name.substr(0, p);
+    auto const rate = name.substr(p + 1);
+    if (std::from_chars(height.data(), height.data() + height.size(),
+                        format.height)
+                .ptr != height.data() + height.size() ||
+        std::from_chars(rate.data(), rate.data() + rate.size(),
+                        format.frame_rate_num)
+                .ptr != rate.data() + rate.size()) {
+      return std::nullopt;
+    }
+    format.width = format.height * 16 / 9;
+    format.pitch = format.width * 4;
+    if (!format.supported()) {
+      return std::nullopt;
+    }
+    return format;
+  }
+};
+
 class triple_buffer {
 public:
-  static constexpr auto width = 1920;
-  static constexpr auto pitch = width * 4;
-  static constexpr auto height = 1080;
-  static constexpr auto size = pitch * height;
+  // Lives in the segment, directly followed by its video and audio data
+  class buffer {
+  private:
+    static constexpr auto alignment = std::size_t{64};
+
+    static constexpr auto align(std::size_t size) -> std::size_t {
+      return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // Room for the sizes and header below, keeping the frame data cache line
+    // aligned
+    static constexpr auto video_offset = 2 * alignment;
+
+    std::size_t video_size;
+    std::size_t audio_size;
+
+    // Counts every frame written to the segment, without wrapping
+    uint64_t _sequence = 0;
+    // Steady clock nanoseconds when the oldest source of this frame was
+    // captured, zero until the writer sets it
+    uint64_t _source_time = 0;
+    // Steady clock nanoseconds when the frame was handed to the reader
+    uint64_t _produce_time = 0;
+    // Premultiplied BGRA, as one little endian word
+    uint32_t _solid_pixel = 0;
+    // Set when the whole frame is _solid_pixel and the video data was never
+    // written, so readers expand it only if they need the pixels
+    bool _solid = false;
+    // Set when the video data was never written and the frame is instead the
+    // one read from the segment named below, with the given sequence
+    bool _passthrough = false;
+    uint64_t _source_sequence = 0;
+    std::array<char, 48> _source_name{};
+    // Counts the writer taking and handing on this slot, odd while the
+    // writer has it, so a reader of another segment can check that a frame
+    // it copied out wasn't written over meanwhile
+    std::atomic<uint32_t> _writes = 0;
 
-  using video_frame_t = uint8_t[size];
+    // As the frame is handed to readers
+    void stamp(uint64_t sequence) {
+      _sequence = sequence;
+      _produce_time = pipeline_stats::now();
+      if (_source_time == 0) {
+        _source_time = _produce_time;
+      }
+    }
+
+    // As the slot is taken for the writer's next frame
+    void reset_header() {
+      _source_time = 0;
+      _solid = false;
+      _passthrough = false;
+    }
+
+    // Stamp and reset the header in done_writing, and count the writes
+    friend class triple_buffer;
+    friend class broadcast_buffer;
+
+    auto audio_offset() const -> std::size_t {
+      return video_offset + align(video_size);
+    }
+
+  public:
+    buffer(media_format const &format)
+        : video_size{format.video_size()},
+          audio_size{format.audio_samples_per_frame_all_channels()} {
+      static_assert(sizeof(buffer) <= video_offset);
+      clear();
+    }
+
+    buffer(buffer const &) = delete;
+
+    auto sequence() const -> uint64_t { return _sequence; }
+    auto source_time() const -> uint64_t { return _source_time; }
+    auto produce_time() const -> uint64_t { return _produce_time; }
+
+    // Producers call this when they know when their frame was captured,
+    // otherwise done_writing takes it as the time the frame was produced
+    void set_source_time(uint64_t time) { _source_time = time; }
+
+    // Publishes the frame as one colour instead of writing every pixel, for
+    // flat sources like colours and mattes
+    // Only until done_writing, the next frame written to this slot is
+    // pixels again unless it is set again
+    void set_solid(uint32_t pixel) {
+      _solid_pixel = pixel;
+      _solid = true;
+    }
+    auto solid() const -> std::optional<uint32_t> {
+      if (_solid) {
+        return _solid_pixel;
+      }
+      return std::nullopt;
+    }
 
-  static constexpr auto sample_rate = 48'000;
-  static constexpr auto frame_rate = 25;
-  static constexpr auto num_channels = 2;
-  static constexpr auto audio_samples_per_frame_per_channel =
-      sample_rate / frame_rate;
-  static constexpr auto audio_samples_per_frame_all_channels =
-      audio_samples_per_frame_per_channel * num_channels;
+    struct passthrough_source {
+      std::string_view name;
+      uint64_t sequence;
+    };
 
-  using audio_frame_t = int32_t[audio_samples_per_frame_all_channels];
+    // Publishes the frame as a reference to another segment's read frame
+    // instead of a copy, for readers that accept_passthrough
+    // Only until done_writing, like set_solid
+    void set_passthrough(std::string_view name, uint64_t sequence) {
+      if (name.size() > _source_name.size()) {
+        std::cerr << "Segment name too long to pass through: " << name
+                  << '\n';
+        std::terminate();
+      }
+      std::ranges::fill(std::ranges::copy(name, _source_name.begin()).out,
+                        _source_name.end(), '\0');
+      _source_sequence = sequence;
+      _passthrough = true;
+    }
+    auto passthrough() const -> std::optional<passthrough_source> {
+      if (_passthrough) {
+        auto const end = std::ranges::find(_source_name, '\0');
+        return passthrough_source{{_source_name.begin(), end},
+                                  _source_sequence};
+      }
+      return std::nullopt;
+    }
 
-  struct buffer {
-    uint8_t video_frame[size];
-    int32_t audio_frame[audio_samples_per_frame_all_channels];
+    static auto required_size(media_format const &format) -> std::size_t {
+      return video_offset + align(format.video_size()) +
+             align(format.audio_samples_per_frame_all_channels() *
+                   sizeof(int32_t));
+    }
+
+    auto video_frame() -> std::span<uint8_t> {
+      return {reinterpret_cast<uint8_t *>(this) + video_offset, video_size};
+    }
+    auto video_frame() const -> std::span<uint8_t const> {
+      return {reinterpret_cast<uint8_t const *>(this) + video_offset,
+              video_size};
+    }
+
+    auto audio_frame() -> std::span<int32_t> {
+      return {reinterpret_cast<int32_t *>(reinterpret_cast<std::byte *>(this) +
+                                          audio_offset()),
+              audio_size};
+    }
+    auto audio_frame() const -> std::span<int32_t const> {
+      return {reinterpret_cast<int32_t const *>(
+                  reinterpret_cast<std::byte const *>(this) + audio_offset()),
+              audio_size};
+    }
 
     void clear() {
-      std::fill(std::begin(video_frame), std::end(video_frame), 0);
-      std::fill(std::begin(audio_frame), std::end(audio_frame), 0);
+      std::ranges::fill(video_frame(), 0);
+      std::ranges::fill(audio_frame(), 0);
+      _solid = false;
+      _passthrough = false;
+    }
+  };
+
+  // A buffer on the heap, for producers that prepare frames ahead of time
+  class frame {
+  private:
+    media_format _format;
+    std::vector<uint8_t> video;
+    std::vector<int32_t> audio;
+
+  public:
+    frame(media_format const &format)
+        : _format{format}, video(format.video_size()),
+          audio(format.audio_samples_per_frame_all_channels()) {}
+
+    auto format() const -> media_format const & { return _format; }
+
+    auto video_frame() -> std::span<uint8_t> { return video; }
+    auto video_frame() const -> std::span<uint8_t const> { return video; }
+    auto audio_frame() -> std::span<int32_t> { return audio; }
+    auto audio_frame() const -> std::span<int32_t const> { return audio; }
+
+    void copy_to(buffer &dst) const {
+      std::ranges::copy(video, dst.video_frame().begin());
+      std::ranges::copy(audio, dst.audio_frame().begin());
     }
   };
 
 private:
-  ipc::interprocess_mutex mutex;
+  // Bumped whenever the layout of the segment changes
+  static constexpr auto layout_version = uint32_t{11};
+
+  // The buffer handed between writer and reader, with a flag set when it
+  // holds a frame the reader hasn't picked up yet and the frame's sequence
+  // number above that
+  // Exchanging this is the only synchronisation, so a process that dies
+  // part way through a frame can't leave the segment locked
+  static constexpr auto index_mask = uint32_t{0b1111};
+  static constexpr auto fresh = uint32_t{0b10000};
+  static constexpr auto sequence_shift = 5;
+  static constexpr auto sequence_mask = ~uint32_t{0} >> sequence_shift;
+
+  static_assert(std::atomic<uint32_t>::is_always_lock_free,
+                "The shared index must be address free");
+
+  uint32_t _layout_version = layout_version;
+  media_format _format;
+  // Slots beyond the three, for a reader that keeps frames after it has read
+  // past them
+  uint32_t _held_slots;
+
   ipc::interprocess_condition_any sync;
 
-  std::array<buffer, 3> buffers;
-  ipc::offset_ptr<buffer> _read;
-  ipc::offset_ptr<buffer> read_next;
-  ipc::offset_ptr<buffer> _write;
-  ipc::offset_ptr<buffer> write_next;
+  alignas(64) std::atomic<uint32_t> middle;
+  // Readers blocked in wait_for_novel, so the writer can skip waking nobody
+  std::atomic<uint32_t> waiters;
+  // Each only touched by its own side
+  alignas(64) uint32_t read_index;
+  uint32_t _read_sequence;
+  bool read_held;
+  // Bit per slot the reader has to swap in for a held read slot, set again
+  // from whichever thread lets go of it
+  std::atomic<uint32_t> free_slots;
+  alignas(64) uint32_t write_index;
+  uint64_t write_sequence;
+  uint32_t published_index;
+
+  // Set by the reader when it follows passed through frames, the writer
+  // copies frames in otherwise
+  std::atomic<bool> _accepts_passthrough;
+
+  pipeline_stats _stats;
+
+  static constexpr auto header_size() -> std::size_t {
+    return (sizeof(triple_buffer) + 63) / 64 * 64;
+  }
+
+  auto buffer_at(std::size_t i) -> buffer * {
+    return reinterpret_cast<buffer *>(reinterpret_cast<std::byte *>(this) +
+                                      header_size() +
+                                      i * buffer::required_size(_format));
+  }
+  auto buffer_at(std::size_t i) const -> buffer const * {
+    return const_cast<triple_buffer *>(this)->buffer_at(i);
+  }
 
 public:
-  triple_buffer()
-      : buffers{}, _read{&buffers[0]}, read_next{&buffers[0]},
-        _write{&buffers[1]}, write_next{&buffers[2]} {}
+  static constexpr auto max_held_slots = std::size_t{index_mask + 1 - 3};
+
+  // The segment must be at least required_size(format, held_slots) bytes
+  triple_buffer(media_format const &format = {}, std::size_t held_slots = 0)
+      : _format{format}, _held_slots{static_cast<uint32_t>(held_slots)} {
+    if (held_slots > max_held_slots) {
+      std::cerr << "Too many held slots: " << held_slots << '\n';
+      std::terminate();
+    }
+    for (std::size_t i = 0; i < slots(); i += 1) {
+      ::new (buffer_at(i)) buffer{_format};
+    }
+    read_index = 0;
+    _read_sequence = 0;
+    read_held = false;
+    free_slots = ((uint32_t{1} << _held_slots) - 1) << 3;
+    write_index = 1;
+    write_sequence = 0;
+    published_index = 2;
+    middle = 2;
+    waiters = 0;
+    _accepts_passthrough = false;
+    write()._writes.store(1, std::memory_order_relaxed);
+  }
+
+  triple_buffer(triple_buffer const &) = delete;
+
+  static auto required_size(media_format const &format = {},
+                            std::size_t held_slots = 0) -> std::size_t {
+    return header_size() + (3 + held_slots) * buffer::required_size(format);
+  }
+
+  // Checked by processes attaching to a segment created by the router
+  auto compatible(std::size_t segment_size) const -> bool {
+    return _layout_version == layout_version && _format.supported() &&
+           _held_slots <= max_held_slots &&
+           segment_size >= required_size(_format, _held_slots);
+  }
+
+  auto format() const -> media_format const & { return _format; }
+  // Every slot hold can hand out is below this
+  auto slots() const -> std::size_t { return 3 + std::size_t{_held_slots}; }
 
-  auto novel_to_read() const {
-    std::atomic_thread_fence(std::memory_order_seq_cst);
-    return _read != read_next;
+  auto stats() -> pipeline_stats & { return _stats; }
+  auto stats() const -> pipeline_stats const & { return _stats; }
+
+  auto novel_to_read() const -> bool {
+    return (middle.load(std::memory_order_relaxed) & fresh) != 0;
+  }
+
+  // Returns whether read() now refers to a newly written frame
+  // A held read slot is swapped for a free one, if none is free the reader
+  // stays on the frame it has
+  auto about_to_read() -> bool {
+    if (!novel_to_read()) {
+      _stats.record_repeated();
+      return false;
+    }
+    auto given = read_index;
+    if (read_held) {
+      auto free = free_slots.load(std::memory_order_acquire);
+      do {
+        if (free == 0) {
+          _stats.record_repeated();
+          return false;
+        }
+      } while (!free_slots.compare_exchange_weak(free, free & (free - 1),
+                                                 std::memory_order_acquire));
+      given = static_cast<uint32_t>(std::countr_zero(free));
+      read_held = false;
+    }
+    auto const previous = middle.exchange(given, std::memory_order_acq_rel);
+    auto const sequence = previous >> sequence_shift;
+    read_index = previous & index_mask;
+    _stats.record_read(frames_between(_read_sequence, sequence) - 1);
+    _read_sequence = sequence;
+    return true;
+  }
+
+  // A frame of this segment as found by a reader of another segment that
+  // was passed a reference to it, with the slot's write count at the time
+  struct borrowed {
+    buffer const *frame;
+    uint32_t writes;
+  };
+
+  // The frame with that sequence if it is still in a slot and not being
+  // written over, found without holding anything, so neither this segment's
+  // reader nor its writer ever waits for the borrower, and a borrower that
+  // dies leaves nothing behind
+  // Copy the frame out and then check it is still intact before using it
+  auto borrow(uint64_t sequence) const -> std::optional<borrowed> {
+    for (std::size_t i = 0; i < slots(); i += 1) {
+      auto const *frame = buffer_at(i);
+      auto const writes = frame->_writes.load(std::memory_order_acquire);
+      if (writes % 2 == 0 && frame->sequence() == sequence) {
+        return borrowed{frame, writes};
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Whether the writer left a borrowed frame alone until now
+  auto intact(borrowed const &borrowed_) const -> bool {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return borrowed_.frame->_writes.load(std::memory_order_relaxed) ==
+           borrowed_.writes;
+  }
+
+  void accept_passthrough() {
+    _accepts_passthrough.store(true, std::memory_order_relaxed);
+  }
+  auto accepts_passthrough() const -> bool {
+    return _accepts_passthrough.load(std::memory_order_relaxed);
+  }
+
+  // Counts frames written, wrapping at 2^27, so the reader can tell how many
+  // it missed between two reads
+  auto read_sequence() const -> uint32_t { return _read_sequence; }
+  static auto frames_between(uint32_t earlier, uint32_t later) -> uint32_t {
+    return (later - earlier) & sequence_mask;
   }
 
-  void about_to_read() {
-    auto lock = ipc::scoped_lock{mutex};
-    if (_read != read_next) {
-      write_next = _read;
+  // Blocks until there is a new frame or the timeout passes, returns whether
+  // there is a new frame
+  // On Linux this sleeps on a futex on the shared index, elsewhere it polls
+  auto wait_for_novel(std::chrono::nanoseconds timeout) -> bool {
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+      auto const current = middle.load(std::memory_order_seq_cst);
+      if ((current & fresh) != 0) {
+        return true;
+      }
+      auto const remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining <= std::chrono::nanoseconds::zero()) {
+        return false;
+      }
+#if defined(__linux__)
+      auto const ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining)
+              .count();
+      auto const timeout_ = timespec{static_cast<time_t>(ns / 1'000'000'000),
+                                     static_cast<long>(ns % 1'000'000'000)};
+      waiters.fetch_add(1, std::memory_order_seq_cst);
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&middle), FUTEX_WAIT,
+              current, &timeout_, nullptr, 0);
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+#else
+      std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+          remaining, std::chrono::milliseconds{1}));
+#endif
     }
-    _read = read_next;
-    std::atomic_thread_fence(std::memory_order_seq_cst);
   }
 
+  // If the reader hasn't picked up the last frame it is overwritten
   void done_writing() {
-    auto lock = ipc::scoped_lock{mutex};
-    std::atomic_thread_fence(std::memory_order_seq_cst);
-    read_next = _write;
-    std::swap(_write, write_next);
+    _stats.record_write();
+    write_sequence += 1;
+
+    write().stamp(write_sequence);
+    write()._writes.fetch_add(1, std::memory_order_release);
+
+    auto const previous = middle.exchange(
+        write_index | fresh |
+            static_cast<uint32_t>(write_sequence & sequence_mask)
+                << sequence_shift,
+        std::memory_order_seq_cst);
+    published_index = write_index;
+    write_index = previous & index_mask;
+    // Marked as being written before any of it is, for borrowers
+    write()._writes.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    write().reset_header();
+#if defined(__linux__)
+    if (waiters.load(std::memory_order_seq_cst) != 0) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&middle), FUTEX_WAKE,
+              INT32_MAX, nullptr, nullptr, 0);
+    }
+#endif
   }
 
-  auto read() const -> buffer const & { return *_read; }
-  auto write() -> buffer & { return *_write; }
+  auto read() const -> buffer const & { return *buffer_at(read_index); }
+  // Nothing else touches the read frame until the next about_to_read, so the
+  // reader may fill it in, say with a frame passed through
+  auto read() -> buffer & { return *buffer_at(read_index); }
+  auto write() -> buffer & { return *buffer_at(write_index); }
+  // The frame last handed on, which only comes back to the writer in its
+  // next done_writing, so the writer may look at it until then
+  // A reader may copy a passed through frame's pixels in meanwhile
+  auto published() const -> buffer const & {
+    return *buffer_at(published_index);
+  }
+
+  // Keeps the read frame where it is after the reader moves on, for readers
+  // that hand it on to something that reads it later, like a card's queue
+  // Only for a segment made with held slots, returns the slot to release
+  auto hold() -> std::size_t {
+    read_held = true;
+    return read_index;
+  }
+  // The frame in a held slot, still there until it is released
+  auto held(std::size_t slot) const -> buffer const & {
+    return *buffer_at(slot);
+  }
+  // Safe from any thread, once nothing reads the slot any more
+  void release(std::size_t slot) {
+    free_slots.fetch_or(uint32_t{1} << slot, std::memory_order_release);
+  }
+  // Whether about_to_read has a slot to swap in for a held read slot
+  auto slot_free_to_read() const -> bool {
+    return !read_held || free_slots.load(std::memory_order_relaxed) != 0;
+  }
 
   void trigger_sync() { sync.notify_all(); }
 
@@ -1,19 +1,14 @@
-fn main() -> miette::Result<()> {
+fn main() {
     let boost_path = "/usr/local/Cellar/boost/1.81.0_1/include";
 
-    let paths = [
-        std::path::PathBuf::from(boost_path),
-        std::path::PathBuf::from("."),
-    ]; // include path
-    let mut b = autocxx_build::Builder::new("src/lib.rs", &paths)
-        .extra_clang_args(&["--std=c++20"])
-        .build()?;
-    // This assumes all your C++ bindings are in main.rs
-    b.flag_if_supported("--std=c++20")
+    cpp_build::Config::new()
         .include(boost_path)
-        .compile("autocxx-demo"); // arbitrary library name, pick anything
+        .include(".")
+        .flag_if_supported("--std=c++20")
+        .build("src/lib.rs");
 
     println!("cargo:rerun-if-changed=src/lib.rs");
+    println!("cargo:rerun-if-changed=../broadcast_buffer.hpp");
+    println!("cargo:rerun-if-changed=../pipeline_stats.hpp");
     println!("cargo:rerun-if-changed=../triple_buffer.hpp");
-    Ok(())
 }
@@ -1,29 +1,192 @@
-autocxx::include_cpp! {
+// The segments have a tail sized from their format at runtime, so they are
+// only ever handled through references into the mapping and every accessor
+// goes through the C++ side
+cpp::cpp! {{
+    #include <cstddef>
+    #include <cstdint>
+    #include <type_traits>
+
+    #include "../broadcast_buffer.hpp"
     #include "../triple_buffer.hpp"
-    generate!("triple_buffer")
-    generate_pod!("triple_buffer_buffer")
-}
 
+    static_assert(std::is_trivially_copyable_v<media_format> &&
+                  std::is_standard_layout_v<media_format> &&
+                  sizeof(media_format) == 8 * sizeof(uint32_t),
+                  "MediaFormat must mirror media_format");
+}}
+
+use core::marker::PhantomPinned;
 use core::pin::Pin;
 
-pub use ffi::triple_buffer as CppTripleBuffer;
-pub use ffi::triple_buffer_buffer as Buffer;
+// Mirrors media_format in triple_buffer.hpp, written by the router when it
+// creates the segment
+#[repr(C)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct MediaFormat {
+    pub width: u32,
+    pub height: u32,
+    // Bytes from the start of one row to the next
+    pub pitch: u32,
+    pub pixel: PixelFormat,
+    pub frame_rate_num: u32,
+    pub frame_rate_den: u32,
+    pub sample_rate: u32,
+    pub num_channels: u32,
+}
+
+const _: () = assert!(core::mem::size_of::<MediaFormat>() == 8 * 4);
+
+#[repr(u32)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PixelFormat {
+    Bgra8 = 0,
+}
+
+impl MediaFormat {
+    pub fn video_size(&self) -> usize {
+        self.pitch as usize * self.height as usize
+    }
+
+    pub fn audio_samples_per_frame_per_channel(&self) -> usize {
+        self.sample_rate as usize * self.frame_rate_den as usize / self.frame_rate_num as usize
+    }
 
-impl Unpin for Buffer {}
+    pub fn audio_samples_per_frame_all_channels(&self) -> usize {
+        self.audio_samples_per_frame_per_channel() * self.num_channels as usize
+    }
 
-pub const WIDTH: usize = 1920;
-pub const PITCH: usize = WIDTH * 4;
-pub const HEIGHT: usize = 1080;
-pub const SIZE: usize = PITCH * HEIGHT;
+    pub fn frame_duration(&self) -> core::time::Duration {
+        core::time::Duration::from_secs(self.frame_rate_den as u64) / self.frame_rate_num
+    }
+}
 
-pub const SAMPLE_RATE: usize = 48_000;
-pub const FRAME_RATE: usize = 25;
-pub const NUM_CHANNELS: usize = 2;
-pub const AUDIO_SAMPLES_PER_FRAME_PER_CHANNEL: usize = SAMPLE_RATE / FRAME_RATE;
-pub const AUDIO_SAMPLES_PER_FRAME_ALL_CHANNELS: usize = AUDIO_SAMPLES_PER_FRAME_PER_CHANNEL * NUM_CHANNELS;
+// A triple_buffer as mapped, the reader's side for outputs
+#[repr(C)]
+pub struct CppTripleBuffer {
+    _opaque: [u8; 0],
+    _pinned: PhantomPinned,
+}
+
+// A broadcast_buffer as mapped, the writer's side for inputs
+#[repr(C)]
+pub struct CppBroadcastBuffer {
+    _opaque: [u8; 0],
+    _pinned: PhantomPinned,
+}
 
-pub type VideoFrame = [u8; SIZE];
-pub type AudioFrame = [i32; AUDIO_SAMPLES_PER_FRAME_ALL_CHANNELS];
+// One frame in a segment, its video and audio sized by the segment's format
+#[repr(C)]
+pub struct Buffer {
+    _opaque: [u8; 0],
+    _pinned: PhantomPinned,
+}
+
+impl ipc_shared_object::Segment for CppTripleBuffer {
+    fn compatible(&self, segment_size: usize) -> bool {
+        let this = self as *const CppTripleBuffer;
+        unsafe {
+            cpp::cpp!([this as "triple_buffer const *", segment_size as "std::size_t"] -> bool as "bool" {
+                return this->compatible(segment_size);
+            })
+        }
+    }
+}
+
+impl ipc_shared_object::Segment for CppBroadcastBuffer {
+    fn compatible(&self, segment_size: usize) -> bool {
+        let this = self as *const CppBroadcastBuffer;
+        unsafe {
+            cpp::cpp!([this as "broadcast_buffer const *", segment_size as "std::size_t"] -> bool as "bool" {
+                return this->compatible(segment_size);
+            })
+        }
+    }
+}
+
+impl Buffer {
+    pub fn sequence(&self) -> u64 {
+        let this = self as *const Buffer;
+        unsafe {
+            cpp::cpp!([this as "triple_buffer::buffer const *"] -> u64 as "uint64_t" {
+                return this->sequence();
+            })
+        }
+    }
+
+    // Marks the frame as every pixel this colour, in BGRA, without touching
+    // its pixels, until done_writing
+    pub fn set_solid(self: Pin<&mut Self>, pixel: u32) {
+        unsafe {
+            let this = self.get_unchecked_mut() as *mut Buffer;
+            cpp::cpp!([this as "triple_buffer::buffer *", pixel as "uint32_t"] {
+                this->set_solid(pixel);
+            })
+        }
+    }
+
+    pub fn video_frame(&self) -> &[u8] {
+        let this = self as *const Buffer;
+        unsafe {
+            let data = cpp::cpp!([this as "triple_buffer::buffer const *"] -> *const u8 as "uint8_t const *" {
+                return this->video_frame().data();
+            });
+            let size = cpp::cpp!([this as "triple_buffer::buffer const *"] -> usize as "std::size_t" {
+                return this->video_frame().size();
+            });
+            core::slice::from_raw_parts(data, size)
+        }
+    }
+
+    pub fn video_frame_mut(self: Pin<&mut Self>) -> &mut [u8] {
+        unsafe {
+            let this = self.get_unchecked_mut() as *mut Buffer;
+            let data = cpp::cpp!([this as "triple_buffer::buffer *"] -> *mut u8 as "uint8_t *" {
+                return this->video_frame().data();
+            });
+            let size = cpp::cpp!([this as "triple_buffer::buffer *"] -> usize as "std::size_t" {
+                return this->video_frame().size();
+            });
+            core::slice::from_raw_parts_mut(data, size)
+        }
+    }
+
+    // Interleaved by channel
+    pub fn audio_frame(&self) -> &[i32] {
+        let this = self as *const Buffer;
+        unsafe {
+            let data = cpp::cpp!([this as "triple_buffer::buffer const *"] -> *const i32 as "int32_t const *" {
+                return this->audio_frame().data();
+            });
+            let size = cpp::cpp!([this as "triple_buffer::buffer const *"] -> usize as "std::size_t" {
+                return this->audio_frame().size();
+            });
+            core::slice::from_raw_parts(data, size)
+        }
+    }
+
+    pub fn audio_frame_mut(self: Pin<&mut Self>) -> &mut [i32] {
+        unsafe {
+            let this = self.get_unchecked_mut() as *mut Buffer;
+            let data = cpp::cpp!([this as "triple_buffer::buffer *"] -> *mut i32 as "int32_t *" {
+                return this->audio_frame().data();
+            });
+            let size = cpp::cpp!([this as "triple_buffer::buffer *"] -> usize as "std::size_t" {
+                return this->audio_frame().size();
+            });
+            core::slice::from_raw_parts_mut(data, size)
+        }
+    }
+
+    // Both at once, for filling a frame in one go
+    pub fn frames_mut(self: Pin<&mut Self>) -> (&mut [u8], &mut [i32]) {
+        unsafe {
+            let this = self.get_unchecked_mut();
+            let video = Pin::new_unchecked(&mut *(this as *mut Buffer)).video_frame_mut();
+            let audio = Pin::new_unchecked(&mut *(this as *mut Buffer)).audio_frame_mut();
+            (video, audio)
+        }
+    }
+}
 
 pub struct TripleBuffer<'a> {
     data: Pin<&'a mut CppTripleBuffer>,
@@ -34,31 +197,164 @@ impl TripleBuffer<'_> {
         TripleBuffer { data: data }
     }
 
-    pub fn novel_to_read(&mut self) -> bool {
-        unsafe { self.data.as_mut().novel_to_read() }
+    fn this(&self) -> *const CppTripleBuffer {
+        &*self.data as *const CppTripleBuffer
     }
 
-    pub fn about_to_read(&mut self) {
-        unsafe { self.data.as_mut().about_to_read() }
+    fn this_mut(&mut self) -> *mut CppTripleBuffer {
+        unsafe { self.data.as_mut().get_unchecked_mut() as *mut CppTripleBuffer }
+    }
+
+    pub fn format(&self) -> MediaFormat {
+        let this = self.this();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer const *"] -> MediaFormat as "media_format" {
+                return this->format();
+            })
+        }
+    }
+
+    pub fn novel_to_read(&self) -> bool {
+        let this = self.this();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer const *"] -> bool as "bool" {
+                return this->novel_to_read();
+            })
+        }
+    }
+
+    pub fn about_to_read(&mut self) -> bool {
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer *"] -> bool as "bool" {
+                return this->about_to_read();
+            })
+        }
+    }
+
+    // Blocks until there is a new frame or the timeout passes, returns whether
+    // there is a new frame
+    pub fn wait_for_novel(&mut self, timeout: core::time::Duration) -> bool {
+        let this = self.this_mut();
+        let timeout_ns = timeout.as_nanos().min(i64::MAX as u128) as i64;
+        unsafe {
+            cpp::cpp!([this as "triple_buffer *", timeout_ns as "int64_t"] -> bool as "bool" {
+                return this->wait_for_novel(std::chrono::nanoseconds{timeout_ns});
+            })
+        }
     }
 
     pub fn done_writing(&mut self) {
-        unsafe { self.data.as_mut().done_writing() }
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer *"] {
+                this->done_writing();
+            })
+        }
     }
 
     pub fn trigger_sync(&mut self) {
-        unsafe { self.data.as_mut().trigger_sync() }
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer *"] {
+                this->trigger_sync();
+            })
+        }
     }
 
     pub fn wait_for_sync(&mut self) {
-        unsafe { self.data.as_mut().wait_for_sync() }
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "triple_buffer *"] {
+                this->wait_for_sync();
+            })
+        }
     }
 
     pub fn read<'a>(&'a self) -> &'a Buffer {
-        unsafe { self.data.read() }
+        let this = self.this();
+        unsafe {
+            &*cpp::cpp!([this as "triple_buffer const *"] -> *const Buffer as "triple_buffer::buffer const *" {
+                return &this->read();
+            })
+        }
+    }
+
+    pub fn write<'a>(&'a mut self) -> Pin<&'a mut Buffer> {
+        let this = self.this_mut();
+        unsafe {
+            Pin::new_unchecked(
+                &mut *cpp::cpp!([this as "triple_buffer *"] -> *mut Buffer as "triple_buffer::buffer *" {
+                    return &this->write();
+                }),
+            )
+        }
+    }
+}
+
+// The writer of an input, the readers are the router and anything else that
+// attaches on the C++ side
+pub struct BroadcastBuffer<'a> {
+    data: Pin<&'a mut CppBroadcastBuffer>,
+}
+
+impl BroadcastBuffer<'_> {
+    pub fn new(data: Pin<&mut CppBroadcastBuffer>) -> BroadcastBuffer {
+        BroadcastBuffer { data: data }
+    }
+
+    fn this(&self) -> *const CppBroadcastBuffer {
+        &*self.data as *const CppBroadcastBuffer
+    }
+
+    fn this_mut(&mut self) -> *mut CppBroadcastBuffer {
+        unsafe { self.data.as_mut().get_unchecked_mut() as *mut CppBroadcastBuffer }
+    }
+
+    pub fn format(&self) -> MediaFormat {
+        let this = self.this();
+        unsafe {
+            cpp::cpp!([this as "broadcast_buffer const *"] -> MediaFormat as "media_format" {
+                return this->format();
+            })
+        }
+    }
+
+    pub fn done_writing(&mut self) {
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "broadcast_buffer *"] {
+                this->done_writing();
+            })
+        }
+    }
+
+    pub fn trigger_sync(&mut self) {
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "broadcast_buffer *"] {
+                this->trigger_sync();
+            })
+        }
+    }
+
+    pub fn wait_for_sync(&mut self) {
+        let this = self.this_mut();
+        unsafe {
+            cpp::cpp!([this as "broadcast_buffer *"] {
+                this->wait_for_sync();
+            })
+        }
     }
 
-    pub fn write<'a>(&'a mut self) -> &'a mut Buffer {
-        unsafe { self.data.as_mut().write().get_mut() }
+    pub fn write<'a>(&'a mut self) -> Pin<&'a mut Buffer> {
+        let this = self.this_mut();
+        unsafe {
+            Pin::new_unchecked(
+                &mut *cpp::cpp!([this as "broadcast_buffer *"] -> *mut Buffer as "broadcast_buffer::buffer *" {
+                    return &this->write();
+                }),
+            )
+        }
     }
 }
@@ -1,4 +1,5 @@
 
+#include "broadcast_buffer.hpp"
 #include "ipc_shared_object.hpp"
 #include "server/server.hpp"
 #include "triple_buffer.hpp"
@@ -75,7 +76,7 @@ public:
 };
 
 int main(int argc, char **argv) {
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto vlc = VLC::Instance{argc, argv};
 
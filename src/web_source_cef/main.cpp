@@ -3,8 +3,9 @@
 #include "include/cef_app.h"
 #include "include/cef_command_line.h"
 
+#include "../broadcast_buffer.hpp"
 #include "../ipc_shared_object.hpp"
-#include "../triple_buffer.hpp"
+#include "../trace.hpp"
 
 #include "../server/server.hpp"
 
@@ -138,14 +139,14 @@ class Client : public CefClient,
 
 private:
   CefRefPtr<CefBrowser> &_browser;
-  std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer;
+  std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer;
   CefString &_title;
   CefString &_url;
   std::function<void()> &reload_clients;
 
 public:
   Client(CefRefPtr<CefBrowser> &browser,
-         std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer,
+         std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer,
          CefString &title, CefString &url,
          std::function<void()> &reload_clients)
       : _browser{browser}, output_buffer{output_buffer}, _title{title},
@@ -181,19 +182,22 @@ public:
   }
 
   // CefRenderHandler methods
+  auto view_rect() const -> CefRect {
+    auto const format =
+        output_buffer ? (*output_buffer)->format() : media_format{};
+    return {0, 0, static_cast<int>(format.width),
+            static_cast<int>(format.height)};
+  }
+
   auto GetScreenInfo(CefRefPtr<CefBrowser> browser, CefScreenInfo &screen_info)
       -> bool override {
-    screen_info = {1.0,
-                   32,
-                   8,
-                   false,
-                   {0, 0, triple_buffer::width, triple_buffer::height},
-                   {0, 0, triple_buffer::width, triple_buffer::height}};
+    auto const rect = view_rect();
+    screen_info = {1.0, 32, 8, false, rect, rect};
     return true;
   }
 
   void GetViewRect(CefRefPtr<CefBrowser> browser, CefRect &rect) override {
-    rect = {0, 0, triple_buffer::width, triple_buffer::height};
+    rect = view_rect();
   }
 
   void OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType type,
@@ -201,9 +205,23 @@ public:
                int height) override {
     auto typed_buffer = static_cast<uint8_t const *>(buffer);
     if (output_buffer) {
-      std::copy(typed_buffer, typed_buffer + triple_buffer::size,
-                std::begin((*output_buffer)->write().video_frame));
+      auto span = trace::span{"produce"};
+      auto const &format = (*output_buffer)->format();
+      auto &written = (*output_buffer)->write();
+      auto video_frame = written.video_frame();
+      auto const rows =
+          std::min(static_cast<std::size_t>(height), std::size_t{format.height});
+      auto const row_bytes = std::min(static_cast<std::size_t>(width) * 4,
+                                      std::size_t{format.width} * 4);
+      {
+        auto const timer = (*output_buffer)->stats().copy.time();
+        for (std::size_t y = 0; y < rows; y += 1) {
+          std::copy_n(typed_buffer + y * static_cast<std::size_t>(width) * 4,
+                      row_bytes, video_frame.begin() + y * format.pitch);
+        }
+      }
       (*output_buffer)->done_writing();
+      span.set_frame(written.sequence(), written.source_time());
     }
   }
 };
@@ -214,14 +232,14 @@ class App : public CefApp, CefBrowserProcessHandler {
 
 private:
   CefRefPtr<CefBrowser> &_browser;
-  std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer;
+  std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer;
   CefString &_title;
   CefString &_url;
   std::function<void()> &reload_clients;
 
 public:
   App(CefRefPtr<CefBrowser> &browser,
-      std::optional<ipc_unmanaged_object<triple_buffer>> &output_buffer,
+      std::optional<ipc_unmanaged_object<broadcast_buffer>> &output_buffer,
       CefString &title, CefString &url, std::function<void()> &reload_clients)
       : _browser{browser}, output_buffer{output_buffer}, _title{title},
         _url{url}, reload_clients{reload_clients} {}
@@ -360,7 +378,7 @@ auto main(int argc, char **argv) -> int {
 
   auto browser = CefRefPtr<CefBrowser>{};
 
-  auto output_buffer = std::optional<ipc_unmanaged_object<triple_buffer>>{};
+  auto output_buffer = std::optional<ipc_unmanaged_object<broadcast_buffer>>{};
 
   auto const name = argc >= 2 ? std::string_view{argv[1]} : "Web Source"sv;
   auto title = CefString{};
@@ -412,6 +430,10 @@ auto main(int argc, char **argv) -> int {
         auto name = std::string{static_cast<char const *>(buffer.data().data()),
                                 buffer.data().size()};
         output_buffer.emplace(name.c_str());
+        if (browser) {
+          // The view size comes from the format of the router's buffer
+          browser->GetHost()->WasResized();
+        }
       });
   auto router_websocket = server_.connect_to_websocket(
       router_websocket_delegate_, "127.0.0.1", 8080,
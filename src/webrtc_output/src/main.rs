@@ -245,6 +245,16 @@ async fn encoder(
     let mut cpp_input_buffer: IpcUnmanagedObject<triple_buffer::CppTripleBuffer> =
         IpcUnmanagedObject::new(name);
     let mut input_buffer = TripleBuffer::new(cpp_input_buffer.get_mut());
+    let format = input_buffer.format();
+    let width = format.width as i32;
+    let height = format.height as i32;
+    if format.pitch != format.width * 4 {
+        panic!("Rows padded past the width aren't supported");
+    }
+    let time_base = ffmpeg::AVRational {
+        num: format.frame_rate_den as i32,
+        den: format.frame_rate_num as i32,
+    };
 
     let video_track = std::sync::Arc::new(TrackLocalStaticSample::new(
         RTCRtpCodecCapability {
@@ -261,14 +271,16 @@ async fn encoder(
     };
     println!("Using codec {}", codec.long_name());
     let mut scaler = ffmpeg::Scaler::new(
-        1920,
-        1080,
+        width,
+        height,
         ffmpeg::AV_PIX_FMT_BGRA,
-        1920,
-        1080,
+        width,
+        height,
         ffmpeg::AV_PIX_FMT_YUV420P,
     );
-    let Ok(mut encoder) = ffmpeg::Encoder::new(&codec, ffmpeg::AV_PIX_FMT_YUV420P) else {
+    let Ok(mut encoder) =
+        ffmpeg::Encoder::new(&codec, ffmpeg::AV_PIX_FMT_YUV420P, width, height, time_base)
+    else {
         panic!("Can't create encoder");
     };
 
@@ -296,7 +308,7 @@ async fn encoder(
         }
     });
 
-    let mut ticker = tokio::time::interval(Duration::from_millis(1000 / 25));
+    let mut ticker = tokio::time::interval(format.frame_duration());
     let mut pts = 1;
     loop {
         input_buffer.about_to_read();
@@ -304,18 +316,18 @@ async fn encoder(
         let bgra_frame = ffmpeg::Frame::new();
         bgra_frame
             .fill(
-                &input_buffer.read().video_frame,
+                input_buffer.read().video_frame(),
                 ffmpeg::AV_PIX_FMT_BGRA,
-                1920,
-                1080,
+                width,
+                height,
                 1,
                 pts,
-                ffmpeg::AVRational { num: 1, den: 25 },
+                time_base,
             )
             .unwrap();
         let mut yuv420_frame = scaler.scale(&bgra_frame).unwrap();
         *yuv420_frame.pts() = pts;
-        *yuv420_frame.time_base() = ffmpeg::AVRational { num: 1, den: 25 };
+        *yuv420_frame.time_base() = time_base;
 
         encoder.send(&yuv420_frame).unwrap();
 
@@ -323,7 +335,7 @@ async fn encoder(
             video_track
                 .write_sample(&webrtc::media::Sample {
                     data: bytes::Bytes::copy_from_slice(packet.data()),
-                    duration: Duration::from_millis(1000 / 25),
+                    duration: format.frame_duration(),
                     ..Default::default()
                 })
                 .await
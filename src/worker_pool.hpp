@@ -0,0 +1,94 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a batch of indexed tasks across a fixed set of threads, the calling
+// thread joins in and run returns once every task has finished
+class worker_pool {
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+
+  std::function<void(std::size_t)> const *task = nullptr;
+  std::size_t num_tasks = 0;
+  std::atomic<std::size_t> next_task = 0;
+  std::size_t busy_workers = 0;
+  std::size_t generation = 0;
+  bool stopping = false;
+
+  void work() {
+    for (auto i = next_task.fetch_add(1); i < num_tasks;
+         i = next_task.fetch_add(1)) {
+      (*task)(i);
+    }
+  }
+
+public:
+  worker_pool(worker_pool const &) = delete;
+
+  explicit worker_pool(std::size_t num_threads) {
+    for (std::size_t i = 1; i < num_threads; i += 1) {
+      workers.emplace_back([this] {
+        auto seen = std::size_t{0};
+        while (true) {
+          {
+            auto lock = std::unique_lock{mutex};
+            start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+              return;
+            }
+            seen = generation;
+          }
+          work();
+          {
+            auto lock = std::scoped_lock{mutex};
+            busy_workers -= 1;
+          }
+          done.notify_one();
+        }
+      });
+    }
+  }
+
+  ~worker_pool() {
+    {
+      auto lock = std::scoped_lock{mutex};
+      stopping = true;
+    }
+    start.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  auto num_threads() const -> std::size_t { return workers.size() + 1; }
+
+  void run(std::size_t count, std::function<void(std::size_t)> const &f) {
+    {
+      auto lock = std::scoped_lock{mutex};
+      task = &f;
+      num_tasks = count;
+      next_task = 0;
+      busy_workers = workers.size();
+      generation += 1;
+    }
+    start.notify_all();
+
+    work();
+
+    auto lock = std::unique_lock{mutex};
+    done.wait(lock, [&] { return busy_workers == 0; });
+  }
+};
+
+#endif // WORKER_POOL_HPP